@@ -0,0 +1,907 @@
+#include "fxpo_common.h"
+#include "fxpo_log.h"
+#include "fxpo_alloc.h"
+#include "fxpo_http.h"
+#include "fxpo_provider.h"
+#include "fxpo_nvtt3.h"
+#include "fxpo_resize.h"
+#include "fxpo_tile.h"
+#include "fxpo_thread.h"
+#include "fxpo_build.h"
+
+#define MAX_TILESET_LENGTH         16
+#define CONTEXT_INITIAL_QUEUE_SIZE 64
+
+struct fxpo_job_t {
+  uint64_t           id;
+  struct fxpo_tile_t tile;
+  char               tileset[MAX_TILESET_LENGTH];
+  bool               rebuild;
+  bool               progressive;
+  enum fxpo_priority priority;
+  /* Cancelled while waiting for a worker. */
+  bool               cancelled;
+  fxpo_done_fn       done;
+  fxpo_done_fn       preview;
+  void *             user;
+};
+
+/* fxpo_job_queue_t is a growable ring buffer of jobs of one priority waiting for a worker. */
+struct fxpo_job_queue_t {
+  struct fxpo_job_t * jobs;
+  size_t              head;
+  size_t              len;
+  size_t              capacity;
+};
+
+/* fxpo_context_slot_t is a worker thread of a context and the job it is handling. */
+struct fxpo_context_slot_t {
+  struct fxpo_context_t * ctx;
+  size_t                  index;
+  struct fxpo_thread_t    thread;
+  struct fxpo_worker_t    worker;
+  /* 1 once the worker's buffers are allocated, -1 if that failed. */
+  volatile int64_t        ready;
+  /* Job being handled, valid while busy. */
+  struct fxpo_job_t       job;
+  bool                    busy;
+  /* Texture of job, valid while busy. */
+  char                    dds_path[MAX_PATH_LENGTH];
+  /* The texture of job is claimed by this worker, see fxpo_context_claim. */
+  bool                    building;
+  /* enum fxpo_stage the job is in, -1 while idle. */
+  volatile int64_t        stage;
+  /* Requests for the texture of job that arrived while it was being built. They complete with it. */
+  struct fxpo_job_queue_t parked;
+};
+
+struct fxpo_context_t {
+  char     scenery_path[MAX_PATH_LENGTH];
+  uint32_t chunks_per_side;
+  size_t   threads;
+  size_t   interactive_workers;
+  size_t   max_queued;
+  bool     pin_threads;
+
+  fxpo_progress_fn progress;
+  void *           progress_user;
+
+  struct fxpo_budget_t        budget;
+  struct fxpo_cache_t         cache;
+  struct fxpo_dedupe_t        dedupe;
+  struct fxpo_build_stats_t   build_stats;
+  struct fxpo_archive_t       archive;
+  /* archive is open. */
+  bool                        archived;
+  struct fxpo_http_rate_t     rates[FXPO_PROVIDER_COUNT];
+  struct fxpo_nvtt3_context_t nvtt_ctx;
+  struct fxpo_builder_t       builder;
+  volatile int64_t            interactive_fetches;
+
+  struct fxpo_job_queue_t      queues[FXPO_PRIORITY_COUNT];
+  struct fxpo_context_slot_t * slots;
+  /* Number of worker threads started. */
+  size_t                       slots_len;
+
+  /* Guards the queues, the jobs of the slots, pending and parked. */
+  struct fxpo_mutex_t lock;
+  /* Signalled when jobs are queued or the context is stopping. */
+  struct fxpo_cond_t  work;
+  /* Signalled when pending decreases or a worker becomes ready. */
+  struct fxpo_cond_t  changed;
+  volatile int64_t    next_id;
+  /* Requests queued, parked or being handled. */
+  int64_t             pending;
+  /* Requests parked on the slots. */
+  size_t              parked;
+  volatile int64_t    tiles_built;
+  volatile int64_t    tiles_degraded;
+  volatile int64_t    stopping;
+  /* Set by fxpo_context_interrupt, cancels every request from then on. */
+  volatile int64_t    interrupted;
+};
+
+enum fxpo_status
+fxpo_library_init( const struct fxpo_allocator_t * const allocator ) {
+
+  if( allocator != NULL ) fxpo_alloc_set_allocator( allocator );
+
+  enum fxpo_status status;
+  if( (status = fxpo_http_init()) != FXPOS_OK ) return status;
+
+  if( (status = fxpo_provider_init()) != FXPOS_OK ) {
+    FXPO_LOG_ERROR( "fxpo_library_init(): invalid provider registry" );
+    fxpo_http_clean();
+    return status;
+  }
+
+  fxpo_nvtt3_init();
+  fxpo_resize_init();
+
+  return FXPOS_OK;
+}
+
+void
+fxpo_library_clean() {
+
+  fxpo_http_clean();
+}
+
+const char *
+fxpo_status_str( const enum fxpo_status status ) {
+
+  switch( status ) {
+    case FXPOS_OK:            return "ok";
+    case FXPOS_NULL_POINTER:  return "null pointer";
+    case FXPOS_INVALID_STATE: return "invalid state";
+    case FXPOS_OUT_OF_MEMORY: return "out of memory";
+    case FXPOS_CANCELLED:     return "cancelled";
+    case FXPOS_QUEUE_FULL:    return "queue full";
+    case FXPOS_NOT_FOUND:     return "not found";
+  }
+
+  return "unknown";
+}
+
+void
+fxpo_config_default( struct fxpo_config_t * const config ) {
+
+  *config = (struct fxpo_config_t) {
+    .texture_size     = DEFAULT_CHUNKS_PER_TILE_SIDE * CHUNK_SIZE,
+    .resize_filter    = FXPO_RESIZE_FILTER_CATMULLROM,
+    .mode             = FXPO_MODE_BUILD,
+    .warm_connections = FXPO_DEFAULT_WARM_CONNECTIONS,
+  };
+}
+
+/* fxpo_job_queue_reserve grows queue if it is full. */
+static enum fxpo_status
+fxpo_job_queue_reserve( struct fxpo_job_queue_t * const queue ) {
+
+  if( queue->len == queue->capacity ) {
+    const size_t              capacity = queue->capacity > 0 ? queue->capacity * 2 : CONTEXT_INITIAL_QUEUE_SIZE;
+    struct fxpo_job_t * const jobs     = fxpo_malloc( capacity * sizeof(struct fxpo_job_t) );
+    if( jobs == NULL ) return FXPOS_OUT_OF_MEMORY;
+
+    /* Unwrap the ring into the new buffer. */
+    for( size_t i = 0; i < queue->len; i++ ) jobs[i] = queue->jobs[(queue->head + i) % queue->capacity];
+
+    fxpo_free( queue->jobs );
+    queue->jobs     = jobs;
+    queue->head     = 0;
+    queue->capacity = capacity;
+  }
+
+  return FXPOS_OK;
+}
+
+/* fxpo_job_queue_push appends job to queue. Called with the context locked. */
+static enum fxpo_status
+fxpo_job_queue_push( struct fxpo_job_queue_t * const queue,
+                     const struct fxpo_job_t * const job ) {
+
+  enum fxpo_status status;
+  if( (status = fxpo_job_queue_reserve( queue )) != FXPOS_OK ) return status;
+
+  queue->jobs[(queue->head + queue->len) % queue->capacity] = *job;
+  queue->len++;
+
+  return FXPOS_OK;
+}
+
+/* fxpo_job_queue_push_front inserts job ahead of the jobs in queue. Called with the context locked. */
+static enum fxpo_status
+fxpo_job_queue_push_front( struct fxpo_job_queue_t * const queue,
+                           const struct fxpo_job_t * const job ) {
+
+  enum fxpo_status status;
+  if( (status = fxpo_job_queue_reserve( queue )) != FXPOS_OK ) return status;
+
+  queue->head              = (queue->head + queue->capacity - 1) % queue->capacity;
+  queue->jobs[queue->head] = *job;
+  queue->len++;
+
+  return FXPOS_OK;
+}
+
+/* fxpo_context_pop hands the oldest job of the highest priority up to lowest_priority to slot. Called
+   with the context locked. */
+static bool
+fxpo_context_pop( struct fxpo_context_t * const      ctx,
+                  struct fxpo_context_slot_t * const slot,
+                  const enum fxpo_priority           lowest_priority ) {
+
+  bool popped = false;
+
+  for( enum fxpo_priority p = 0; p <= lowest_priority && !popped; p++ ) {
+    struct fxpo_job_queue_t * const queue = &ctx->queues[p];
+    if( queue->len == 0 ) continue;
+
+    slot->job   = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->len--;
+    popped = true;
+  }
+
+  if( popped ) {
+    slot->busy = true;
+    fxpo_atomic_store( &slot->worker.cancelled, slot->job.cancelled );
+    /* fxpo_context_interrupt does not take the lock, it may have set the flag just before it was overwritten. */
+    if( fxpo_atomic_load( &ctx->interrupted ) ) fxpo_atomic_store( &slot->worker.cancelled, 1 );
+  }
+
+  return popped;
+}
+
+static inline bool
+fxpo_context_same_texture( const struct fxpo_job_t * const a,
+                           const struct fxpo_job_t * const b ) {
+
+  return a->tile.x == b->tile.x && a->tile.y == b->tile.y && a->tile.zoom_level == b->tile.zoom_level
+         && a->tile.provider == b->tile.provider && !strcmp( a->tileset, b->tileset );
+}
+
+/* fxpo_context_claim marks the texture of the slot's job as being built by it. If another worker is
+   already building it the job is parked on that worker instead, frees the slot and false is returned.
+   status is set if the job could not be parked. Called with the context locked. */
+static bool
+fxpo_context_claim( struct fxpo_context_t * const      ctx,
+                    struct fxpo_context_slot_t * const slot,
+                    enum fxpo_status * const           status ) {
+
+  *status = FXPOS_OK;
+
+  for( size_t i = 0; i < ctx->slots_len; i++ ) {
+    struct fxpo_context_slot_t * const other = &ctx->slots[i];
+    if( !other->building || !fxpo_context_same_texture( &other->job, &slot->job ) ) continue;
+
+    /* The texture is current once the other worker is done, there is no need to build it twice. The job keeps
+       its rebuild flag in case that build fails and it is queued again. */
+    if( (*status = fxpo_job_queue_push( &other->parked, &slot->job )) != FXPOS_OK ) return true;
+
+    ctx->parked++;
+    slot->busy = false;
+    return false;
+  }
+
+  slot->building = true;
+  return true;
+}
+
+/* fxpo_context_next waits for a job slot can handle and claims it. Returns false once the context is
+   stopping and no job is left. status is passed on to fxpo_context_handle_job. Called with the context
+   locked. */
+static bool
+fxpo_context_next( struct fxpo_context_t * const      ctx,
+                   struct fxpo_context_slot_t * const slot,
+                   const enum fxpo_priority           lowest_priority,
+                   enum fxpo_status * const           status ) {
+
+  while( true ) {
+    if( fxpo_context_pop( ctx, slot, lowest_priority ) ) {
+      /* Cancelled jobs complete immediately without claiming their texture. */
+      *status = FXPOS_OK;
+      if( slot->job.cancelled || fxpo_context_claim( ctx, slot, status ) ) return true;
+      continue;
+    }
+
+    /* Parked jobs may still be queued again if the build they wait for fails. */
+    if( fxpo_atomic_load( &ctx->stopping ) && ctx->parked == 0 ) return false;
+
+    fxpo_cond_wait( &ctx->work, &ctx->lock );
+  }
+}
+
+/* fxpo_context_done invokes the done callback of job. */
+static void
+fxpo_context_done( const struct fxpo_job_t * const job,
+                   const enum fxpo_status          status,
+                   const char * const              dds_path,
+                   const bool                      degraded ) {
+
+  if( job->done == NULL ) return;
+
+  const struct fxpo_result_t result = {
+    .id       = job->id,
+    .status   = status,
+    .tileset  = job->tileset,
+    .dds_path = dds_path,
+    .degraded = degraded,
+  };
+  job->done( &result, job->user );
+}
+
+/* fxpo_context_complete ends the job of slot, it can no longer be cancelled. The requests parked on it
+   take its result if it succeeded and are queued again ahead of the others otherwise. */
+static void
+fxpo_context_complete( struct fxpo_context_t * const      ctx,
+                       struct fxpo_context_slot_t * const slot,
+                       const enum fxpo_status             status,
+                       const bool                         degraded ) {
+
+  fxpo_mutex_lock( &ctx->lock );
+  slot->building = false;
+  slot->busy     = false;
+
+  struct fxpo_job_queue_t parked = slot->parked;
+  slot->parked = (struct fxpo_job_queue_t) { 0 };
+  ctx->parked -= parked.len;
+
+  /* Parked jobs are never wrapped, see fxpo_context_cancel_matching. They are pushed to the front from
+     the last so that they keep their order. Those that cannot be queued again fail along with the job and
+     are gathered at the end of parked. */
+  size_t done_len = 0;
+  for( size_t i = parked.len; i-- > 0; ) {
+    const struct fxpo_job_t * const duplicate = &parked.jobs[i];
+    if( status != FXPOS_OK && !duplicate->cancelled && fxpo_job_queue_push_front( &ctx->queues[duplicate->priority], duplicate ) == FXPOS_OK ) continue;
+    parked.jobs[parked.len - ++done_len] = *duplicate;
+  }
+
+  /* Also wakes workers waiting for the parked jobs before stopping. */
+  if( parked.len > 0 ) fxpo_cond_broadcast( &ctx->work );
+  fxpo_mutex_unlock( &ctx->lock );
+
+  fxpo_context_done( &slot->job, status, slot->dds_path, degraded );
+  for( size_t i = parked.len - done_len; i < parked.len; i++ ) {
+    fxpo_context_done( &parked.jobs[i], parked.jobs[i].cancelled ? FXPOS_CANCELLED : status, slot->dds_path, degraded );
+  }
+  fxpo_free( parked.jobs );
+
+  fxpo_mutex_lock( &ctx->lock );
+  ctx->pending -= (int64_t)(1 + done_len);
+  fxpo_cond_broadcast( &ctx->changed );
+  fxpo_mutex_unlock( &ctx->lock );
+}
+
+static bool
+fxpo_context_file_exists( const char * const path ) {
+
+  FILE * const f = fopen( path, "rb" );
+  if( f == NULL ) return false;
+  fclose( f );
+  return true;
+}
+
+/* fxpo_context_on_stage forwards the stages of the job a worker is building to the callbacks. */
+static void
+fxpo_context_on_stage( const struct fxpo_worker_t * const worker,
+                       const enum fxpo_stage              stage,
+                       void * const                       user ) {
+
+  const struct fxpo_context_t * const ctx  = user;
+  struct fxpo_context_slot_t * const  slot = worker->owner;
+  const struct fxpo_job_t * const     job  = &slot->job;
+
+  /* A preview is written in the middle of the assembly. */
+  if( stage != FXPO_STAGE_PREVIEW ) fxpo_atomic_store( &slot->stage, (int64_t)stage );
+
+  if( ctx->progress != NULL ) ctx->progress( job->id, stage, ctx->progress_user );
+
+  if( stage == FXPO_STAGE_PREVIEW && job->preview != NULL ) {
+    const struct fxpo_result_t result = {
+      .id       = job->id,
+      .status   = FXPOS_OK,
+      .tileset  = job->tileset,
+      .dds_path = slot->dds_path,
+    };
+    job->preview( &result, job->user );
+  }
+}
+
+/* fxpo_context_handle_job builds the texture of the job claimed by slot unless status is already set. */
+static void
+fxpo_context_handle_job( struct fxpo_context_t * const      ctx,
+                         struct fxpo_context_slot_t * const slot,
+                         enum fxpo_status                   status ) {
+
+  const struct fxpo_job_t * const job    = &slot->job;
+  struct fxpo_worker_t * const    worker = &slot->worker;
+
+  char * const dds_path = slot->dds_path;
+  fxpo_ortho_build_dds_path( ctx->scenery_path, job->tileset, &job->tile, dds_path, sizeof(slot->dds_path) );
+
+  /* Textures written through an fxpo_texture_io_t cannot be looked up and are always built. */
+  bool degraded = false;
+  if( status != FXPOS_OK ) {
+    FXPO_LOG_ERROR( "fxpo_context_handle_job(): could not wait for tile x=%u y=%u zl=%u", job->tile.x, job->tile.y, job->tile.zoom_level );
+  } else if( fxpo_atomic_load( &worker->cancelled ) ) {
+    status = FXPOS_CANCELLED;
+  } else if( job->rebuild || ctx->builder.io.open != NULL || !fxpo_context_file_exists( dds_path ) || fxpo_build_is_preview( dds_path ) ) {
+    const double start = fxpo_time_s();
+    status = fxpo_build_tile( &ctx->builder, worker, job->tileset, &job->tile, job->priority, job->progressive, dds_path, sizeof(slot->dds_path) );
+    FXPO_LOG_INFO( "built tile x=%u y=%u zl=%u priority=%u in %.0f ms status=%s",
+                   job->tile.x, job->tile.y, job->tile.zoom_level, job->priority, (fxpo_time_s() - start) * 1000.0, fxpo_status_str( status ) );
+    if( status == FXPOS_OK ) fxpo_atomic_add( &ctx->tiles_built, 1 );
+
+    degraded = status == FXPOS_OK && worker->degraded;
+    if( degraded ) fxpo_atomic_add( &ctx->tiles_degraded, 1 );
+  }
+
+  fxpo_atomic_store( &slot->stage, -1 );
+  fxpo_context_complete( ctx, slot, status, degraded );
+}
+
+static void
+fxpo_context_worker_main( void * const arg ) {
+
+  struct fxpo_context_slot_t * const slot = arg;
+  struct fxpo_context_t * const      ctx  = slot->ctx;
+
+  if( ctx->pin_threads && !fxpo_pin_thread( slot->index ) ) {
+    FXPO_LOG_WARN( "failed to pin worker=%zu", slot->index );
+  }
+
+  /* Buffers are allocated by the worker itself so they are placed on its NUMA node. */
+  const size_t max_chunks_per_tile = (size_t)ctx->chunks_per_side * ctx->chunks_per_side;
+  const bool allocated = fxpo_worker_new( &slot->worker, max_chunks_per_tile, ctx->threads ) == FXPOS_OK;
+  if( allocated ) slot->worker.owner = slot;
+
+  fxpo_mutex_lock( &ctx->lock );
+  fxpo_atomic_store( &slot->ready, allocated ? 1 : -1 );
+  fxpo_cond_broadcast( &ctx->changed );
+  fxpo_mutex_unlock( &ctx->lock );
+
+  if( !allocated ) return;
+
+  /* Overlaps with the caller scanning the tileset for the tiles to queue. */
+  fxpo_worker_warm( &ctx->builder, &slot->worker );
+
+  const enum fxpo_priority lowest_priority = slot->index < ctx->interactive_workers ? FXPO_PRIORITY_INTERACTIVE : FXPO_PRIORITY_COUNT - 1;
+
+  /* Queued jobs are drained before stopping, cancelled ones complete immediately. */
+  enum fxpo_status status;
+  fxpo_mutex_lock( &ctx->lock );
+  while( fxpo_context_next( ctx, slot, lowest_priority, &status ) ) {
+    fxpo_mutex_unlock( &ctx->lock );
+    fxpo_context_handle_job( ctx, slot, status );
+    fxpo_mutex_lock( &ctx->lock );
+  }
+  fxpo_mutex_unlock( &ctx->lock );
+
+  fxpo_worker_free( &slot->worker );
+}
+
+/* fxpo_context_stop stops and joins the workers that were started. */
+static void
+fxpo_context_stop( struct fxpo_context_t * const ctx ) {
+
+  fxpo_mutex_lock( &ctx->lock );
+  fxpo_atomic_store( &ctx->stopping, 1 );
+  fxpo_cond_broadcast( &ctx->work );
+  fxpo_mutex_unlock( &ctx->lock );
+
+  for( size_t i = 0; i < ctx->slots_len; i++ ) fxpo_thread_join( &ctx->slots[i].thread );
+  ctx->slots_len = 0;
+}
+
+static void
+fxpo_context_release_resources( struct fxpo_context_t * const ctx ) {
+
+  for( enum fxpo_priority p = 0; p < FXPO_PRIORITY_COUNT; p++ ) fxpo_free( ctx->queues[p].jobs );
+  for( size_t i = 0; ctx->slots != NULL && i < ctx->threads; i++ ) fxpo_free( ctx->slots[i].parked.jobs );
+  fxpo_free( ctx->slots );
+  fxpo_nvtt3_context_free( &ctx->nvtt_ctx );
+  fxpo_budget_free( &ctx->budget );
+  fxpo_dedupe_free( &ctx->dedupe );
+  for( enum fxpo_provider p = 0; p < FXPO_PROVIDER_COUNT; p++ ) fxpo_http_rate_free( &ctx->rates[p] );
+  if( ctx->archived ) fxpo_archive_close( &ctx->archive );
+  fxpo_cond_free( &ctx->changed );
+  fxpo_cond_free( &ctx->work );
+  fxpo_mutex_free( &ctx->lock );
+  fxpo_free( ctx );
+}
+
+enum fxpo_status
+fxpo_context_new( const struct fxpo_config_t * const config,
+                  struct fxpo_context_t ** const     out ) {
+
+  *out = NULL;
+
+  if( config->scenery_path == NULL ) return FXPOS_NULL_POINTER;
+
+  const struct fxpo_tile_geometry_t * const geometry = fxpo_tile_geometry( config->texture_size / CHUNK_SIZE );
+  if( geometry == NULL || config->texture_size % CHUNK_SIZE != 0 ) {
+    FXPO_LOG_ERROR( "fxpo_context_new(): unsupported texture_size=%u", config->texture_size );
+    return FXPOS_INVALID_STATE;
+  }
+
+  if( config->resize_filter >= FXPO_RESIZE_FILTER_COUNT || strlen( config->scenery_path ) >= MAX_PATH_LENGTH ) return FXPOS_INVALID_STATE;
+  if( config->record_path != NULL && config->replay_path != NULL ) return FXPOS_INVALID_STATE;
+
+  struct fxpo_context_t * const ctx = fxpo_malloc( sizeof(struct fxpo_context_t) );
+  if( ctx == NULL ) return FXPOS_OUT_OF_MEMORY;
+  memset( ctx, 0, sizeof(struct fxpo_context_t) );
+
+  strcpy( ctx->scenery_path, config->scenery_path );
+  ctx->chunks_per_side     = geometry->chunks_per_side;
+  ctx->threads             = config->threads > 0 ? config->threads : (size_t)omp_get_max_threads();
+  ctx->interactive_workers = config->interactive_workers < ctx->threads ? config->interactive_workers : ctx->threads - 1;
+  ctx->max_queued          = config->max_queued;
+  ctx->pin_threads         = config->pin_threads;
+  ctx->progress            = config->progress;
+  ctx->progress_user       = config->progress_user;
+  fxpo_mutex_new( &ctx->lock );
+  fxpo_cond_new( &ctx->work );
+  fxpo_cond_new( &ctx->changed );
+  fxpo_dedupe_new( &ctx->dedupe );
+
+  for( enum fxpo_provider p = 0; p < FXPO_PROVIDER_COUNT; p++ ) {
+    const struct fxpo_provider_t * const provider = fxpo_provider_get( p );
+
+    struct fxpo_http_rate_config_t rate = provider->rate;
+    if( config->max_requests_per_second > 0 ) rate.requests_per_second = config->max_requests_per_second;
+    if( config->max_bytes_per_second > 0 ) rate.bytes_per_second = config->max_bytes_per_second;
+
+    fxpo_http_rate_new( &ctx->rates[p], &rate, &provider->host_rate, provider->hosts, provider->hosts_len );
+  }
+
+  if( config->cache_path != NULL ) {
+    fxpo_cache_new( &ctx->cache, config->cache_path );
+  } else {
+    char cache_path[MAX_PATH_LENGTH];
+    snprintf( cache_path, sizeof(cache_path), "%s/fxpo_cache", ctx->scenery_path );
+    fxpo_cache_new( &ctx->cache, cache_path );
+  }
+
+  /* Tiles only hold large buffers while being assembled and compressed. Network fetches are cheap in
+     comparison so every worker keeps fetching ahead and waits for admission before assembling. */
+  const size_t max_chunks_per_tile = (size_t)ctx->chunks_per_side * ctx->chunks_per_side;
+  const size_t tile_stage_size     = fxpo_build_stage_size( ctx->chunks_per_side, config->scaled_mips );
+  const size_t thread_fixed_size   = fxpo_build_thread_size( max_chunks_per_tile );
+
+  size_t budget_limit = 0;
+
+  if( config->max_memory > 0 ) {
+    const size_t fixed_size = ctx->threads * thread_fixed_size + DEDUPE_CAPACITY * DEDUPE_IMAGE_SIZE;
+    budget_limit = config->max_memory > fixed_size ? config->max_memory - fixed_size : 0;
+
+    if( budget_limit < tile_stage_size ) {
+      FXPO_LOG_WARN( "max_memory=%zu is below the size of a single tile=%zu, tiles will be built one at a time",
+                     config->max_memory, tile_stage_size + thread_fixed_size );
+      budget_limit = tile_stage_size;
+    }
+
+    FXPO_LOG_INFO( "memory budget=%zu allows %zu tiles in flight", config->max_memory, budget_limit / tile_stage_size );
+  }
+
+  fxpo_budget_new( &ctx->budget, budget_limit );
+  /* Keep room for a tile the simulator is waiting for while batch work fills the budget. */
+  if( ctx->interactive_workers > 0 ) fxpo_budget_reserve( &ctx->budget, tile_stage_size );
+
+  if( config->record_path != NULL || config->replay_path != NULL ) {
+    const enum fxpo_status status = config->record_path != NULL ? fxpo_archive_record( &ctx->archive, config->record_path )
+                                                                : fxpo_archive_replay( &ctx->archive, config->replay_path, config->replay_latency );
+    if( status != FXPOS_OK ) {
+      fxpo_context_release_resources( ctx );
+      return status;
+    }
+    ctx->archived = true;
+  }
+
+  uint32_t alloc_flags = FXPO_ALLOC_DEFAULT;
+  if( config->huge_pages ) {
+#ifdef _WIN32
+    if( !fxpo_alloc_enable_huge_pages() ) FXPO_LOG_WARN( "could not enable large pages, grant \"Lock pages in memory\" to use them" );
+#else
+    if( !fxpo_alloc_enable_huge_pages() ) FXPO_LOG_WARN( "huge pages unavailable, set vm.nr_hugepages or enable transparent huge pages" );
+#endif
+    alloc_flags |= FXPO_ALLOC_HUGE_PAGES;
+  }
+  if( config->pin_threads ) alloc_flags |= FXPO_ALLOC_LOCAL_NODE;
+
+  ctx->builder = (struct fxpo_builder_t) {
+    .scenery_path        = ctx->scenery_path,
+    .mode                = config->mode,
+    .alloc_flags         = alloc_flags,
+    .pin_threads         = config->pin_threads,
+    .budget              = &ctx->budget,
+    .nvtt_ctx            = &ctx->nvtt_ctx,
+    .cache               = &ctx->cache,
+    .dedupe              = &ctx->dedupe,
+    .stats               = &ctx->build_stats,
+    .archive             = ctx->archived ? &ctx->archive : NULL,
+    .rates               = ctx->rates,
+    /* Lower priorities only back off if interactive tiles have workers of their own. */
+    .interactive_fetches = ctx->interactive_workers > 0 ? &ctx->interactive_fetches : NULL,
+    .resize_filter       = config->resize_filter,
+    .warm_connections    = config->warm_connections,
+    .tolerant            = config->tolerant,
+    .scaled_mips         = config->scaled_mips,
+    .io                  = config->io,
+    .on_stage            = fxpo_context_on_stage,
+    .on_stage_user       = ctx,
+  };
+
+  ctx->slots = fxpo_malloc( ctx->threads * sizeof(struct fxpo_context_slot_t) );
+  if( ctx->slots == NULL ) {
+    fxpo_context_release_resources( ctx );
+    return FXPOS_OUT_OF_MEMORY;
+  }
+  memset( ctx->slots, 0, ctx->threads * sizeof(struct fxpo_context_slot_t) );
+
+  /* Slots are published before the threads start so that claims see every worker. */
+  enum fxpo_status status = FXPOS_OK;
+  for( ; ctx->slots_len < ctx->threads; ctx->slots_len++ ) {
+    struct fxpo_context_slot_t * const slot = &ctx->slots[ctx->slots_len];
+    slot->ctx   = ctx;
+    slot->index = ctx->slots_len;
+    slot->stage = -1;
+
+    if( !fxpo_thread_start( &slot->thread, fxpo_context_worker_main, slot ) ) {
+      FXPO_LOG_ERROR( "fxpo_context_new(): could not start worker=%zu", slot->index );
+      status = FXPOS_INVALID_STATE;
+      break;
+    }
+  }
+
+  /* Workers allocate their buffers and warm up their connections meanwhile. They only use the
+     compressor once jobs are queued, after this function returns. */
+  if( status == FXPOS_OK && config->mode != FXPO_MODE_FETCH_ONLY && fxpo_nvtt3_context_new( &ctx->nvtt_ctx ) != FXPOS_OK ) {
+    status = FXPOS_OUT_OF_MEMORY;
+  }
+
+  fxpo_mutex_lock( &ctx->lock );
+  for( size_t i = 0; i < ctx->slots_len && status == FXPOS_OK; i++ ) {
+    while( fxpo_atomic_load( &ctx->slots[i].ready ) == 0 ) fxpo_cond_wait( &ctx->changed, &ctx->lock );
+    if( fxpo_atomic_load( &ctx->slots[i].ready ) < 0 ) status = FXPOS_OUT_OF_MEMORY;
+  }
+  fxpo_mutex_unlock( &ctx->lock );
+
+  if( status != FXPOS_OK ) {
+    fxpo_context_stop( ctx );
+    fxpo_context_release_resources( ctx );
+    return status;
+  }
+
+  *out = ctx;
+  return FXPOS_OK;
+}
+
+void
+fxpo_context_free( struct fxpo_context_t * const ctx ) {
+
+  if( ctx == NULL ) return;
+
+  fxpo_context_cancel_all( ctx );
+  fxpo_context_stop( ctx );
+  fxpo_context_release_resources( ctx );
+}
+
+/* fxpo_context_parse_tileset checks that tileset is coordinates such as +57-006, anything else could escape the scenery path. */
+static bool
+fxpo_context_parse_tileset( const char * const        tileset,
+                            struct fxpo_job_t * const job ) {
+
+  const size_t tileset_len = tileset != NULL ? strlen( tileset ) : 0;
+  if( tileset_len == 0 || tileset_len >= MAX_TILESET_LENGTH || strspn( tileset, "+-0123456789" ) != tileset_len ) return false;
+
+  memcpy( job->tileset, tileset, tileset_len + 1 );
+  return true;
+}
+
+/* fxpo_context_job initialises job from request except for its tile. */
+static enum fxpo_status
+fxpo_context_job( const struct fxpo_request_t * const request,
+                  struct fxpo_job_t * const           job ) {
+
+  *job = (struct fxpo_job_t) {
+    .rebuild     = request->rebuild,
+    .progressive = request->progressive,
+    .priority    = request->priority,
+    .done        = request->done,
+    .preview     = request->preview,
+    .user        = request->user,
+  };
+
+  if( request->priority >= FXPO_PRIORITY_COUNT || !fxpo_context_parse_tileset( request->tileset, job ) ) {
+    FXPO_LOG_ERROR( "fxpo_context_job(): invalid tileset or priority" );
+    return FXPOS_INVALID_STATE;
+  }
+
+  return FXPOS_OK;
+}
+
+enum fxpo_status
+fxpo_context_build( struct fxpo_context_t * const       ctx,
+                    const struct fxpo_request_t * const request,
+                    uint64_t * const                    id ) {
+
+  struct fxpo_job_t job;
+
+  enum fxpo_status status;
+  if( (status = fxpo_context_job( request, &job )) != FXPOS_OK ) return status;
+
+  if( request->dds_name == NULL || fxpo_ortho_parse_dds_name( request->dds_name, &job.tile ) != FXPOS_OK ) return FXPOS_INVALID_STATE;
+  job.tile.chunks_per_side = ctx->chunks_per_side;
+
+  job.id = (uint64_t)fxpo_atomic_add( &ctx->next_id, 1 );
+
+  fxpo_mutex_lock( &ctx->lock );
+  struct fxpo_job_queue_t * const queue = &ctx->queues[job.priority];
+  if( fxpo_atomic_load( &ctx->stopping ) ) status = FXPOS_INVALID_STATE;
+  else if( ctx->max_queued > 0 && queue->len >= ctx->max_queued ) status = FXPOS_QUEUE_FULL;
+  else status = fxpo_job_queue_push( queue, &job );
+
+  /* Not every worker takes every priority, a single wakeup could go to one that leaves the job queued. */
+  if( status == FXPOS_OK ) {
+    ctx->pending++;
+    fxpo_cond_broadcast( &ctx->work );
+  }
+  fxpo_mutex_unlock( &ctx->lock );
+
+  if( status == FXPOS_OK && id != NULL ) *id = job.id;
+
+  return status;
+}
+
+enum fxpo_status
+fxpo_context_build_tileset( struct fxpo_context_t * const       ctx,
+                            const struct fxpo_request_t * const request,
+                            size_t * const                      count ) {
+
+  struct fxpo_job_t job;
+
+  if( count != NULL ) *count = 0;
+
+  enum fxpo_status status;
+  if( (status = fxpo_context_job( request, &job )) != FXPOS_OK ) return status;
+
+  struct fxpo_tile_t ** tiles;
+  const size_t          tile_num = fxpo_ortho_find_tiles( ctx->scenery_path, job.tileset, &tiles );
+  if( tile_num == 0 ) return FXPOS_NOT_FOUND;
+
+  /* The ids are taken as one block so that they can be reported once the queue is unlocked. */
+  const uint64_t first_id = (uint64_t)fxpo_atomic_add( &ctx->next_id, (int64_t)tile_num ) - tile_num + 1;
+
+  fxpo_mutex_lock( &ctx->lock );
+  struct fxpo_job_queue_t * const queue  = &ctx->queues[job.priority];
+  size_t                          queued = 0;
+
+  if( fxpo_atomic_load( &ctx->stopping ) ) status = FXPOS_INVALID_STATE;
+  else if( ctx->max_queued > 0 && queue->len + tile_num > ctx->max_queued ) status = FXPOS_QUEUE_FULL;
+
+  for( ; status == FXPOS_OK && queued < tile_num; queued++ ) {
+    job.tile                 = *tiles[queued];
+    job.tile.chunks_per_side = ctx->chunks_per_side;
+    job.id                   = first_id + queued;
+
+    if( (status = fxpo_job_queue_push( queue, &job )) != FXPOS_OK ) break;
+  }
+
+  /* Only this call appends to the queue while it is locked, so the tiles queued so far are at its tail. */
+  if( status != FXPOS_OK ) {
+    queue->len -= queued;
+  } else {
+    ctx->pending += (int64_t)tile_num;
+    fxpo_cond_broadcast( &ctx->work );
+  }
+  fxpo_mutex_unlock( &ctx->lock );
+
+  for( size_t i = 0; i < tile_num && status == FXPOS_OK && request->queued != NULL; i++ ) {
+    char dds_name[MAX_PATH_LENGTH];
+    fxpo_ortho_build_dds_name( tiles[i], dds_name, sizeof(dds_name) );
+    request->queued( first_id + i, dds_name, request->user );
+  }
+
+  fxpo_ortho_free_tiles( tiles, tile_num );
+
+  if( status == FXPOS_OK && count != NULL ) *count = tile_num;
+
+  return status;
+}
+
+/* fxpo_context_cancel_matching cancels request id, or every request if all is set. */
+static bool
+fxpo_context_cancel_matching( struct fxpo_context_t * const ctx,
+                              const uint64_t                id,
+                              const bool                    all ) {
+
+  bool found = false;
+
+  fxpo_mutex_lock( &ctx->lock );
+  for( enum fxpo_priority p = 0; p < FXPO_PRIORITY_COUNT; p++ ) {
+    struct fxpo_job_queue_t * const queue = &ctx->queues[p];
+
+    for( size_t i = 0; i < queue->len; i++ ) {
+      struct fxpo_job_t * const job = &queue->jobs[(queue->head + i) % queue->capacity];
+      if( job->cancelled || (!all && job->id != id) ) continue;
+
+      job->cancelled = true;
+      found          = true;
+    }
+  }
+
+  for( size_t i = 0; i < ctx->slots_len; i++ ) {
+    struct fxpo_context_slot_t * const slot = &ctx->slots[i];
+    if( !slot->busy || (!all && slot->job.id != id) ) continue;
+
+    fxpo_atomic_store( &slot->worker.cancelled, 1 );
+    found = true;
+  }
+
+  /* Parked jobs are queued again ahead of the others so that a worker completes them immediately. If
+     that fails they stay parked and complete as cancelled with the job they wait for. */
+  bool requeued = false;
+  for( size_t i = 0; i < ctx->slots_len; i++ ) {
+    struct fxpo_job_queue_t * const parked = &ctx->slots[i].parked;
+
+    size_t kept = 0;
+    for( size_t j = 0; j < parked->len; j++ ) {
+      struct fxpo_job_t * const job = &parked->jobs[j];
+      if( !job->cancelled && (all || job->id == id) ) {
+        job->cancelled = true;
+        found          = true;
+        if( fxpo_job_queue_push_front( &ctx->queues[job->priority], job ) == FXPOS_OK ) {
+          ctx->parked--;
+          requeued = true;
+          continue;
+        }
+      }
+      parked->jobs[kept++] = *job;
+    }
+    parked->len = kept;
+  }
+
+  if( requeued ) fxpo_cond_broadcast( &ctx->work );
+  fxpo_mutex_unlock( &ctx->lock );
+
+  /* Cancelled workers may be waiting for memory. */
+  if( found ) fxpo_budget_wake( &ctx->budget );
+
+  return found;
+}
+
+bool
+fxpo_context_cancel( struct fxpo_context_t * const ctx,
+                     const uint64_t                id ) {
+
+  return fxpo_context_cancel_matching( ctx, id, false );
+}
+
+void
+fxpo_context_cancel_all( struct fxpo_context_t * const ctx ) {
+
+  fxpo_context_cancel_matching( ctx, 0, true );
+}
+
+void
+fxpo_context_interrupt( struct fxpo_context_t * const ctx ) {
+
+  /* Only atomic stores, slots are not reallocated while the context is running. */
+  fxpo_atomic_store( &ctx->interrupted, 1 );
+  for( size_t i = 0; i < ctx->slots_len; i++ ) fxpo_atomic_store( &ctx->slots[i].worker.cancelled, 1 );
+}
+
+bool
+fxpo_context_is_interrupted( struct fxpo_context_t * const ctx ) {
+
+  return fxpo_atomic_load( &ctx->interrupted ) != 0;
+}
+
+void
+fxpo_context_stats( struct fxpo_context_t * const ctx,
+                    struct fxpo_stats_t * const   stats ) {
+
+  *stats = (struct fxpo_stats_t) {
+    .tiles_built         = (uint64_t)fxpo_atomic_load( &ctx->tiles_built ),
+    .tiles_degraded      = (uint64_t)fxpo_atomic_load( &ctx->tiles_degraded ),
+    .chunks_decoded      = (uint64_t)fxpo_atomic_load( &ctx->dedupe.decoded ),
+    .chunks_deduplicated = (uint64_t)fxpo_atomic_load( &ctx->dedupe.reused ),
+    .chunks_fetched      = (uint64_t)fxpo_atomic_load( &ctx->build_stats.chunks_fetched ),
+    .bytes_downloaded    = (uint64_t)fxpo_atomic_load( &ctx->build_stats.bytes_downloaded ),
+    .workers             = ctx->slots_len,
+  };
+
+  for( size_t i = 0; i < ctx->slots_len; i++ ) {
+    const int64_t stage = fxpo_atomic_load( &ctx->slots[i].stage );
+    if( stage >= 0 && stage < FXPO_STAGE_COUNT ) stats->workers_by_stage[stage]++;
+  }
+}
+
+void
+fxpo_context_wait( struct fxpo_context_t * const ctx ) {
+
+  fxpo_mutex_lock( &ctx->lock );
+  while( ctx->pending > 0 ) fxpo_cond_wait( &ctx->changed, &ctx->lock );
+  fxpo_mutex_unlock( &ctx->lock );
+}
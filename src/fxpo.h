@@ -0,0 +1,286 @@
+#ifndef FXPO_H
+#define FXPO_H
+
+/* fxpo.h is the public interface of libfxpo. A context keeps worker threads, HTTP connections and the
+   texture compressor warm and builds the textures requested of it asynchronously. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Define FXPO_SHARED when linking against the shared library. FXPO_BUILDING is defined while building it. */
+#if defined(FXPO_SHARED) && defined(_WIN32)
+#ifdef FXPO_BUILDING
+#define FXPO_API __declspec(dllexport)
+#else
+#define FXPO_API __declspec(dllimport)
+#endif
+#elif defined(FXPO_SHARED)
+#define FXPO_API __attribute__((visibility("default")))
+#else
+#define FXPO_API
+#endif
+
+enum fxpo_status {
+  FXPOS_OK = 0,
+  FXPOS_NULL_POINTER,
+  FXPOS_INVALID_STATE,
+  FXPOS_OUT_OF_MEMORY,
+  /* The request was cancelled before its texture was built. */
+  FXPOS_CANCELLED,
+  /* Too many requests of the same priority are waiting for a worker. */
+  FXPOS_QUEUE_FULL,
+  /* The tileset or texture does not exist. */
+  FXPOS_NOT_FOUND,
+};
+
+/* fxpo_priority orders work competing for memory, connections and workers. */
+enum fxpo_priority {
+  /* A tile the simulator is waiting for. */
+  FXPO_PRIORITY_INTERACTIVE,
+  /* A tile likely to be needed soon. */
+  FXPO_PRIORITY_PREFETCH,
+  /* Batch builds of whole tilesets. */
+  FXPO_PRIORITY_BACKGROUND,
+  FXPO_PRIORITY_COUNT
+};
+
+enum fxpo_mode {
+  /* Fetch chunks from the provider and build textures. */
+  FXPO_MODE_BUILD,
+  /* Fetch chunks from the provider into the chunk cache without building textures. */
+  FXPO_MODE_FETCH_ONLY,
+  /* Build textures from the chunk cache without network access. */
+  FXPO_MODE_OFFLINE,
+};
+
+/* Filters upsampling chunks from their ancestors. Each output pixel weighs the 4 source pixels nearest to
+   it by the filter at their distance, in source pixels, normalised to sum to 1. */
+enum fxpo_resize_filter {
+  /* Nearest source pixel. */
+  FXPO_RESIZE_FILTER_BOX,
+  /* Bilinear interpolation. */
+  FXPO_RESIZE_FILTER_TRIANGLE,
+  /* Cubic B-spline, B=1 C=0. Smooth without overshoot but blurs. */
+  FXPO_RESIZE_FILTER_CUBICBSPLINE,
+  /* Catmull-Rom spline, B=0 C=0.5. Interpolating and sharp with slight overshoot. */
+  FXPO_RESIZE_FILTER_CATMULLROM,
+  /* Mitchell-Netravali, B=1/3 C=1/3. Between the two. */
+  FXPO_RESIZE_FILTER_MITCHELL,
+  FXPO_RESIZE_FILTER_COUNT
+};
+
+/* fxpo_stage is reported to progress callbacks as a texture is built. */
+enum fxpo_stage {
+  /* Looking up the zoom level each chunk is available at. */
+  FXPO_STAGE_PROBE,
+  /* Downloading or reading the chunks from the cache. */
+  FXPO_STAGE_FETCH,
+  /* Decoding and upsampling chunks into the texture. */
+  FXPO_STAGE_ASSEMBLE,
+  /* Compressing the texture to DDS. */
+  FXPO_STAGE_COMPRESS,
+  /* A coarse texture was written for a progressive request, the full resolution one replaces it later. */
+  FXPO_STAGE_PREVIEW,
+  FXPO_STAGE_COUNT
+};
+
+/* fxpo_allocator_t routes the heap allocations of fxpo, e.g. to an embedding application's allocator.
+   Every function receives user. Large tile buffers are mapped from the OS, see fxpo_large_malloc. */
+struct fxpo_allocator_t {
+  void * (*malloc)( size_t size, void * user );
+  void * (*realloc)( void * ptr, size_t size, void * user );
+  void   (*free)( void * ptr, void * user );
+  void * user;
+};
+
+/* fxpo_texture_io_t redirects where DDS textures are written, e.g. to an embedding application's
+   storage. open returns a handle passed to write and close or NULL on failure. close is told whether
+   the texture was written completely. Leave open NULL to write files to the scenery path. */
+struct fxpo_texture_io_t {
+  void * (*open)( const char * path, void * user );
+  bool   (*write)( void * handle, const void * data, size_t len, void * user );
+  void   (*close)( void * handle, bool ok, void * user );
+  void * user;
+};
+
+/* fxpo_result_t is the outcome of a request, valid for the duration of its done callback. */
+struct fxpo_result_t {
+  uint64_t         id;
+  enum fxpo_status status;
+  const char *     tileset;
+  /* Path of the texture, also passed to fxpo_texture_io_t.open. */
+  const char *     dds_path;
+  /* Chunks of the texture were filled in, see fxpo_config_t.tolerant. The texture should be rebuilt later. */
+  bool             degraded;
+};
+
+/* Callbacks are invoked on the worker thread building the texture and must not block for long. */
+typedef void (*fxpo_done_fn)( const struct fxpo_result_t * result, void * user );
+typedef void (*fxpo_progress_fn)( uint64_t id, enum fxpo_stage stage, void * user );
+typedef void (*fxpo_queued_fn)( uint64_t id, const char * dds_name, void * user );
+
+/* Connections each worker opens to every provider host by default, see fxpo_config_t.warm_connections. */
+#define FXPO_DEFAULT_WARM_CONNECTIONS 2
+
+struct fxpo_config_t {
+  /* Path to X-Plane's Custom Scenery folder holding the tilesets. */
+  const char * scenery_path;
+  /* Worker threads building textures. 0 for one per logical processor. */
+  size_t threads;
+  /* Workers that only build interactive textures, so that one is free when the simulator needs a tile.
+     Memory is also set aside for them. */
+  size_t interactive_workers;
+  /* Memory budget for textures being assembled and compressed in bytes. 0 means unlimited. */
+  size_t max_memory;
+  /* Requests of each priority waiting for a worker. 0 means unlimited. */
+  size_t max_queued;
+  /* Width of the textures in pixels: 2048, 4096 or 8192. */
+  uint32_t texture_size;
+  /* Filter used to upsample chunks missing at the texture's zoom level. */
+  enum fxpo_resize_filter resize_filter;
+  enum fxpo_mode          mode;
+  /* Root of the chunk cache used by FXPO_MODE_FETCH_ONLY and FXPO_MODE_OFFLINE. NULL for <scenery_path>/fxpo_cache. */
+  const char * cache_path;
+  /* Limits of the requests to each provider shared by every worker, e.g. to stay under a provider's
+     throttling threshold. 0 keeps the provider's default, which is usually unlimited. */
+  double max_requests_per_second;
+  double max_bytes_per_second;
+  /* Keep-alive connections each worker opens to every provider host when it starts, overlapping DNS, TCP
+     and TLS handshakes with scanning the tileset. 0 to connect on the first tile instead. */
+  size_t warm_connections;
+  /* Back texture buffers with huge pages. */
+  bool huge_pages;
+  /* Pin workers to cores and allocate their buffers on the local NUMA node. */
+  bool pin_threads;
+  /* Fill chunks that cannot be fetched or decoded from their nearest ancestor, or a neutral grey if none
+     is available, instead of failing the texture. Such textures are reported as degraded. In
+     FXPO_MODE_FETCH_ONLY, those chunks are left out of the cache instead. */
+  bool tolerant;
+  /* Build the first mip of each chunk from a half scale decode of its JPEG and the next ones from that mip
+     rather than filtering them from the texture. The mips are averaged in sRGB rather than linear space, so
+     they are very slightly darker where the contrast is high. */
+  bool scaled_mips;
+  /* Record every chunk request and its response to the archive at record_path, or serve them from the
+     archive at replay_path instead of the network, so that runs can be compared on the same responses.
+     NULL for neither. replay_latency scales the latencies recorded that replayed requests wait for,
+     0 answers them at once. */
+  const char * record_path;
+  const char * replay_path;
+  double       replay_latency;
+
+  fxpo_progress_fn progress;
+  void *           progress_user;
+
+  struct fxpo_texture_io_t io;
+};
+
+struct fxpo_request_t {
+  /* Coordinates of the tileset, e.g. +57-006. */
+  const char * tileset;
+  /* File name of the texture, e.g. 63568_40144_BI17.dds. Ignored by fxpo_context_build_tileset. */
+  const char * dds_name;
+  enum fxpo_priority priority;
+  /* Build the texture even if it already exists. Textures written through fxpo_texture_io_t are always built. */
+  bool rebuild;
+  /* Write a coarse texture upsampled from a single low zoom level chunk before building the full
+     resolution one. Only applies to FXPO_MODE_BUILD and FXPO_MODE_OFFLINE. */
+  bool progressive;
+
+  /* Called once per texture when it is built, has failed or was cancelled. May be NULL. */
+  fxpo_done_fn done;
+  /* Called when the coarse texture of a progressive request is written. done still follows. May be NULL. */
+  fxpo_done_fn preview;
+  /* Called by fxpo_context_build_tileset for every texture it queued, with the file name of the texture,
+     before it returns. Textures may already be built meanwhile. May be NULL. */
+  fxpo_queued_fn queued;
+  void *         user;
+};
+
+/* fxpo_stats_t counts the work done by a context since it was created. */
+struct fxpo_stats_t {
+  /* Tiles built, or fetched into the chunk cache in FXPO_MODE_FETCH_ONLY. */
+  uint64_t tiles_built;
+  /* Tiles built with chunks filled in, see fxpo_config_t.tolerant. */
+  uint64_t tiles_degraded;
+  /* Chunks decoded from JPEG. */
+  uint64_t chunks_decoded;
+  /* Chunks whose JPEG was identical to one decoded before, reusing its image instead. */
+  uint64_t chunks_deduplicated;
+  /* Chunks downloaded or read from the chunk cache, and the bytes downloaded. */
+  uint64_t chunks_fetched;
+  uint64_t bytes_downloaded;
+  /* Worker threads, and how many are currently in each stage. The others are idle. */
+  size_t   workers;
+  size_t   workers_by_stage[FXPO_STAGE_COUNT];
+};
+
+/* fxpo_context_t is opaque to embedding applications. */
+struct fxpo_context_t;
+
+/* fxpo_library_init initialises the libraries fxpo depends on. allocator replaces the C library's for
+   the whole process, NULL keeps it. Must be called once before any other function. */
+FXPO_API enum fxpo_status
+fxpo_library_init( const struct fxpo_allocator_t * allocator );
+
+FXPO_API void
+fxpo_library_clean();
+
+FXPO_API const char *
+fxpo_status_str( enum fxpo_status status );
+
+/* fxpo_config_default fills config with the defaults of the fxpo executable. */
+FXPO_API void
+fxpo_config_default( struct fxpo_config_t * config );
+
+/* fxpo_context_new starts the workers of a context. Contexts are independent of each other. */
+FXPO_API enum fxpo_status
+fxpo_context_new( const struct fxpo_config_t * config,
+                  struct fxpo_context_t **     ctx );
+
+/* fxpo_context_free cancels every request, waits for the workers to stop and releases the context. */
+FXPO_API void
+fxpo_context_free( struct fxpo_context_t * ctx );
+
+/* fxpo_context_build queues the texture of request and returns its id without waiting for it.
+   Concurrent requests for the same texture build it once. */
+FXPO_API enum fxpo_status
+fxpo_context_build( struct fxpo_context_t *       ctx,
+                    const struct fxpo_request_t * request,
+                    uint64_t *                    id );
+
+/* fxpo_context_build_tileset queues every texture of request's tileset, each completing separately.
+   Either all textures are queued or none. Returns their number in count and reports each to request's queued. */
+FXPO_API enum fxpo_status
+fxpo_context_build_tileset( struct fxpo_context_t *       ctx,
+                            const struct fxpo_request_t * request,
+                            size_t *                      count );
+
+/* fxpo_context_cancel cancels request id. A texture being built stops within milliseconds, dropping
+   its transfers in flight and partial texture.
+   Returns false if the request is unknown or already done. */
+FXPO_API bool
+fxpo_context_cancel( struct fxpo_context_t * ctx,
+                     uint64_t                id );
+
+FXPO_API void
+fxpo_context_cancel_all( struct fxpo_context_t * ctx );
+
+/* fxpo_context_interrupt cancels every request, including those made afterwards. Transfers in flight are
+   dropped and compression stops between mips within milliseconds. Only sets flags without locking, so
+   it may be called from a signal handler. */
+FXPO_API void
+fxpo_context_interrupt( struct fxpo_context_t * ctx );
+
+FXPO_API bool
+fxpo_context_is_interrupted( struct fxpo_context_t * ctx );
+
+FXPO_API void
+fxpo_context_stats( struct fxpo_context_t * ctx,
+                    struct fxpo_stats_t *   stats );
+
+/* fxpo_context_wait blocks until every queued request is done. Must not be called from a callback. */
+FXPO_API void
+fxpo_context_wait( struct fxpo_context_t * ctx );
+
+#endif
@@ -0,0 +1,248 @@
+#include "fxpo_common.h"
+#include "fxpo_alloc.h"
+#include "fxpo_log.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static void *
+fxpo_libc_malloc( const size_t size,
+                  void * const user ) {
+
+  (void)user;
+  return malloc( size );
+}
+
+static void *
+fxpo_libc_realloc( void * const ptr,
+                   const size_t size,
+                   void * const user ) {
+
+  (void)user;
+  return realloc( ptr, size );
+}
+
+static void
+fxpo_libc_free( void * const ptr,
+                void * const user ) {
+
+  (void)user;
+  free( ptr );
+}
+
+struct fxpo_allocator_t fxpo_allocator = {
+  .malloc  = fxpo_libc_malloc,
+  .realloc = fxpo_libc_realloc,
+  .free    = fxpo_libc_free,
+  .user    = NULL,
+};
+
+void
+fxpo_alloc_set_allocator( const struct fxpo_allocator_t * const allocator ) {
+
+  if( allocator != NULL ) {
+    fxpo_allocator = *allocator;
+  } else {
+    fxpo_allocator = (struct fxpo_allocator_t) { fxpo_libc_malloc, fxpo_libc_realloc, fxpo_libc_free, NULL };
+  }
+}
+
+static inline size_t
+fxpo_round_up( const size_t size,
+               const size_t alignment ) {
+
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+#ifdef _WIN32
+
+bool
+fxpo_alloc_enable_huge_pages() {
+
+  HANDLE token;
+  if( !OpenProcessToken( GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token ) ) return false;
+
+  TOKEN_PRIVILEGES privileges = {
+    .PrivilegeCount = 1,
+    .Privileges[0]  = { .Attributes = SE_PRIVILEGE_ENABLED },
+  };
+
+  bool enabled = false;
+  if( LookupPrivilegeValue( NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid ) ) {
+    /* AdjustTokenPrivileges succeeds even if the privilege was not assigned to the user. */
+    enabled = AdjustTokenPrivileges( token, FALSE, &privileges, 0, NULL, NULL ) && GetLastError() == ERROR_SUCCESS;
+  }
+
+  CloseHandle( token );
+  return enabled && GetLargePageMinimum() > 0;
+}
+
+void *
+fxpo_large_malloc( const size_t   size,
+                   const uint32_t flags ) {
+
+  DWORD node = NUMA_NO_PREFERRED_NODE;
+
+  if( flags & FXPO_ALLOC_LOCAL_NODE ) {
+    PROCESSOR_NUMBER processor;
+    USHORT           processor_node;
+
+    GetCurrentProcessorNumberEx( &processor );
+    if( GetNumaProcessorNodeEx( &processor, &processor_node ) ) node = processor_node;
+  }
+
+  void * ptr = NULL;
+
+  const SIZE_T large_page_size = GetLargePageMinimum();
+  if( (flags & FXPO_ALLOC_HUGE_PAGES) && large_page_size > 0 ) {
+    ptr = VirtualAllocExNuma( GetCurrentProcess(), NULL, fxpo_round_up( size, large_page_size ),
+                              MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node );
+    if( ptr == NULL ) FXPO_LOG_DEBUG( "fxpo_large_malloc(): large pages unavailable (%lu), using regular pages", GetLastError() );
+  }
+
+  /* Windows has no transparent huge pages, fall back to regular pages. Reservations are only aligned to the
+     64kb allocation granularity so over-reserve and commit the part starting at a huge page boundary. */
+  if( ptr == NULL ) {
+    const size_t    len  = fxpo_round_up( size, HUGE_PAGE_SIZE );
+    uint8_t * const base = VirtualAllocExNuma( GetCurrentProcess(), NULL, len + HUGE_PAGE_SIZE, MEM_RESERVE, PAGE_NOACCESS, node );
+    if( base != NULL ) {
+      ptr = VirtualAllocExNuma( GetCurrentProcess(), (void *)fxpo_round_up( (uintptr_t)base, HUGE_PAGE_SIZE ), len,
+                                MEM_COMMIT, PAGE_READWRITE, node );
+      if( ptr == NULL ) VirtualFree( base, 0, MEM_RELEASE );
+    }
+  }
+
+  if( ptr == NULL && size > 0 ) {
+    FXPO_LOG_ERROR( "fxpo_large_malloc(): out of memory (%zu bytes)", size );
+    return NULL;
+  }
+
+  return ptr;
+}
+
+void
+fxpo_large_free( void * const ptr,
+                 const size_t size ) {
+
+  (void)size;
+  if( ptr == NULL ) return;
+
+  /* Regular page allocations start inside a larger reservation which has to be released as a whole. */
+  MEMORY_BASIC_INFORMATION info;
+  if( VirtualQuery( ptr, &info, sizeof(info) ) == 0 ) {
+    FXPO_LOG_ERROR( "fxpo_large_free(): unknown allocation %p (%lu)", ptr, GetLastError() );
+    return;
+  }
+
+  VirtualFree( info.AllocationBase, 0, MEM_RELEASE );
+}
+
+bool
+fxpo_pin_thread( size_t cpu ) {
+
+  const WORD groups = GetActiveProcessorGroupCount();
+
+  for( WORD group = 0; group < groups; group++ ) {
+    const DWORD group_cpus = GetActiveProcessorCount( group );
+
+    if( cpu < group_cpus ) {
+      GROUP_AFFINITY affinity = { .Mask = (KAFFINITY)1 << cpu, .Group = group };
+      return SetThreadGroupAffinity( GetCurrentThread(), &affinity, NULL ) != 0;
+    }
+
+    cpu -= group_cpus;
+  }
+
+  return false;
+}
+
+#else
+
+bool
+fxpo_alloc_enable_huge_pages() {
+
+  /* Explicit huge pages depend on the vm.nr_hugepages pool, there is no privilege to acquire. Report whether
+     either the pool or transparent huge pages can back an allocation. */
+  unsigned long pool = 0;
+  FILE *        f    = fopen( "/proc/sys/vm/nr_hugepages", "r" );
+  if( f != NULL ) {
+    if( fscanf( f, "%lu", &pool ) != 1 ) pool = 0;
+    fclose( f );
+  }
+  if( pool > 0 ) return true;
+
+  /* The active mode is bracketed, e.g. "always [madvise] never". */
+  char mode[64] = { 0 };
+  f = fopen( "/sys/kernel/mm/transparent_hugepage/enabled", "r" );
+  if( f == NULL ) return false;
+
+  const bool read = fgets( mode, sizeof(mode), f ) != NULL;
+  fclose( f );
+
+  return read && strstr( mode, "[never]" ) == NULL;
+}
+
+void *
+fxpo_large_malloc( const size_t   size,
+                   const uint32_t flags ) {
+
+  const size_t len = fxpo_round_up( size, HUGE_PAGE_SIZE );
+  void *       ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+  if( flags & FXPO_ALLOC_HUGE_PAGES ) {
+    ptr = mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+  }
+#endif
+
+  if( ptr == MAP_FAILED ) {
+    /* Over-allocate to align the mapping to a huge page boundary which transparent huge pages require. */
+    uint8_t * const base = mmap( NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( base == MAP_FAILED ) {
+      FXPO_LOG_ERROR( "fxpo_large_malloc(): out of memory (%zu bytes)", size );
+      return NULL;
+    }
+
+    uint8_t * const aligned = (uint8_t *)fxpo_round_up( (uintptr_t)base, HUGE_PAGE_SIZE );
+    const size_t    head    = (size_t)(aligned - base);
+    if( head > 0 ) munmap( base, head );
+    if( HUGE_PAGE_SIZE - head > 0 ) munmap( aligned + len, HUGE_PAGE_SIZE - head );
+
+    ptr = aligned;
+
+#ifdef MADV_HUGEPAGE
+    if( flags & FXPO_ALLOC_HUGE_PAGES ) madvise( ptr, len, MADV_HUGEPAGE );
+#endif
+  }
+
+  /* Linux places pages on the node of the thread that first touches them. */
+  if( flags & FXPO_ALLOC_LOCAL_NODE ) {
+    const size_t page_size = (size_t)sysconf( _SC_PAGESIZE );
+    for( size_t i = 0; i < len; i += page_size ) ((volatile uint8_t *)ptr)[i] = 0;
+  }
+
+  return ptr;
+}
+
+void
+fxpo_large_free( void * const ptr,
+                 const size_t size ) {
+
+  if( ptr != NULL ) munmap( ptr, fxpo_round_up( size, HUGE_PAGE_SIZE ) );
+}
+
+bool
+fxpo_pin_thread( const size_t cpu ) {
+
+  cpu_set_t set;
+  CPU_ZERO( &set );
+  CPU_SET( cpu % CPU_SETSIZE, &set );
+
+  return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+}
+
+#endif
@@ -3,48 +3,156 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fxpo.h"
 
-#define DEFAULT_ALIGNMENT 16
+/* Cache line alignment also satisfies aligned AVX2 and AVX-512 loads. */
+#define DEFAULT_ALIGNMENT 64
+#define HUGE_PAGE_SIZE    (2 * 1024 * 1024)
 
-#ifdef _WIN32
-#include <malloc.h>
-#define aligned_alloc( align, size ) _aligned_malloc( size, align )
-#define aligned_free( ptr )          _aligned_free( ptr )
-#endif
+/* Allocator of the process, see fxpo_allocator_t. */
+extern struct fxpo_allocator_t fxpo_allocator;
 
+/* fxpo_alloc_set_allocator replaces the allocator of the process, NULL restores the C library's.
+   Must be called before anything is allocated. */
+void
+fxpo_alloc_set_allocator( const struct fxpo_allocator_t * allocator );
+
+/* Allocation functions return NULL when out of memory for callers to report FXPOS_OUT_OF_MEMORY. */
 static inline void *
 fxpo_malloc( const size_t size ) {
 
-  void * ptr = malloc( size );
-  if( ptr == NULL && size > 0 ) {
-    fprintf( stderr, "malloc out of memory (%zu bytes)\n", size );
-    exit( EXIT_FAILURE );
-  }
+  void * ptr = fxpo_allocator.malloc( size, fxpo_allocator.user );
+  if( ptr == NULL && size > 0 ) fprintf( stderr, "malloc out of memory (%zu bytes)\n", size );
   return ptr;
 }
 
+static inline void *
+fxpo_realloc( void * const ptr,
+              const size_t size ) {
+
+  void * newptr = fxpo_allocator.realloc( ptr, size, fxpo_allocator.user );
+  if( newptr == NULL && size > 0 ) fprintf( stderr, "realloc out of memory (%zu bytes)\n", size );
+  return newptr;
+}
+
+static inline void
+fxpo_free( void * const ptr ) {
+
+  if( ptr != NULL ) fxpo_allocator.free( ptr, fxpo_allocator.user );
+}
+
+/* fxpo_aligned_malloc returns size bytes aligned to DEFAULT_ALIGNMENT, release with fxpo_aligned_free.
+   The pointer returned by the allocator is stored in front of the aligned block. */
 static inline void *
 fxpo_aligned_malloc( const size_t size ) {
 
-  void * ptr = aligned_alloc( DEFAULT_ALIGNMENT, size );
-  if( ptr == NULL && size > 0 ) {
-    fprintf( stderr, "aligned malloc out of memory (%zu bytes)\n", size );
-    exit( EXIT_FAILURE );
-  }
-  return ptr;
+  uint8_t * const base = fxpo_malloc( size + DEFAULT_ALIGNMENT + sizeof(void *) );
+  if( base == NULL ) return NULL;
+
+  const uintptr_t aligned = ((uintptr_t)base + sizeof(void *) + DEFAULT_ALIGNMENT - 1) & ~(uintptr_t)(DEFAULT_ALIGNMENT - 1);
+  ((void **)aligned)[-1] = base;
+  return (void *)aligned;
+}
+
+static inline void
+fxpo_aligned_free( void * const ptr ) {
+
+  if( ptr != NULL ) fxpo_free( ((void **)ptr)[-1] );
+}
+
+/* fxpo_arena_t is a bump allocator for short-lived buffers owned by a single thread.
+   Allocations are released all at once by rewinding to a mark or resetting the arena. */
+struct fxpo_arena_t {
+  uint8_t * buf;
+  size_t    capacity;
+  /* Offset of the next free byte in buf. */
+  size_t offset;
+};
+
+static inline bool
+fxpo_arena_new( struct fxpo_arena_t * const arena,
+                const size_t                capacity ) {
+
+  arena->buf      = fxpo_aligned_malloc( capacity );
+  arena->capacity = arena->buf != NULL ? capacity : 0;
+  arena->offset   = 0;
+  return arena->buf != NULL;
+}
+
+static inline void
+fxpo_arena_free( struct fxpo_arena_t * const arena ) {
+
+  fxpo_aligned_free( arena->buf );
+  arena->buf      = NULL;
+  arena->capacity = 0;
+  arena->offset   = 0;
 }
 
+/* fxpo_arena_alloc returns size bytes aligned to DEFAULT_ALIGNMENT from the arena, NULL if it is full. */
 static inline void *
-fxpo_realloc( void * const ptr,
-              const size_t size ) {
+fxpo_arena_alloc( struct fxpo_arena_t * const arena,
+                  const size_t                size ) {
 
-  void * newptr = realloc( ptr, size );
-  if( newptr == NULL && size > 0 ) {
-    fprintf( stderr, "realloc out of memory (%zu bytes)\n", size );
-    exit( EXIT_FAILURE );
+  const size_t offset = (arena->offset + DEFAULT_ALIGNMENT - 1) & ~(size_t)(DEFAULT_ALIGNMENT - 1);
+  if( offset + size > arena->capacity ) {
+    fprintf( stderr, "arena out of memory (%zu of %zu bytes used, %zu requested)\n", arena->offset, arena->capacity, size );
+    return NULL;
   }
 
-  return newptr;
+  arena->offset = offset + size;
+  return &arena->buf[offset];
 }
 
+/* fxpo_arena_mark returns the current position of the arena to rewind to with fxpo_arena_rewind. */
+static inline size_t
+fxpo_arena_mark( const struct fxpo_arena_t * const arena ) {
+
+  return arena->offset;
+}
+
+/* fxpo_arena_rewind releases every allocation made since mark was taken. */
+static inline void
+fxpo_arena_rewind( struct fxpo_arena_t * const arena,
+                   const size_t                mark ) {
+
+  arena->offset = mark;
+}
+
+static inline void
+fxpo_arena_reset( struct fxpo_arena_t * const arena ) {
+
+  arena->offset = 0;
+}
+
+enum fxpo_alloc_flags {
+  FXPO_ALLOC_DEFAULT = 0,
+  /* Back the allocation with huge pages. Explicit large pages are tried first, then
+     transparent huge pages. Falls back to regular pages if neither is available. */
+  FXPO_ALLOC_HUGE_PAGES = 1 << 0,
+  /* Place the allocation on the NUMA node of the calling thread. */
+  FXPO_ALLOC_LOCAL_NODE = 1 << 1,
+};
+
+/* fxpo_alloc_enable_huge_pages acquires the privileges required for explicit large pages.
+   Returns false if neither explicit nor transparent huge pages are available and allocations use regular pages. */
+bool
+fxpo_alloc_enable_huge_pages();
+
+/* fxpo_large_malloc allocates size bytes aligned to HUGE_PAGE_SIZE directly from the OS.
+   Meant for long-lived buffers of several megabytes, release with fxpo_large_free. Returns NULL when out of memory. */
+void *
+fxpo_large_malloc( size_t   size,
+                   uint32_t flags );
+
+void
+fxpo_large_free( void * ptr,
+                 size_t size );
+
+/* fxpo_pin_thread pins the calling thread to the logical processor cpu. Processors are numbered
+   linearly across processor groups so consecutive threads fill a NUMA node before the next one. */
+bool
+fxpo_pin_thread( size_t cpu );
+
 #endif
\ No newline at end of file
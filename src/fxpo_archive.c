@@ -0,0 +1,380 @@
+#include "fxpo_archive.h"
+#include "fxpo_log.h"
+#include "fxpo_alloc.h"
+
+#define ARCHIVE_MAGIC       "FXPOARC1"
+#define ARCHIVE_INDEX_MAGIC "FXPOIDX1"
+#define ARCHIVE_MAGIC_LEN   8
+
+#define ARCHIVE_FLAG_HEAD   1u
+#define ARCHIVE_FLAG_FAILED 2u
+
+/* fxpo_archive_record_t precedes the URL and the response of each request in the file. */
+struct fxpo_archive_record_t {
+  uint32_t url_len;
+  uint32_t size;
+  /* Microseconds the response took to arrive. */
+  uint32_t latency_us;
+  /* ARCHIVE_FLAG_* of the request. */
+  uint32_t flags;
+};
+
+struct fxpo_archive_footer_t {
+  uint64_t index_offset;
+  uint64_t count;
+  char     magic[ARCHIVE_MAGIC_LEN];
+};
+
+/* Archives of a whole tileset exceed the 2 GB long offsets of fseek on Windows. */
+static int
+fxpo_archive_seek( FILE * const  f,
+                   const int64_t offset,
+                   const int     origin ) {
+
+#ifdef _WIN32
+  return _fseeki64( f, offset, origin );
+#else
+  return fseeko( f, (off_t)offset, origin );
+#endif
+}
+
+static int64_t
+fxpo_archive_tell( FILE * const f ) {
+
+#ifdef _WIN32
+  return _ftelli64( f );
+#else
+  return (int64_t)ftello( f );
+#endif
+}
+
+static uint64_t
+fxpo_archive_hash( const char * const url,
+                   const size_t       url_len,
+                   const bool         is_head ) {
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for( size_t i = 0; i < url_len; i++ ) {
+    hash ^= (uint8_t)url[i];
+    hash *= 0x100000001b3ull;
+  }
+  hash ^= is_head ? ARCHIVE_FLAG_HEAD : 0;
+  hash *= 0x100000001b3ull;
+
+  /* 0 marks free slots of a recording. */
+  return hash != 0 ? hash : 1;
+}
+
+/* fxpo_archive_slot returns the slot of the recording table holding hash or the free slot it goes in. */
+static size_t
+fxpo_archive_slot( const struct fxpo_archive_t * const archive,
+                   const uint64_t                      hash ) {
+
+  const size_t mask = archive->entries_capacity - 1;
+
+  size_t i = (size_t)hash & mask;
+  while( archive->entries[i].hash != 0 && archive->entries[i].hash != hash ) i = (i + 1) & mask;
+  return i;
+}
+
+/* fxpo_archive_grow doubles the recording table. Must hold the lock. */
+static bool
+fxpo_archive_grow( struct fxpo_archive_t * const archive ) {
+
+  struct fxpo_archive_entry_t * const old          = archive->entries;
+  const size_t                        old_capacity = archive->entries_capacity;
+
+  const size_t capacity = old_capacity * 2;
+  archive->entries = fxpo_malloc( capacity * sizeof(struct fxpo_archive_entry_t) );
+  if( archive->entries == NULL ) {
+    archive->entries = old;
+    return false;
+  }
+  memset( archive->entries, 0, capacity * sizeof(struct fxpo_archive_entry_t) );
+  archive->entries_capacity = capacity;
+
+  for( size_t i = 0; i < old_capacity; i++ ) {
+    if( old[i].hash != 0 ) archive->entries[fxpo_archive_slot( archive, old[i].hash )] = old[i];
+  }
+
+  fxpo_free( old );
+  return true;
+}
+
+enum fxpo_status
+fxpo_archive_record( struct fxpo_archive_t * const archive,
+                     const char * const            path ) {
+
+  memset( archive, 0, sizeof(struct fxpo_archive_t) );
+
+  archive->entries_capacity = ARCHIVE_INITIAL_CAPACITY;
+  archive->entries          = fxpo_malloc( archive->entries_capacity * sizeof(struct fxpo_archive_entry_t) );
+  if( archive->entries == NULL ) return FXPOS_OUT_OF_MEMORY;
+  memset( archive->entries, 0, archive->entries_capacity * sizeof(struct fxpo_archive_entry_t) );
+
+  archive->file = fopen( path, "wb" );
+  if( archive->file == NULL || fwrite( ARCHIVE_MAGIC, 1, ARCHIVE_MAGIC_LEN, archive->file ) != ARCHIVE_MAGIC_LEN ) {
+    FXPO_LOG_ERROR( "fxpo_archive_record(): could not create file=%s", path );
+    if( archive->file != NULL ) fclose( archive->file );
+    fxpo_free( archive->entries );
+    return FXPOS_INVALID_STATE;
+  }
+
+  fxpo_mutex_new( &archive->lock );
+  return FXPOS_OK;
+}
+
+static int
+fxpo_archive_entry_compare( const void * const a,
+                            const void * const b ) {
+
+  const uint64_t x = ((const struct fxpo_archive_entry_t *)a)->hash;
+  const uint64_t y = ((const struct fxpo_archive_entry_t *)b)->hash;
+  return (x > y) - (x < y);
+}
+
+/* fxpo_archive_read_index reads the index at the end of the file. Returns false if there is none. */
+static bool
+fxpo_archive_read_index( struct fxpo_archive_t * const archive ) {
+
+  FILE * const f = archive->file;
+
+  struct fxpo_archive_footer_t footer;
+  if( fxpo_archive_seek( f, 0, SEEK_END ) != 0 ) return false;
+  const int64_t size = fxpo_archive_tell( f );
+
+  if( size < (int64_t)(ARCHIVE_MAGIC_LEN + sizeof(footer))
+      || fxpo_archive_seek( f, size - (int64_t)sizeof(footer), SEEK_SET ) != 0
+      || fread( &footer, sizeof(footer), 1, f ) != 1
+      || memcmp( footer.magic, ARCHIVE_INDEX_MAGIC, ARCHIVE_MAGIC_LEN ) != 0
+      || footer.index_offset + footer.count * sizeof(struct fxpo_archive_entry_t) + sizeof(footer) != (uint64_t)size ) {
+    return false;
+  }
+
+  archive->entries = fxpo_malloc( (size_t)footer.count * sizeof(struct fxpo_archive_entry_t) + 1 );
+  if( archive->entries == NULL ) return false;
+
+  if( fxpo_archive_seek( f, (int64_t)footer.index_offset, SEEK_SET ) != 0
+      || fread( archive->entries, sizeof(struct fxpo_archive_entry_t), (size_t)footer.count, f ) != (size_t)footer.count ) {
+    fxpo_free( archive->entries );
+    archive->entries = NULL;
+    return false;
+  }
+
+  archive->entries_len      = (size_t)footer.count;
+  archive->entries_capacity = (size_t)footer.count;
+  return true;
+}
+
+/* fxpo_archive_scan indexes the records of a recording that was not closed, up to the first one
+   that is incomplete. */
+static enum fxpo_status
+fxpo_archive_scan( struct fxpo_archive_t * const archive ) {
+
+  FILE * const f = archive->file;
+
+  if( fxpo_archive_seek( f, 0, SEEK_END ) != 0 ) return FXPOS_INVALID_STATE;
+  const int64_t size = fxpo_archive_tell( f );
+
+  int64_t offset = ARCHIVE_MAGIC_LEN;
+  while( fxpo_archive_seek( f, offset, SEEK_SET ) == 0 ) {
+    struct fxpo_archive_record_t record;
+    char                         url[MAX_URL_LENGTH];
+    if( fread( &record, sizeof(record), 1, f ) != 1 || record.url_len >= MAX_URL_LENGTH
+        || fread( url, 1, record.url_len, f ) != record.url_len ) {
+      break;
+    }
+
+    const int64_t next = offset + (int64_t)sizeof(record) + record.url_len + record.size;
+    if( next > size ) break;
+
+    if( archive->entries_len == archive->entries_capacity ) {
+      const size_t                        capacity = archive->entries_capacity > 0 ? archive->entries_capacity * 2 : ARCHIVE_INITIAL_CAPACITY;
+      struct fxpo_archive_entry_t * const entries  = fxpo_realloc( archive->entries, capacity * sizeof(struct fxpo_archive_entry_t) );
+      if( entries == NULL ) return FXPOS_OUT_OF_MEMORY;
+
+      archive->entries          = entries;
+      archive->entries_capacity = capacity;
+    }
+
+    archive->entries[archive->entries_len++] = (struct fxpo_archive_entry_t) {
+      .hash   = fxpo_archive_hash( url, record.url_len, (record.flags & ARCHIVE_FLAG_HEAD) != 0 ),
+      .offset = (uint64_t)offset,
+    };
+    offset = next;
+  }
+
+  qsort( archive->entries, archive->entries_len, sizeof(struct fxpo_archive_entry_t), fxpo_archive_entry_compare );
+  return FXPOS_OK;
+}
+
+enum fxpo_status
+fxpo_archive_replay( struct fxpo_archive_t * const archive,
+                     const char * const            path,
+                     const double                  latency_scale ) {
+
+  memset( archive, 0, sizeof(struct fxpo_archive_t) );
+  archive->replay        = true;
+  archive->latency_scale = latency_scale;
+
+  char magic[ARCHIVE_MAGIC_LEN];
+  archive->file = fopen( path, "rb" );
+  if( archive->file == NULL || fread( magic, 1, sizeof(magic), archive->file ) != sizeof(magic) || memcmp( magic, ARCHIVE_MAGIC, sizeof(magic) ) != 0 ) {
+    FXPO_LOG_ERROR( "fxpo_archive_replay(): could not open archive file=%s", path );
+    if( archive->file != NULL ) fclose( archive->file );
+    return FXPOS_NOT_FOUND;
+  }
+
+  if( !fxpo_archive_read_index( archive ) ) {
+    FXPO_LOG_WARN( "fxpo_archive_replay(): archive file=%s was not closed, scanning its responses", path );
+
+    const enum fxpo_status status = fxpo_archive_scan( archive );
+    if( status != FXPOS_OK ) {
+      FXPO_LOG_ERROR( "fxpo_archive_replay(): could not scan archive file=%s", path );
+      fxpo_free( archive->entries );
+      fclose( archive->file );
+      return status;
+    }
+  }
+
+  FXPO_LOG_INFO( "replaying %zu responses from archive=%s", archive->entries_len, path );
+
+  fxpo_mutex_new( &archive->lock );
+  return FXPOS_OK;
+}
+
+void
+fxpo_archive_close( struct fxpo_archive_t * const archive ) {
+
+  if( !archive->replay ) {
+    /* The table is compacted in place into the index. */
+    size_t count = 0;
+    for( size_t i = 0; i < archive->entries_capacity; i++ ) {
+      if( archive->entries[i].hash != 0 ) archive->entries[count++] = archive->entries[i];
+    }
+    qsort( archive->entries, count, sizeof(struct fxpo_archive_entry_t), fxpo_archive_entry_compare );
+
+    struct fxpo_archive_footer_t footer = {
+      .index_offset = (uint64_t)fxpo_archive_tell( archive->file ),
+      .count        = count,
+    };
+    memcpy( footer.magic, ARCHIVE_INDEX_MAGIC, ARCHIVE_MAGIC_LEN );
+
+    if( fwrite( archive->entries, sizeof(struct fxpo_archive_entry_t), count, archive->file ) != count
+        || fwrite( &footer, sizeof(footer), 1, archive->file ) != 1 ) {
+      FXPO_LOG_ERROR( "fxpo_archive_close(): could not write the index of %zu responses", count );
+    }
+  }
+
+  if( fclose( archive->file ) != 0 && !archive->replay ) FXPO_LOG_ERROR( "fxpo_archive_close(): could not write archive" );
+  fxpo_free( archive->entries );
+  fxpo_mutex_free( &archive->lock );
+}
+
+void
+fxpo_archive_put( struct fxpo_archive_t * const         archive,
+                  const char * const                    url,
+                  const bool                            is_head,
+                  const struct fxpo_http_data_t * const res,
+                  const double                          seconds ) {
+
+  const size_t   url_len = strlen( url );
+  const uint64_t hash    = fxpo_archive_hash( url, url_len, is_head );
+
+  const double                       latency_us = seconds * 1e6;
+  const struct fxpo_archive_record_t record     = {
+    .url_len    = (uint32_t)url_len,
+    .size       = res->failed ? 0 : (uint32_t)res->size,
+    .latency_us = latency_us < (double)UINT32_MAX ? (uint32_t)latency_us : UINT32_MAX,
+    .flags      = (is_head ? ARCHIVE_FLAG_HEAD : 0) | (res->failed ? ARCHIVE_FLAG_FAILED : 0),
+  };
+
+  fxpo_mutex_lock( &archive->lock );
+
+  /* Retries and chunks shared by tiles keep the response recorded first. */
+  if( (archive->entries_len + 1) * 2 > archive->entries_capacity && !fxpo_archive_grow( archive ) ) {
+    fxpo_mutex_unlock( &archive->lock );
+    FXPO_LOG_ERROR( "fxpo_archive_put(): out of memory, not recording url=%s", url );
+    return;
+  }
+
+  const size_t slot = fxpo_archive_slot( archive, hash );
+  if( archive->entries[slot].hash == 0 ) {
+    const int64_t offset = fxpo_archive_tell( archive->file );
+    if( fwrite( &record, sizeof(record), 1, archive->file ) == 1
+        && fwrite( url, 1, url_len, archive->file ) == url_len
+        && fwrite( res->buf, 1, record.size, archive->file ) == record.size ) {
+      archive->entries[slot] = (struct fxpo_archive_entry_t) { .hash = hash, .offset = (uint64_t)offset };
+      archive->entries_len++;
+    } else {
+      FXPO_LOG_ERROR( "fxpo_archive_put(): could not record url=%s", url );
+    }
+  }
+
+  fxpo_mutex_unlock( &archive->lock );
+}
+
+enum fxpo_status
+fxpo_archive_get( struct fxpo_archive_t * const   archive,
+                  const char * const              url,
+                  const bool                      is_head,
+                  struct fxpo_http_data_t * const res,
+                  double * const                  seconds ) {
+
+  const size_t   url_len = strlen( url );
+  const uint64_t hash    = fxpo_archive_hash( url, url_len, is_head );
+
+  /* First entry of hash. */
+  size_t lo = 0, hi = archive->entries_len;
+  while( lo < hi ) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if( archive->entries[mid].hash < hash ) lo = mid + 1;
+    else hi = mid;
+  }
+
+  enum fxpo_status status = FXPOS_NOT_FOUND;
+
+  fxpo_mutex_lock( &archive->lock );
+  for( size_t i = lo; i < archive->entries_len && archive->entries[i].hash == hash && status == FXPOS_NOT_FOUND; i++ ) {
+    struct fxpo_archive_record_t record;
+    char                         recorded_url[MAX_URL_LENGTH];
+    if( fxpo_archive_seek( archive->file, (int64_t)archive->entries[i].offset, SEEK_SET ) != 0
+        || fread( &record, sizeof(record), 1, archive->file ) != 1 ) {
+      status = FXPOS_INVALID_STATE;
+      break;
+    }
+
+    /* Another request with the same hash. */
+    if( record.url_len != url_len || ((record.flags & ARCHIVE_FLAG_HEAD) != 0) != is_head
+        || fread( recorded_url, 1, url_len, archive->file ) != url_len || memcmp( recorded_url, url, url_len ) != 0 ) {
+      continue;
+    }
+
+    /* The buffer is kept null-terminated like fxpo_http_get_multi leaves it, headers are searched as a string. */
+    if( res->buf_len < (size_t)record.size + 1 ) {
+      uint8_t * const buf = fxpo_realloc( res->buf, (size_t)record.size + 1 );
+      if( buf == NULL ) {
+        status = FXPOS_OUT_OF_MEMORY;
+        break;
+      }
+
+      res->buf     = buf;
+      res->buf_len = (size_t)record.size + 1;
+    }
+
+    if( fread( res->buf, 1, record.size, archive->file ) != record.size ) {
+      status = FXPOS_INVALID_STATE;
+      break;
+    }
+
+    res->size             = record.size;
+    res->buf[record.size] = 0;
+    res->failed           = (record.flags & ARCHIVE_FLAG_FAILED) != 0;
+    *seconds              = (double)record.latency_us / 1e6;
+    status                = FXPOS_OK;
+  }
+  fxpo_mutex_unlock( &archive->lock );
+
+  if( status == FXPOS_INVALID_STATE ) FXPO_LOG_ERROR( "fxpo_archive_get(): could not read the response to url=%s", url );
+  return status;
+}
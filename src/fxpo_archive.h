@@ -0,0 +1,77 @@
+#ifndef FXPO_ARCHIVE_H
+#define FXPO_ARCHIVE_H
+
+#include "fxpo_common.h"
+#include "fxpo_thread.h"
+#include "fxpo_http.h"
+
+/* Entries the index of a recording starts with, it doubles whenever half full. */
+#define ARCHIVE_INITIAL_CAPACITY 4096
+
+/* fxpo_archive_entry_t locates the response to a request in the file of an archive. */
+struct fxpo_archive_entry_t {
+  /* Hash of the URL and method of the request, never 0. */
+  uint64_t hash;
+  uint64_t offset;
+};
+
+/* fxpo_archive_t is a file of HTTP responses keyed by request, so that a run can be repeated byte for
+   byte without the network, e.g. to compare builds. A recording appends every response as it
+   completes, including failed ones, and writes an index of them when closed. A replay serves requests
+   from that index. Requests are keyed by the URL fxpo_http_get_multi is given, before a host is
+   selected, and whether they are HEAD requests. The file is in native byte order:
+
+     "FXPOARC1"
+     record*     struct fxpo_archive_record_t, the URL, then the response
+     index       struct fxpo_archive_entry_t sorted by hash
+     footer      struct fxpo_archive_footer_t
+
+   The records of a recording that was not closed are scanned instead of the missing index. */
+struct fxpo_archive_t {
+  FILE *                        file;
+  bool                          replay;
+  /* Factor applied to the recorded latencies a replay waits for. 0 answers at once. */
+  double                        latency_scale;
+  /* Recording: open addressing table of the responses written, free slots have hash 0.
+     Replay: the index sorted by hash. */
+  struct fxpo_archive_entry_t * entries;
+  size_t                        entries_len;
+  size_t                        entries_capacity;
+  struct fxpo_mutex_t           lock;
+};
+
+/* fxpo_archive_record creates the archive at path, replacing any existing file. */
+enum fxpo_status
+fxpo_archive_record( struct fxpo_archive_t * archive,
+                     const char *            path );
+
+/* fxpo_archive_replay opens the archive at path for replay. latency_scale is applied to the latencies
+   recorded, see fxpo_archive_t. */
+enum fxpo_status
+fxpo_archive_replay( struct fxpo_archive_t * archive,
+                     const char *            path,
+                     double                  latency_scale );
+
+/* fxpo_archive_close writes the index of a recording and closes the archive. */
+void
+fxpo_archive_close( struct fxpo_archive_t * archive );
+
+/* fxpo_archive_put records the response res to url, received in seconds. Only the first response to a
+   request is kept. Failures to write are logged and leave the request out. */
+void
+fxpo_archive_put( struct fxpo_archive_t *         archive,
+                  const char *                    url,
+                  bool                            is_head,
+                  const struct fxpo_http_data_t * res,
+                  double                          seconds );
+
+/* fxpo_archive_get reads the response recorded for url into res and the seconds it took into seconds.
+   Returns FXPOS_NOT_FOUND if the request was not recorded. */
+enum fxpo_status
+fxpo_archive_get( struct fxpo_archive_t *   archive,
+                  const char *              url,
+                  bool                      is_head,
+                  struct fxpo_http_data_t * res,
+                  double *                  seconds );
+
+#endif
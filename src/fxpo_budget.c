@@ -0,0 +1,133 @@
+#include "fxpo_budget.h"
+#include "fxpo_log.h"
+
+void
+fxpo_budget_new( struct fxpo_budget_t * const budget,
+                 const size_t                 limit ) {
+
+  budget->limit    = limit;
+  budget->reserved = 0;
+  budget->used     = 0;
+  memset( budget->waiting, 0, sizeof(budget->waiting) );
+  fxpo_mutex_new( &budget->lock );
+  fxpo_cond_new( &budget->changed );
+}
+
+void
+fxpo_budget_free( struct fxpo_budget_t * const budget ) {
+
+  fxpo_cond_free( &budget->changed );
+  fxpo_mutex_free( &budget->lock );
+}
+
+void
+fxpo_budget_reserve( struct fxpo_budget_t * const budget,
+                     const size_t                 size ) {
+
+  if( budget->limit == 0 ) return;
+
+  if( budget->limit < 2 * size ) {
+    FXPO_LOG_WARN( "fxpo_budget_reserve(): budget=%zu too small to reserve size=%zu for interactive requests", budget->limit, size );
+    return;
+  }
+
+  budget->reserved = size;
+}
+
+enum fxpo_status
+fxpo_budget_acquire( struct fxpo_budget_t * const   budget,
+                     const size_t                   size,
+                     const enum fxpo_priority       priority,
+                     const volatile int64_t * const cancelled ) {
+
+  if( budget->limit == 0 ) return FXPOS_OK;
+
+  const size_t     limit  = priority == FXPO_PRIORITY_INTERACTIVE ? budget->limit : budget->limit - budget->reserved;
+  enum fxpo_status status = FXPOS_OK;
+
+  fxpo_mutex_lock( &budget->lock );
+  budget->waiting[priority]++;
+
+  while( true ) {
+    if( fxpo_atomic_load( cancelled ) ) {
+      status = FXPOS_CANCELLED;
+      break;
+    }
+
+    bool preceded = false;
+    for( enum fxpo_priority p = 0; p < priority; p++ ) preceded |= budget->waiting[p] > 0;
+
+    if( !preceded && (budget->used + size <= limit || budget->used == 0) ) {
+      budget->used += size;
+      break;
+    }
+
+    fxpo_cond_wait_ms( &budget->changed, &budget->lock, BUDGET_CANCEL_CHECK_MS );
+  }
+
+  /* Requests of lower priorities may have been held back by this one. */
+  budget->waiting[priority]--;
+  fxpo_cond_broadcast( &budget->changed );
+  fxpo_mutex_unlock( &budget->lock );
+
+  return status;
+}
+
+void
+fxpo_budget_release( struct fxpo_budget_t * const budget,
+                     const size_t                 size ) {
+
+  if( budget->limit == 0 ) return;
+
+  fxpo_mutex_lock( &budget->lock );
+  budget->used -= size;
+  fxpo_cond_broadcast( &budget->changed );
+  fxpo_mutex_unlock( &budget->lock );
+}
+
+void
+fxpo_budget_wake( struct fxpo_budget_t * const budget ) {
+
+  if( budget->limit == 0 ) return;
+
+  fxpo_mutex_lock( &budget->lock );
+  fxpo_cond_broadcast( &budget->changed );
+  fxpo_mutex_unlock( &budget->lock );
+}
+
+enum fxpo_status
+fxpo_budget_parse_size( const char * const str,
+                        size_t * const     size ) {
+
+  char * end   = NULL;
+  double value = strtod( str, &end );
+
+  if( end == str || value < 0 ) {
+    FXPO_LOG_ERROR( "fxpo_budget_parse_size(): invalid size=%s", str );
+    return FXPOS_INVALID_STATE;
+  }
+
+  switch( *end ) {
+    case 'T': case 't': value *= 1024.0;
+    /* fall through */
+    case 'G': case 'g': value *= 1024.0;
+    /* fall through */
+    case 'M': case 'm': value *= 1024.0;
+    /* fall through */
+    case 'K': case 'k': value *= 1024.0; end++; break;
+    case '\0': break;
+    default:
+      FXPO_LOG_ERROR( "fxpo_budget_parse_size(): unknown unit in size=%s", str );
+      return FXPOS_INVALID_STATE;
+  }
+
+  /* Allow an optional trailing B, e.g. "8GB". */
+  if( *end == 'B' || *end == 'b' ) end++;
+  if( *end != '\0' ) {
+    FXPO_LOG_ERROR( "fxpo_budget_parse_size(): invalid size=%s", str );
+    return FXPOS_INVALID_STATE;
+  }
+
+  *size = (size_t)value;
+  return FXPOS_OK;
+}
@@ -0,0 +1,65 @@
+#ifndef FXPO_BUDGET_H
+#define FXPO_BUDGET_H
+
+#include "fxpo_common.h"
+#include "fxpo_thread.h"
+
+/* Longest a waiting request takes to notice it was cancelled without fxpo_budget_wake, e.g. by a signal handler. */
+#define BUDGET_CANCEL_CHECK_MS 50
+
+/* fxpo_budget_t is an admission controller that bounds the number of bytes held by tiles
+   in the memory-heavy assemble and compress stages. */
+struct fxpo_budget_t {
+  /* Maximum number of bytes that can be admitted at once. 0 means unlimited. */
+  size_t limit;
+  /* Bytes of the limit only interactive requests may use. */
+  size_t reserved;
+  /* Number of bytes currently admitted. */
+  size_t used;
+  /* Number of requests waiting for admission by priority. */
+  size_t              waiting[FXPO_PRIORITY_COUNT];
+  struct fxpo_mutex_t lock;
+  /* Signalled when bytes are released or waiting requests change. */
+  struct fxpo_cond_t  changed;
+};
+
+/* fxpo_budget_new initialises a budget of limit bytes. A limit of 0 disables the budget. */
+void
+fxpo_budget_new( struct fxpo_budget_t * budget,
+                 size_t                 limit );
+
+void
+fxpo_budget_free( struct fxpo_budget_t * budget );
+
+/* fxpo_budget_reserve sets aside size bytes of the budget for interactive requests so that they do
+   not queue behind batch work. Nothing is reserved if the budget cannot also fit a batch request of size bytes. */
+void
+fxpo_budget_reserve( struct fxpo_budget_t * budget,
+                     size_t                 size );
+
+/* fxpo_budget_acquire blocks until size bytes fit into the budget and admits them. Requests are
+   admitted only when no request of a higher priority is waiting.
+   A request larger than the whole budget is admitted once nothing else is in flight
+   so that a too small budget degrades to serial processing rather than a deadlock.
+   Returns FXPOS_CANCELLED without admitting anything if cancelled is set while waiting. */
+enum fxpo_status
+fxpo_budget_acquire( struct fxpo_budget_t *   budget,
+                     size_t                   size,
+                     enum fxpo_priority       priority,
+                     const volatile int64_t * cancelled );
+
+/* fxpo_budget_release returns size bytes previously admitted via fxpo_budget_acquire. */
+void
+fxpo_budget_release( struct fxpo_budget_t * budget,
+                     size_t                 size );
+
+/* fxpo_budget_wake makes waiting requests check whether they were cancelled. */
+void
+fxpo_budget_wake( struct fxpo_budget_t * budget );
+
+/* fxpo_budget_parse_size parses a human readable size such as "8G", "512M" or "1048576". */
+enum fxpo_status
+fxpo_budget_parse_size( const char * str,
+                        size_t *     size );
+
+#endif
@@ -0,0 +1,959 @@
+#include "fxpo_build.h"
+#include "fxpo_log.h"
+#include "fxpo_jpeg.h"
+#include "fxpo_provider.h"
+#include "fxpo_resize.h"
+#include "fxpo_tile.h"
+#include "fxpo_thread.h"
+#include "fxpo_dds.h"
+
+/* Neutral grey, BGRA of which the first PIXEL_CHANNELS bytes are used, of chunks a tolerant builder could not fetch or decode at any zoom level. */
+static const uint8_t fxpo_build_missing_colour[4] = { 128, 128, 128, UINT8_MAX };
+
+/* fxpo_build_fetch fetches the chunk URLs of a tile. Lower priority tiles are limited to a share of
+   the connections while an interactive tile is being fetched. Chunks downloaded are counted in the
+   builder's statistics, responses already filled in are skipped by fxpo_http_get_multi. */
+static enum fxpo_status
+fxpo_build_fetch( const struct fxpo_builder_t * const  builder,
+                  struct fxpo_worker_t * const         worker,
+                  const struct fxpo_provider_t * const provider,
+                  const enum fxpo_priority             priority,
+                  const size_t                         chunks_len,
+                  const bool                           is_head ) {
+
+  struct fxpo_http_policy_t policy = provider->policy;
+  policy.rate              = &builder->rates[provider->id];
+  policy.select_host       = true;
+  policy.tolerate_failures = builder->tolerant;
+  policy.cancelled         = &worker->cancelled;
+  policy.archive           = builder->archive;
+
+  if( priority != FXPO_PRIORITY_INTERACTIVE && builder->interactive_fetches != NULL
+      && fxpo_atomic_load( builder->interactive_fetches ) > 0 ) {
+    if( policy.max_concurrent == 0 || policy.max_concurrent > BATCH_MAX_CONCURRENT_REQUESTS ) policy.max_concurrent = BATCH_MAX_CONCURRENT_REQUESTS;
+  }
+
+  size_t chunks_before = 0, bytes_before = 0;
+  for( size_t i = 0; i < chunks_len && !is_head; i++ ) {
+    if( worker->res[i].size > 0 ) chunks_before++;
+    bytes_before += worker->res[i].size;
+  }
+
+  const enum fxpo_status status = fxpo_http_get_multi( &worker->http_ctx, &policy, worker->urls, chunks_len, worker->res, is_head );
+
+  if( status == FXPOS_OK && !is_head && builder->stats != NULL ) {
+    size_t chunks = 0, bytes = 0;
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      if( worker->res[i].size > 0 ) chunks++;
+      bytes += worker->res[i].size;
+    }
+    fxpo_atomic_add( &builder->stats->chunks_fetched, (int64_t)(chunks - chunks_before) );
+    fxpo_atomic_add( &builder->stats->bytes_downloaded, (int64_t)(bytes - bytes_before) );
+  }
+
+  return status;
+}
+
+size_t
+fxpo_build_thread_size( const size_t max_chunks_per_tile ) {
+
+  return max_chunks_per_tile * HTTP_INITIAL_BUFFER_SIZE + CHUNK_ARENA_SIZE;
+}
+
+size_t
+fxpo_build_stage_size( const uint32_t chunks_per_side,
+                       const bool     scaled_mips ) {
+
+  const struct fxpo_tile_geometry_t * const geometry = fxpo_tile_geometry( chunks_per_side );
+  return geometry->size + (scaled_mips ? fxpo_tile_mips_size( geometry ) : 0) + fxpo_nvtt3_memory_estimate( geometry->width, geometry->width );
+}
+
+enum fxpo_status
+fxpo_worker_new( struct fxpo_worker_t * const worker,
+                 const size_t                 max_chunks_per_tile,
+                 const size_t                 max_parallel ) {
+
+  *worker = (struct fxpo_worker_t) { .max_chunks_per_tile = 0 };
+
+  if( fxpo_http_multi_context_new( &worker->http_ctx, max_parallel, CHUNK_SIZE * 4 ) != FXPOS_OK ) return FXPOS_OUT_OF_MEMORY;
+
+  worker->res    = fxpo_malloc( max_chunks_per_tile * sizeof(struct fxpo_http_data_t) );
+  worker->urls   = fxpo_malloc( max_chunks_per_tile * MAX_URL_LENGTH );
+  worker->chunks = fxpo_malloc( max_chunks_per_tile * sizeof(struct fxpo_chunk_t) );
+  worker->built   = fxpo_malloc( max_chunks_per_tile * sizeof(bool) );
+  worker->uniform = fxpo_malloc( max_chunks_per_tile * sizeof(bool) );
+  worker->colours = fxpo_malloc( max_chunks_per_tile * PIXEL_CHANNELS );
+
+  bool allocated = worker->res != NULL && worker->urls != NULL && worker->chunks != NULL && worker->built != NULL
+                   && worker->uniform != NULL && worker->colours != NULL && fxpo_arena_new( &worker->arena, CHUNK_ARENA_SIZE )
+                   && (worker->jpeg = fxpo_jpeg_new()) != NULL;
+
+  /* Only response buffers that were allocated are released by fxpo_worker_free. */
+  for( ; allocated && worker->max_chunks_per_tile < max_chunks_per_tile; worker->max_chunks_per_tile++ ) {
+    allocated = fxpo_http_data_new( &worker->res[worker->max_chunks_per_tile] ) == FXPOS_OK;
+  }
+
+  if( !allocated ) {
+    fxpo_worker_free( worker );
+    return FXPOS_OUT_OF_MEMORY;
+  }
+
+  return FXPOS_OK;
+}
+
+void
+fxpo_worker_free( struct fxpo_worker_t * const worker ) {
+
+  fxpo_jpeg_free( worker->jpeg );
+  fxpo_arena_free( &worker->arena );
+  fxpo_free( worker->colours );
+  fxpo_free( worker->uniform );
+  fxpo_free( worker->built );
+  fxpo_free( worker->chunks );
+  fxpo_free( worker->urls );
+  for( size_t i = 0; i < worker->max_chunks_per_tile; i++ ) fxpo_http_data_free( &worker->res[i] );
+  fxpo_free( worker->res );
+  fxpo_http_multi_context_free( &worker->http_ctx );
+  *worker = (struct fxpo_worker_t) { .max_chunks_per_tile = 0 };
+}
+
+void
+fxpo_worker_warm( const struct fxpo_builder_t * const builder,
+                  struct fxpo_worker_t * const        worker ) {
+
+  /* A replay makes no connections. */
+  if( builder->mode == FXPO_MODE_OFFLINE || builder->warm_connections == 0 || (builder->archive != NULL && builder->archive->replay) ) return;
+
+  const double start = fxpo_time_s();
+
+  for( enum fxpo_provider p = 0; p < FXPO_PROVIDER_COUNT; p++ ) {
+    const struct fxpo_provider_t * const provider = fxpo_provider_get( p );
+
+    /* Requests to the same host in flight together each open a connection. */
+    size_t urls_len = 0;
+    for( size_t host = 0; host < provider->hosts_len; host++ ) {
+      for( size_t i = 0; i < builder->warm_connections && urls_len < worker->max_chunks_per_tile; i++ ) {
+        if( fxpo_provider_build_host_url( provider, host, worker->urls[urls_len], MAX_URL_LENGTH ) == FXPOS_OK ) urls_len++;
+      }
+    }
+
+    /* Each host is warmed up rather than the ones host selection prefers, which also measures how fast they answer. */
+    struct fxpo_http_policy_t policy = provider->policy;
+    policy.rate      = &builder->rates[p];
+    policy.cancelled = &worker->cancelled;
+
+    if( fxpo_http_get_multi( &worker->http_ctx, &policy, worker->urls, urls_len, worker->res, true ) != FXPOS_OK ) {
+      FXPO_LOG_WARN( "could not warm up connections to provider=%s", provider->name );
+    }
+
+    for( size_t i = 0; i < urls_len; i++ ) fxpo_http_data_reset( &worker->res[i] );
+  }
+
+  FXPO_LOG_DEBUG( "warmed up connections in %.0f ms", (fxpo_time_s() - start) * 1000.0 );
+}
+
+/* fxpo_build_enter_stage reports the stage of the tile being built. Returns false if it was cancelled. */
+static bool
+fxpo_build_enter_stage( const struct fxpo_builder_t * const builder,
+                        const struct fxpo_worker_t * const  worker,
+                        const enum fxpo_stage               stage ) {
+
+  if( fxpo_atomic_load( &worker->cancelled ) ) return false;
+  if( builder->on_stage != NULL ) builder->on_stage( worker, stage, builder->on_stage_user );
+  return true;
+}
+
+/* fxpo_build_same_source tells whether chunk j of a tile is built from the same image as chunk i, e.g.
+   both fall back to the same parent. */
+static inline bool
+fxpo_build_same_source( const struct fxpo_worker_t * const worker,
+                        const size_t                       i,
+                        const size_t                       j ) {
+
+  const struct fxpo_chunk_t * const a = &worker->chunks[i];
+  const struct fxpo_chunk_t * const b = &worker->chunks[j];
+
+  /* A chunk filled in for a failed request may share its coordinates with one that was fetched. */
+  return a->x == b->x && a->y == b->y && a->zoom_level == b->zoom_level && worker->uniform[i] == worker->uniform[j];
+}
+
+/* fxpo_build_repair_probe walks the chunks being repaired further up while the provider reports that it
+   has no imagery for them, like the probe of fxpo_build_tile. A placeholder image would otherwise pass for
+   imagery. Chunks without imagery down to min_zoom_level are left empty and marked failed. The responses
+   of the chunks with imagery hold their headers. */
+static enum fxpo_status
+fxpo_build_repair_probe( const struct fxpo_builder_t * const  builder,
+                         struct fxpo_worker_t * const         worker,
+                         const struct fxpo_provider_t * const provider,
+                         const size_t                         chunks_len,
+                         const uint8_t                        min_zoom_level,
+                         const enum fxpo_priority             priority,
+                         bool * const                         probing ) {
+
+  struct fxpo_http_data_t * const res    = worker->res;
+  struct fxpo_chunk_t * const     chunks = worker->chunks;
+
+  while( true ) {
+    enum fxpo_status status;
+    if( (status = fxpo_build_fetch( builder, worker, provider, priority, chunks_len, true )) != FXPOS_OK ) return status;
+
+    bool again = false;
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      if( !probing[i] || (!res[i].failed && !fxpo_provider_is_no_tile( provider, &res[i] )) ) continue;
+
+      fxpo_http_data_reset( &res[i] );
+
+      if( chunks[i].zoom_level > min_zoom_level ) {
+        FXPO_LOG_WARN( "chunk x=%u y=%u zl=%u is unavailable, falling back to its parent", chunks[i].x, chunks[i].y, chunks[i].zoom_level );
+        fxpo_ortho_downsample_chunk( &chunks[i] );
+        fxpo_provider_build_url( provider, &chunks[i], &worker->urls[i][0], MAX_URL_LENGTH );
+        again = true;
+      } else {
+        FXPO_LOG_WARN( "chunk x=%u y=%u zl=%u is unavailable, filling it in", chunks[i].x, chunks[i].y, chunks[i].zoom_level );
+        res[i].failed = true;
+        probing[i]    = false;
+      }
+    }
+
+    if( !again ) return FXPOS_OK;
+  }
+}
+
+/* fxpo_build_repair replaces chunks of a tile that could not be fetched, or whose response is not a JPEG
+   image, with their ancestors down to min_zoom_level. Chunks still missing are left empty and marked failed. */
+static enum fxpo_status
+fxpo_build_repair( const struct fxpo_builder_t * const  builder,
+                   struct fxpo_worker_t * const         worker,
+                   const struct fxpo_provider_t * const provider,
+                   const size_t                         chunks_len,
+                   const uint8_t                        min_zoom_level,
+                   const enum fxpo_priority             priority ) {
+
+  struct fxpo_http_data_t * const res    = worker->res;
+  struct fxpo_chunk_t * const     chunks = worker->chunks;
+
+  while( true ) {
+    bool refetch = false;
+    bool probing[MAX_CHUNKS_PER_TILE];
+
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      probing[i] = false;
+      if( res[i].size > 0 && fxpo_jpeg_check( worker->jpeg, res[i].buf, res[i].size ) ) continue;
+
+      worker->degraded = true;
+      fxpo_http_data_reset( &res[i] );
+
+      /* The cache already falls back to every ancestor a chunk could be upsampled from. */
+      if( builder->mode != FXPO_MODE_OFFLINE && chunks[i].zoom_level > min_zoom_level ) {
+        FXPO_LOG_WARN( "chunk x=%u y=%u zl=%u is unavailable, falling back to its parent", chunks[i].x, chunks[i].y, chunks[i].zoom_level );
+        fxpo_ortho_downsample_chunk( &chunks[i] );
+        fxpo_provider_build_url( provider, &chunks[i], &worker->urls[i][0], MAX_URL_LENGTH );
+        probing[i] = true;
+        refetch    = true;
+      } else {
+        FXPO_LOG_WARN( "chunk x=%u y=%u zl=%u is unavailable, filling it in", chunks[i].x, chunks[i].y, chunks[i].zoom_level );
+        res[i].failed = true;
+      }
+    }
+
+    if( !refetch ) return FXPOS_OK;
+
+    enum fxpo_status status;
+    if( (status = fxpo_build_repair_probe( builder, worker, provider, chunks_len, min_zoom_level, priority, probing )) != FXPOS_OK ) return status;
+
+    /* Only the reset responses are requested again. */
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      if( probing[i] ) fxpo_http_data_reset( &res[i] );
+    }
+    if( (status = fxpo_build_fetch( builder, worker, provider, priority, chunks_len, false )) != FXPOS_OK ) return status;
+  }
+}
+
+/* fxpo_build_write writes the texture of a tile, either compressed from tile_imgbuf or, if colour is not
+   NULL, a texture of that single colour. mips_imgbuf holds the first TILE_MIPS mips of tile_imgbuf, see
+   fxpo_tile_mips_size, or is NULL for every mip to be filtered from tile_imgbuf. Compression stops if
+   the worker is cancelled. */
+static enum fxpo_status
+fxpo_build_write( const struct fxpo_builder_t * const       builder,
+                  const struct fxpo_worker_t * const        worker,
+                  const struct fxpo_tile_geometry_t * const geometry,
+                  const uint8_t * const                     tile_imgbuf,
+                  uint8_t * const                           mips_imgbuf,
+                  const uint8_t * const                     colour,
+                  const char * const                        path ) {
+
+  if( colour != NULL ) return fxpo_dds_write_uniform( geometry->width, colour, path, &builder->io );
+
+  const uint8_t * mips[TILE_MIPS];
+  for( uint32_t level = 1; level <= TILE_MIPS && mips_imgbuf != NULL; level++ ) mips[level - 1] = fxpo_tile_mip( geometry, mips_imgbuf, level );
+
+  return fxpo_nvtt3_compress( builder->nvtt_ctx, geometry->width, geometry->width, tile_imgbuf, mips, mips_imgbuf != NULL ? TILE_MIPS : 0,
+                              path, &builder->io, &worker->cancelled );
+}
+
+/* fxpo_build_compress writes the texture of a tile to dds_path, see fxpo_build_write. Files are written under
+   a temporary name and renamed over the previous texture, so that the simulator never loads a partial one. */
+static enum fxpo_status
+fxpo_build_compress( const struct fxpo_builder_t * const       builder,
+                     const struct fxpo_worker_t * const        worker,
+                     const struct fxpo_tile_geometry_t * const geometry,
+                     const uint8_t * const                     tile_imgbuf,
+                     uint8_t * const                           mips_imgbuf,
+                     const uint8_t * const                     colour,
+                     const char * const                        dds_path ) {
+
+  if( builder->io.open != NULL ) return fxpo_build_write( builder, worker, geometry, tile_imgbuf, mips_imgbuf, colour, dds_path );
+
+  char tmp_path[MAX_PATH_LENGTH + 32];
+  snprintf( tmp_path, sizeof(tmp_path), "%s.%llx.tmp", dds_path, (unsigned long long)fxpo_thread_id() );
+
+  enum fxpo_status status = fxpo_build_write( builder, worker, geometry, tile_imgbuf, mips_imgbuf, colour, tmp_path );
+
+  if( status == FXPOS_OK && !fxpo_file_replace( tmp_path, dds_path ) ) {
+    FXPO_LOG_ERROR( "fxpo_build_compress(): failed to replace dds=%s", dds_path );
+    status = FXPOS_INVALID_STATE;
+  }
+
+  if( status != FXPOS_OK ) remove( tmp_path );
+
+  return status;
+}
+
+/* fxpo_build_marker_path writes the path of the preview marker of dds_path to path. */
+static void
+fxpo_build_marker_path( const char * const dds_path,
+                        char * const       path,
+                        const size_t       path_len ) {
+
+  snprintf( path, path_len, "%s" PREVIEW_MARKER_SUFFIX, dds_path );
+}
+
+bool
+fxpo_build_is_preview( const char * const dds_path ) {
+
+  char marker_path[MAX_PATH_LENGTH + 16];
+  fxpo_build_marker_path( dds_path, marker_path, sizeof(marker_path) );
+
+  FILE * const f = fopen( marker_path, "rb" );
+  if( f == NULL ) return false;
+  fclose( f );
+  return true;
+}
+
+/* fxpo_build_preview writes a coarse texture upsampled from the single ancestor chunk covering every chunk
+   of the tile, e.g. 4 zoom levels up for 16x16 chunks. Returns FXPOS_NOT_FOUND if there is no such chunk
+   within RESIZE_MAX_SCALE_LOG2 zoom levels. Leaves the worker's buffers reset for the full build. */
+static enum fxpo_status
+fxpo_build_preview( const struct fxpo_builder_t * const       builder,
+                    struct fxpo_worker_t * const              worker,
+                    const struct fxpo_provider_t * const      provider,
+                    const struct fxpo_tile_geometry_t * const geometry,
+                    const uint32_t                            origin_x,
+                    const uint32_t                            origin_y,
+                    const uint8_t                             zoom_level,
+                    const enum fxpo_priority                  priority,
+                    const char * const                        dds_path ) {
+
+  const uint32_t chunks_per_side = geometry->chunks_per_side;
+  const size_t   stage_size      = fxpo_build_stage_size( chunks_per_side, false );
+
+  struct fxpo_http_data_t * const res = &worker->res[0];
+
+  struct fxpo_chunk_t parent = { .x = origin_x, .y = origin_y, .zoom_level = zoom_level };
+  struct fxpo_chunk_t last   = { .x = origin_x + chunks_per_side - 1, .y = origin_y + chunks_per_side - 1, .zoom_level = zoom_level };
+
+  /* Walk up until the first and last chunks of the tile share their ancestor and the provider has imagery. */
+  while( parent.zoom_level > 0 && (parent.x != last.x || parent.y != last.y || parent.zoom_level > provider->max_zoom_level) ) {
+    fxpo_ortho_downsample_chunk( &parent );
+    fxpo_ortho_downsample_chunk( &last );
+  }
+
+  if( parent.x != last.x || parent.y != last.y ) return FXPOS_NOT_FOUND;
+
+  enum fxpo_status status = FXPOS_NOT_FOUND;
+  bool             found  = false;
+
+  if( builder->mode == FXPO_MODE_OFFLINE ) {
+    const uint8_t min_zoom_level = zoom_level > RESIZE_MAX_SCALE_LOG2 ? zoom_level - RESIZE_MAX_SCALE_LOG2 : 0;
+    found = parent.zoom_level >= min_zoom_level && fxpo_cache_lookup( builder->cache, provider, &worker->pack, &parent, min_zoom_level, res );
+  } else {
+    while( !found && zoom_level - parent.zoom_level <= RESIZE_MAX_SCALE_LOG2 ) {
+      fxpo_provider_build_url( provider, &parent, &worker->urls[0][0], MAX_URL_LENGTH );
+      if( (status = fxpo_build_fetch( builder, worker, provider, priority, 1, true )) != FXPOS_OK ) goto cleanup;
+
+      found = !fxpo_provider_is_no_tile( provider, res );
+      fxpo_http_data_reset( res );
+      if( !found ) {
+        if( parent.zoom_level == 0 ) break;
+        fxpo_ortho_downsample_chunk( &parent );
+      }
+    }
+
+    if( found && (status = fxpo_build_fetch( builder, worker, provider, priority, 1, false )) != FXPOS_OK ) goto cleanup;
+  }
+
+  if( !found ) {
+    status = FXPOS_NOT_FOUND;
+    goto cleanup;
+  }
+
+  uint8_t * imgbuf;
+  size_t    imgbuf_len;
+  if( (status = fxpo_jpeg_decode( worker->jpeg, res->buf, res->size, &worker->arena, &imgbuf, &imgbuf_len )) != FXPOS_OK ) goto cleanup;
+
+  if( (status = fxpo_budget_acquire( builder->budget, stage_size, priority, &worker->cancelled )) != FXPOS_OK ) goto cleanup;
+  uint8_t * const tile_imgbuf = fxpo_large_malloc( geometry->size, builder->alloc_flags );
+  if( tile_imgbuf == NULL ) {
+    fxpo_budget_release( builder->budget, stage_size );
+    status = FXPOS_OUT_OF_MEMORY;
+    goto cleanup;
+  }
+
+  const uint8_t downsample = zoom_level - parent.zoom_level;
+
+  struct fxpo_resize_child_t children[MAX_CHUNKS_PER_TILE];
+  size_t                     children_len = 0;
+
+  for( uint32_t yo = 0; yo < chunks_per_side; yo++ ) {
+    for( uint32_t xo = 0; xo < chunks_per_side; xo++ ) {
+      uint32_t x, y, w, h;
+      fxpo_ortho_chunk_bbox( parent.x, parent.y, origin_x + xo, origin_y + yo, downsample, &x, &y, &w, &h );
+
+      children[children_len++] = (struct fxpo_resize_child_t) {
+        .crop_x = x,
+        .crop_y = y,
+        .dst    = geometry->chunk( tile_imgbuf, xo, yo ),
+      };
+    }
+  }
+
+  const struct fxpo_resize_image_t image = {
+    .buf    = imgbuf,
+    .stride = CHUNK_SIZE*PIXEL_CHANNELS,
+    .width  = CHUNK_SIZE,
+    .height = CHUNK_SIZE,
+  };
+
+  FXPO_LOG_DEBUG( "upsampling preview from parent x=%u y=%u zl=%u", parent.x, parent.y, parent.zoom_level );
+  if( (status = fxpo_resize_upsample_children( builder->resize_filter, &image, downsample, children, children_len, &worker->arena, geometry->stride )) == FXPOS_OK ) {
+    /* The marker goes first so that a preview is never taken for a finished texture. */
+    char marker_path[MAX_PATH_LENGTH + 16];
+    fxpo_build_marker_path( dds_path, marker_path, sizeof(marker_path) );
+
+    FILE * const marker = builder->io.open == NULL ? fopen( marker_path, "wb" ) : NULL;
+    if( marker != NULL ) fclose( marker );
+
+    if( builder->io.open == NULL && marker == NULL ) {
+      FXPO_LOG_ERROR( "fxpo_build_preview(): could not write marker=%s", marker_path );
+      status = FXPOS_INVALID_STATE;
+    } else if( (status = fxpo_build_compress( builder, worker, geometry, tile_imgbuf, NULL, NULL, dds_path )) != FXPOS_OK && marker != NULL ) {
+      remove( marker_path );
+    }
+  }
+
+  fxpo_large_free( tile_imgbuf, geometry->size );
+  fxpo_budget_release( builder->budget, stage_size );
+
+cleanup:
+  fxpo_http_data_reset( res );
+  fxpo_arena_reset( &worker->arena );
+
+  return status;
+}
+
+enum fxpo_status
+fxpo_build_tile( const struct fxpo_builder_t * const builder,
+                 struct fxpo_worker_t * const        worker,
+                 const char * const                  tileset,
+                 const struct fxpo_tile_t * const    tile,
+                 const enum fxpo_priority            priority,
+                 const bool                          progressive,
+                 char * const                        dds_path,
+                 const size_t                        dds_path_len ) {
+
+  const bool fetch_only = builder->mode == FXPO_MODE_FETCH_ONLY;
+  const bool offline    = builder->mode == FXPO_MODE_OFFLINE;
+
+  /* Whether this tile is counted in builder->interactive_fetches. */
+  bool interactive_fetch = false;
+  /* Whether a preview was written to dds_path, which has to be removed unless the full texture replaces it. */
+  bool previewed = false;
+
+  struct fxpo_http_data_t * const res     = worker->res;
+  char ( * const urls )[MAX_URL_LENGTH]  = worker->urls;
+  struct fxpo_chunk_t * const     chunks  = worker->chunks;
+  bool * const                    built   = worker->built;
+  bool * const                    uniform = worker->uniform;
+  uint8_t * const                 colours = worker->colours;
+
+  const struct fxpo_tile_geometry_t * const geometry = fxpo_tile_geometry( tile->chunks_per_side );
+  if( geometry == NULL ) {
+    FXPO_LOG_ERROR( "fxpo_build_tile(): unsupported chunks_per_side=%u", tile->chunks_per_side );
+    return FXPOS_INVALID_STATE;
+  }
+
+  const uint32_t chunks_per_side = geometry->chunks_per_side;
+  const size_t   chunks_len      = (size_t)chunks_per_side * chunks_per_side;
+  const size_t   stage_size      = fxpo_build_stage_size( chunks_per_side, builder->scaled_mips );
+
+  if( chunks_len > worker->max_chunks_per_tile ) {
+    FXPO_LOG_ERROR( "fxpo_build_tile(): tile of chunks_per_side=%u does not fit the worker", chunks_per_side );
+    return FXPOS_INVALID_STATE;
+  }
+
+  FXPO_LOG_INFO( "building chunks for tile x=%u y=%u zoom_level=%u", tile->x, tile->y, tile->zoom_level );
+
+  worker->degraded = false;
+  fxpo_arena_reset( &worker->arena );
+  fxpo_ortho_build_dds_path( builder->scenery_path, tileset, tile, dds_path, dds_path_len );
+
+  const struct fxpo_provider_t * const provider = fxpo_provider_get( tile->provider );
+
+  enum fxpo_status status = FXPOS_OK;
+
+  uint8_t * imgbuf;
+  size_t    imgbuf_len;
+
+  /* Pixels of the orthophoto for a tile, e.g. a 4096x4096 image. Allocated once the tile is
+     admitted into the memory budget, on the NUMA node of this thread when pinned. */
+  uint8_t * tile_imgbuf = NULL;
+  /* Mips 1 to TILE_MIPS of tile_imgbuf if builder->scaled_mips is set. */
+  uint8_t * mips_imgbuf = NULL;
+  const size_t mips_size = fxpo_tile_mips_size( geometry );
+
+  /* Top-left chunk of the tile. Textures other than 4096x4096 use chunks from another zoom level. */
+  uint32_t origin_x, origin_y;
+  uint8_t  zoom_level;
+  if( (status = fxpo_ortho_tile_origin( tile, &origin_x, &origin_y, &zoom_level )) != FXPOS_OK ) goto cleanup;
+
+  /* Chunks cached by earlier versions are loose files, read whether or not the tile has a pack. */
+  if( offline ) fxpo_cache_open_tile( builder->cache, provider, tile, &worker->pack );
+
+  /* The coarse texture is written before probing, which takes several round trips for the whole tile. */
+  if( progressive && !fetch_only ) {
+    if( fxpo_atomic_load( &worker->cancelled ) ) {
+      status = FXPOS_CANCELLED;
+      goto cleanup;
+    }
+
+    if( fxpo_build_preview( builder, worker, provider, geometry, origin_x, origin_y, zoom_level, priority, dds_path ) == FXPOS_OK ) {
+      FXPO_LOG_INFO( "saved preview of tile to dds=%s", dds_path );
+      previewed = builder->io.open == NULL;
+      if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_PREVIEW ) ) {
+        status = FXPOS_CANCELLED;
+        goto cleanup;
+      }
+    } else {
+      FXPO_LOG_DEBUG( "no preview for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+    }
+  }
+
+  /* Each tile has chunks_per_side x chunks_per_side chunks, e.g. 256 chunks (16x16) for a 4096x4096 texture. */
+  for( uint32_t yo = 0; yo < chunks_per_side; yo++ ) {
+    for( uint32_t xo = 0; xo < chunks_per_side; xo++ ) {
+      const size_t i = xo*chunks_per_side + yo;
+
+      chunks[i] = (struct fxpo_chunk_t) {
+        .x          = origin_x + xo,
+        .y          = origin_y + yo,
+        .zoom_level = zoom_level,
+        .found      = false,
+      };
+
+      /* No point probing zoom levels the provider has no imagery for. */
+      while( chunks[i].zoom_level > provider->max_zoom_level ) fxpo_ortho_downsample_chunk( &chunks[i] );
+
+      fxpo_provider_build_url( provider, &chunks[i], &urls[i][0], MAX_URL_LENGTH );
+    }
+  }
+
+  /* Chunks are upsampled from ancestors at most RESIZE_MAX_SCALE_LOG2 zoom levels up. */
+  const uint8_t min_zoom_level = zoom_level > RESIZE_MAX_SCALE_LOG2 ? zoom_level - RESIZE_MAX_SCALE_LOG2 : 0;
+
+  if( offline ) {
+    if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_FETCH ) ) {
+      status = FXPOS_CANCELLED;
+      goto cleanup;
+    }
+
+    FXPO_LOG_DEBUG( "reading chunks from cache for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      const bool cached = fxpo_cache_lookup( builder->cache, provider, &worker->pack, &chunks[i], min_zoom_level, &res[i] );
+      if( !cached && builder->tolerant ) {
+        /* Left empty for fxpo_build_repair. */
+        fxpo_http_data_reset( &res[i] );
+        continue;
+      } else if( !cached ) {
+        FXPO_LOG_ERROR( "chunk x=%u y=%u zl=%u of tile x=%u y=%u is not cached", chunks[i].x, chunks[i].y, chunks[i].zoom_level, tile->x, tile->y );
+        status = FXPOS_INVALID_STATE;
+        goto cleanup;
+      }
+
+      chunks[i].found = true;
+      fxpo_provider_build_url( provider, &chunks[i], &urls[i][0], MAX_URL_LENGTH );
+      if( builder->stats != NULL ) fxpo_atomic_add( &builder->stats->chunks_fetched, 1 );
+    }
+
+    goto assemble;
+  }
+
+  if( fetch_only ) {
+    /* Resume an interrupted run: skip tiles whose chunks were all fetched before. */
+    fxpo_cache_open_tile( builder->cache, provider, tile, &worker->pack );
+
+    bool cached = true;
+    for( size_t i = 0; i < chunks_len && cached; i++ ) {
+      struct fxpo_chunk_t chunk = chunks[i];
+      cached = fxpo_cache_lookup( builder->cache, provider, &worker->pack, &chunk, min_zoom_level, NULL );
+    }
+    fxpo_pack_close( &worker->pack );
+
+    if( cached ) {
+      FXPO_LOG_INFO( "tile x=%u y=%u zl=%u is already cached", tile->x, tile->y, tile->zoom_level );
+      goto cleanup;
+    }
+  }
+
+  /* Lower priority tiles back off while this tile is being fetched. */
+  if( priority == FXPO_PRIORITY_INTERACTIVE && builder->interactive_fetches != NULL ) {
+    fxpo_atomic_add( builder->interactive_fetches, 1 );
+    interactive_fetch = true;
+  }
+
+  /* Check if chunk at given zoom level found. Resize if not. */
+  FXPO_LOG_DEBUG( "fetching metadata for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+
+  bool has_chunks = false;
+  /* Chunks without imagery down to min_zoom_level, which cannot be upsampled from further up. */
+  bool exhausted[MAX_CHUNKS_PER_TILE] = { false };
+  bool any_exhausted                  = false;
+
+  do {
+    has_chunks = true;
+
+    /* Probing walks up one zoom level per round, stop between rounds if cancelled. */
+    if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_PROBE ) ) {
+      status = FXPOS_CANCELLED;
+      goto cleanup;
+    }
+
+    if( (status = fxpo_build_fetch( builder, worker, provider, priority, chunks_len, true )) != FXPOS_OK ) {
+      if( status != FXPOS_CANCELLED ) FXPO_LOG_ERROR( "failed to fetch chunk metadata for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+      goto cleanup;
+    }
+
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      struct fxpo_chunk_t * const chunk = &chunks[i];
+      if( chunk->found ) continue;
+
+      /* Check if chunk at given zoom level exists. Downsample if not. */
+      if( fxpo_provider_is_no_tile( provider, &res[i] ) && chunk->zoom_level <= min_zoom_level ) {
+        FXPO_LOG_WARN( "no imagery for chunk x=%u y=%u down to zl=%u", chunk->x, chunk->y, chunk->zoom_level );
+        chunk->found  = true;
+        exhausted[i]  = true;
+        any_exhausted = true;
+      } else if( fxpo_provider_is_no_tile( provider, &res[i] ) ) {
+
+        FXPO_LOG_DEBUG( "missing chunk at x=%u y=%u for zl=%u. downsampling.", chunk->x, chunk->y, chunk->zoom_level );
+        has_chunks = false;
+
+        fxpo_ortho_downsample_chunk( chunk );
+        fxpo_provider_build_url( provider, chunk, &urls[i][0], MAX_URL_LENGTH );
+
+        /* Reset the response buffer to signal fxpo_http_get_multi to make the request again with the new URL. */
+        fxpo_http_data_reset( &res[i] );
+      } else {
+        FXPO_LOG_DEBUG( "found chunk at x=%u y=%u for zl=%u.", chunk->x, chunk->y, chunk->zoom_level );
+        chunk->found = true;
+      }
+    }
+  } while( !has_chunks );
+
+  if( any_exhausted && !builder->tolerant ) {
+    FXPO_LOG_ERROR( "missing chunks for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+    status = FXPOS_INVALID_STATE;
+    goto cleanup;
+  }
+
+  /* Reset HTTP data buffers. Exhausted chunks are not fetched, fxpo_build_repair fills them in. */
+  for( size_t i = 0; i < chunks_len; i++ ) {
+    fxpo_http_data_reset( &res[i] );
+    res[i].failed = exhausted[i];
+  }
+
+  if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_FETCH ) ) {
+    status = FXPOS_CANCELLED;
+    goto cleanup;
+  }
+
+  FXPO_LOG_DEBUG( "fetching images for tile x=%u y=%u", tile->x, tile->y );
+  if( (status = fxpo_build_fetch( builder, worker, provider, priority, chunks_len, false )) != FXPOS_OK ) {
+    if( status != FXPOS_CANCELLED ) FXPO_LOG_ERROR( "failed to fetch images for tile x=%u y=%u", tile->x, tile->y );
+    goto cleanup;
+  }
+
+  if( interactive_fetch ) {
+    fxpo_atomic_add( builder->interactive_fetches, -1 );
+    interactive_fetch = false;
+  }
+
+  if( fetch_only ) {
+    /* Indices of the chunks stored in the pack of the tile. */
+    size_t selected[MAX_CHUNKS_PER_TILE];
+    size_t selected_len = 0;
+
+    for( size_t i = 0; i < chunks_len; i++ ) {
+      /* Chunks sharing a downsampled parent are stored once. */
+      bool duplicate = false;
+      for( size_t j = 0; j < i && chunks[i].zoom_level < zoom_level && !duplicate; j++ ) {
+        duplicate = chunks[j].x == chunks[i].x && chunks[j].y == chunks[i].y && chunks[j].zoom_level == chunks[i].zoom_level;
+      }
+      if( duplicate ) continue;
+
+      /* Left out of the cache so that the next run fetches the tile again. */
+      if( builder->tolerant && !fxpo_jpeg_check( worker->jpeg, res[i].buf, res[i].size ) ) {
+        FXPO_LOG_WARN( "chunk x=%u y=%u zl=%u is unavailable, not caching it", chunks[i].x, chunks[i].y, chunks[i].zoom_level );
+        worker->degraded = true;
+        continue;
+      }
+
+      selected[selected_len++] = i;
+    }
+
+    if( (status = fxpo_cache_write_tile( builder->cache, provider, tile, chunks, res, selected, selected_len )) != FXPOS_OK ) {
+      FXPO_LOG_ERROR( "failed to cache chunks for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+      goto cleanup;
+    }
+
+    FXPO_LOG_INFO( "cached chunks for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+    goto cleanup;
+  }
+
+assemble:
+  if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_ASSEMBLE ) ) {
+    status = FXPOS_CANCELLED;
+    goto cleanup;
+  }
+
+  if( builder->tolerant && (status = fxpo_build_repair( builder, worker, provider, chunks_len, min_zoom_level, priority )) != FXPOS_OK ) {
+    if( status != FXPOS_CANCELLED ) FXPO_LOG_ERROR( "failed to fetch missing chunks for tile x=%u y=%u", tile->x, tile->y );
+    goto cleanup;
+  }
+
+  /* Flat chunks, e.g. open water, are filled with their colour instead of being decoded and upsampled.
+     Chunks left empty by fxpo_build_repair are filled in the same way. */
+  bool    uniform_tile = true;
+  uint8_t lo[PIXEL_CHANNELS], hi[PIXEL_CHANNELS];
+  memset( lo, UINT8_MAX, sizeof(lo) );
+  memset( hi, 0, sizeof(hi) );
+
+  for( size_t i = 0; i < chunks_len; i++ ) {
+    uint8_t * const colour = &colours[i * PIXEL_CHANNELS];
+    if( res[i].size == 0 ) {
+      memcpy( colour, fxpo_build_missing_colour, PIXEL_CHANNELS );
+      uniform[i] = true;
+    } else {
+      uniform[i] = fxpo_jpeg_uniform_colour( worker->jpeg, res[i].buf, res[i].size, &worker->arena, colour );
+    }
+
+    uniform_tile &= uniform[i];
+    for( size_t c = 0; c < PIXEL_CHANNELS; c++ ) {
+      if( colour[c] < lo[c] ) lo[c] = colour[c];
+      if( colour[c] > hi[c] ) hi[c] = colour[c];
+    }
+  }
+
+  /* Chunks each within the range of the first could still drift twice as far apart. */
+  for( size_t c = 0; c < PIXEL_CHANNELS && uniform_tile; c++ ) uniform_tile = hi[c] - lo[c] <= JPEG_UNIFORM_MAX_RANGE;
+
+  /* A tile of a single colour, e.g. open sea, needs neither a tile buffer nor the compressor. */
+  if( uniform_tile ) {
+    if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_COMPRESS ) ) {
+      status = FXPOS_CANCELLED;
+      goto cleanup;
+    }
+
+    if( (status = fxpo_build_compress( builder, worker, geometry, NULL, NULL, colours, dds_path )) != FXPOS_OK ) {
+      if( status != FXPOS_CANCELLED ) FXPO_LOG_ERROR( "failed to write uniform tile to dds=%s", dds_path );
+      goto cleanup;
+    }
+    FXPO_LOG_INFO( "saved uniform tile to dds=%s", dds_path );
+    goto cleanup;
+  }
+
+  if( (status = fxpo_budget_acquire( builder->budget, stage_size, priority, &worker->cancelled )) != FXPOS_OK ) goto cleanup;
+  tile_imgbuf = fxpo_large_malloc( geometry->size, builder->alloc_flags );
+  if( tile_imgbuf == NULL ) {
+    fxpo_budget_release( builder->budget, stage_size );
+    status = FXPOS_OUT_OF_MEMORY;
+    goto cleanup;
+  }
+
+  /* The mips add a third of the tile on top of it, admitted as part of stage_size. */
+  if( builder->scaled_mips && (mips_imgbuf = fxpo_large_malloc( mips_size, builder->alloc_flags )) == NULL ) {
+    status = FXPOS_OUT_OF_MEMORY;
+    goto cleanup;
+  }
+
+  /* Chunks whose first mip was decoded from their JPEG. */
+  bool mipped[MAX_CHUNKS_PER_TILE];
+
+  memset( built, 0, chunks_len * sizeof(bool) );
+  memset( mipped, 0, chunks_len * sizeof(bool) );
+
+  for( uint32_t yo = 0; yo < chunks_per_side; yo++ ) {
+    for( uint32_t xo = 0; xo < chunks_per_side; xo++ ) {
+      const size_t i = xo*chunks_per_side + yo;
+      if( built[i] ) continue;
+
+      /* Decoding and upsampling every chunk takes a while, stop between chunks if cancelled. */
+      if( fxpo_atomic_load( &worker->cancelled ) ) {
+        status = FXPOS_CANCELLED;
+        goto cleanup;
+      }
+
+      const struct fxpo_chunk_t * const     chunk = &chunks[i];
+      const struct fxpo_http_data_t * const data  = &res[i];
+
+      if( uniform[i] ) {
+        /* Chunks falling back to the same parent share its colour. */
+        for( size_t j = i; j < chunks_len; j++ ) {
+          if( built[j] || !fxpo_build_same_source( worker, i, j ) ) continue;
+
+          geometry->fill( tile_imgbuf, (uint32_t)(j / chunks_per_side), (uint32_t)(j % chunks_per_side), &colours[i * PIXEL_CHANNELS] );
+          built[j] = true;
+        }
+        continue;
+      }
+
+      FXPO_LOG_DEBUG( "processing JPEG image for url=%s size=%zu", urls[i], data->size );
+
+      /* Everything allocated for this chunk is released once it is copied into the tile. */
+      const size_t arena_mark = fxpo_arena_mark( &worker->arena );
+
+      /* Byte-identical JPEGs, here or in another tile, are decoded once. */
+      const uint64_t  hash         = data->hash != 0 ? data->hash : fxpo_dedupe_hash( data->buf, data->size );
+      size_t          shared_entry = DEDUPE_CAPACITY;
+      const uint8_t * pixels       = fxpo_dedupe_acquire( builder->dedupe, hash, data->buf, data->size, &shared_entry );
+
+      if( pixels != NULL ) {
+        FXPO_LOG_DEBUG( "reusing decoded JPEG image for url=%s", urls[i] );
+      } else if( (status = fxpo_jpeg_decode( worker->jpeg, data->buf, data->size, &worker->arena, &imgbuf, &imgbuf_len )) == FXPOS_OK ) {
+        FXPO_LOG_DEBUG( "decoded JPEG image to pixel buffer size=%zu", imgbuf_len );
+        if( imgbuf_len == DEDUPE_IMAGE_SIZE ) fxpo_dedupe_offer( builder->dedupe, hash, data->buf, data->size, imgbuf );
+        pixels = imgbuf;
+      } else if( builder->tolerant ) {
+        FXPO_LOG_WARN( "failed to decode JPEG image for url=%s, filling it in", urls[i] );
+
+        for( size_t j = i; j < chunks_len; j++ ) {
+          if( built[j] || !fxpo_build_same_source( worker, i, j ) ) continue;
+
+          geometry->fill( tile_imgbuf, (uint32_t)(j / chunks_per_side), (uint32_t)(j % chunks_per_side), fxpo_build_missing_colour );
+          built[j] = true;
+        }
+
+        worker->degraded = true;
+        status           = FXPOS_OK;
+        fxpo_arena_rewind( &worker->arena, arena_mark );
+        continue;
+      } else {
+        FXPO_LOG_ERROR( "failed to decode JPEG image for url=%s", urls[i] );
+        goto cleanup;
+      }
+
+      const uint8_t downsample = zoom_level - chunk->zoom_level;
+      if( downsample > 0 ) {
+        /* Up to every chunk of the tile may fall back to the same parent. Decode it once and
+           upsample every chunk it covers straight into the tile. */
+        struct fxpo_resize_child_t children[MAX_CHUNKS_PER_TILE];
+        size_t                     children_len = 0;
+
+        for( size_t j = i; j < chunks_len; j++ ) {
+          if( built[j] || !fxpo_build_same_source( worker, i, j ) ) continue;
+
+          const uint32_t sxo = (uint32_t)(j / chunks_per_side);
+          const uint32_t syo = (uint32_t)(j % chunks_per_side);
+          uint32_t       x, y, w, h;
+          fxpo_ortho_chunk_bbox( chunk->x, chunk->y, origin_x + sxo, origin_y + syo, downsample, &x, &y, &w, &h );
+
+          children[children_len++] = (struct fxpo_resize_child_t) {
+            .crop_x = x,
+            .crop_y = y,
+            .dst    = geometry->chunk( tile_imgbuf, sxo, syo ),
+          };
+          built[j] = true;
+        }
+
+        const struct fxpo_resize_image_t parent = {
+          .buf    = pixels,
+          .stride = CHUNK_SIZE*PIXEL_CHANNELS,
+          .width  = CHUNK_SIZE,
+          .height = CHUNK_SIZE,
+        };
+
+        FXPO_LOG_DEBUG( "upsampling %zu chunks from parent x=%u y=%u zl=%u", children_len, chunk->x, chunk->y, chunk->zoom_level );
+        status = fxpo_resize_upsample_children( builder->resize_filter, &parent, downsample, children, children_len, &worker->arena, geometry->stride );
+      } else {
+        geometry->blit( tile_imgbuf, xo, yo, pixels );
+        built[i] = true;
+
+        /* A half scale decode of the same JPEG stands in for filtering the first mip from the tile. */
+        if( mips_imgbuf != NULL ) {
+          uint8_t * const mip = fxpo_tile_mip_chunk( geometry, mips_imgbuf, 1, xo, yo );
+          mipped[i] = fxpo_jpeg_decode_half( worker->jpeg, data->buf, data->size, CHUNK_SIZE, mip, geometry->stride >> 1 ) == FXPOS_OK;
+        }
+      }
+
+      if( shared_entry < DEDUPE_CAPACITY ) fxpo_dedupe_release( builder->dedupe, shared_entry );
+
+      if( status != FXPOS_OK ) {
+        FXPO_LOG_ERROR( "failed to upsample chunks for url=%s", urls[i] );
+        goto cleanup;
+      }
+
+      fxpo_arena_rewind( &worker->arena, arena_mark );
+    }
+  }
+
+  /* Upsampled and filled chunks have no JPEG of their own to decode the first mip from. The mips below
+     the first are box-filtered from it, a second pass over the entropy-coded data of the JPEG costs more. */
+  for( size_t i = 0; i < chunks_len && mips_imgbuf != NULL; i++ ) {
+    for( uint32_t level = mipped[i] ? 2 : 1; level <= TILE_MIPS; level++ ) {
+      geometry->downsample( tile_imgbuf, mips_imgbuf, level, (uint32_t)(i / chunks_per_side), (uint32_t)(i % chunks_per_side) );
+    }
+  }
+
+  FXPO_LOG_DEBUG( "built tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+
+  if( !fxpo_build_enter_stage( builder, worker, FXPO_STAGE_COMPRESS ) ) {
+    status = FXPOS_CANCELLED;
+    goto cleanup;
+  }
+
+  FXPO_LOG_DEBUG( "compressing tile to dds=%s", dds_path );
+  if( (status = fxpo_build_compress( builder, worker, geometry, tile_imgbuf, mips_imgbuf, NULL, dds_path )) != FXPOS_OK ) {
+    if( status != FXPOS_CANCELLED ) FXPO_LOG_ERROR( "failed to compress tile to dds=%s", dds_path );
+    goto cleanup;
+  }
+  FXPO_LOG_INFO( "saved compressed tile to dds=%s", dds_path );
+
+cleanup:
+  if( previewed ) {
+    char marker_path[MAX_PATH_LENGTH + 16];
+    fxpo_build_marker_path( dds_path, marker_path, sizeof(marker_path) );
+
+    if( status != FXPOS_OK ) remove( dds_path );
+    remove( marker_path );
+  }
+  if( interactive_fetch ) fxpo_atomic_add( builder->interactive_fetches, -1 );
+  for( size_t i = 0; i < chunks_len; i++ ) fxpo_http_data_reset( &res[i] );
+  fxpo_pack_close( &worker->pack );
+  if( mips_imgbuf != NULL ) fxpo_large_free( mips_imgbuf, mips_size );
+  if( tile_imgbuf != NULL ) {
+    fxpo_large_free( tile_imgbuf, geometry->size );
+    fxpo_budget_release( builder->budget, stage_size );
+  }
+
+  return status;
+}
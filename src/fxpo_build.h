@@ -0,0 +1,143 @@
+#ifndef FXPO_BUILD_H
+#define FXPO_BUILD_H
+
+#include "fxpo_common.h"
+#include "fxpo_alloc.h"
+#include "fxpo_http.h"
+#include "fxpo_ortho.h"
+#include "fxpo_nvtt3.h"
+#include "fxpo_budget.h"
+#include "fxpo_cache.h"
+#include "fxpo_dedupe.h"
+#include "fxpo_resize.h"
+#include "fxpo_archive.h"
+#include "fxpo_jpeg.h"
+
+#define CHUNK_ARENA_SIZE (4 * CHUNK_SIZE * CHUNK_SIZE * PIXEL_CHANNELS)
+/* Requests in flight per worker for prefetch and background tiles while interactive tiles are being fetched. */
+#define BATCH_MAX_CONCURRENT_REQUESTS 32
+/* Appended to the path of a texture holding a coarse preview until the full resolution texture replaces it,
+   see fxpo_build_is_preview. */
+#define PREVIEW_MARKER_SUFFIX ".preview"
+
+struct fxpo_worker_t;
+
+/* fxpo_build_stats_t counts the work of every thread building tiles, see fxpo_stats_t. */
+struct fxpo_build_stats_t {
+  /* Chunks downloaded or read from the chunk cache. */
+  volatile int64_t chunks_fetched;
+  volatile int64_t bytes_downloaded;
+};
+
+/* fxpo_builder_t is the state shared by every thread building tiles. */
+struct fxpo_builder_t {
+  const char *                  scenery_path;
+  enum fxpo_mode                mode;
+  /* FXPO_ALLOC_* flags for tile buffers. */
+  uint32_t                      alloc_flags;
+  /* Pin threads building tiles to cores. */
+  bool                          pin_threads;
+  struct fxpo_budget_t *        budget;
+  struct fxpo_nvtt3_context_t * nvtt_ctx;
+  struct fxpo_cache_t *         cache;
+  /* Rate limits of each provider, indexed by enum fxpo_provider. */
+  struct fxpo_http_rate_t *     rates;
+  /* Decoded chunks shared by every thread. */
+  struct fxpo_dedupe_t *        dedupe;
+  /* Statistics updated by every thread. May be NULL. */
+  struct fxpo_build_stats_t *   stats;
+  /* Archive recording the chunk responses, or replaying them instead of fetching. May be NULL. */
+  struct fxpo_archive_t *       archive;
+  /* Number of interactive tiles being fetched. NULL if every tile has the same priority. */
+  volatile int64_t *            interactive_fetches;
+  enum fxpo_resize_filter       resize_filter;
+  /* Connections each thread opens to every provider host before building its first tile. */
+  size_t                        warm_connections;
+  /* Fill chunks that cannot be fetched or decoded from their ancestors or a neutral colour instead of
+     failing the tile, see fxpo_worker_t.degraded. */
+  bool                          tolerant;
+  /* Decode mips 1 to TILE_MIPS of each chunk from its JPEG at reduced scale instead of filtering them
+     from the tile. */
+  bool                          scaled_mips;
+  /* Destination of the textures, see fxpo_texture_io_t. */
+  struct fxpo_texture_io_t      io;
+  /* Called on the worker as each tile enters a stage. May be NULL. */
+  void ( * on_stage )( const struct fxpo_worker_t * worker, enum fxpo_stage stage, void * user );
+  void *                        on_stage_user;
+};
+
+/* fxpo_worker_t holds the buffers and connections of a thread building tiles. They are allocated
+   once and reused for every tile the thread builds. */
+struct fxpo_worker_t {
+  struct fxpo_http_multi_context_t http_ctx;
+  /* HTTP response buffers. */
+  struct fxpo_http_data_t * res;
+  char ( * urls )[MAX_URL_LENGTH];
+  struct fxpo_chunk_t * chunks;
+  /* Chunks built together with a sibling sharing the same downsampled parent. */
+  bool * built;
+  /* Chunks of a single flat colour, e.g. open water, and their BGRA colour of PIXEL_CHANNELS bytes each. */
+  bool *    uniform;
+  uint8_t * colours;
+  /* Scratch memory for decoding and resizing chunks. Holds a decoded chunk and the resize rows. */
+  struct fxpo_arena_t arena;
+  /* Decompressor reused for every JPEG of the worker. */
+  tjhandle jpeg;
+  /* Pack of the tile being built from the cache, res borrows its JPEGs. */
+  struct fxpo_pack_t pack;
+  /* Capacity of res, urls, chunks, built, uniform and colours. */
+  size_t max_chunks_per_tile;
+  /* Owner of the worker, for fxpo_builder_t.on_stage. */
+  void * owner;
+  /* Set by another thread to stop building the current tile at the next stage. */
+  volatile int64_t cancelled;
+  /* Set by fxpo_build_tile if chunks of the last tile were filled in by fxpo_builder_t.tolerant. */
+  bool degraded;
+};
+
+/* fxpo_build_thread_size returns the memory held by a worker for tiles of up to max_chunks_per_tile chunks. */
+size_t
+fxpo_build_thread_size( size_t max_chunks_per_tile );
+
+/* fxpo_build_is_preview returns whether the texture at dds_path is a coarse preview left by a progressive
+   build that did not complete, e.g. because the process was killed. Such textures have to be built again. */
+bool
+fxpo_build_is_preview( const char * dds_path );
+
+/* fxpo_build_stage_size returns the memory held by a tile while it is assembled and compressed, including
+   its first mips if scaled_mips is set. */
+size_t
+fxpo_build_stage_size( uint32_t chunks_per_side,
+                       bool     scaled_mips );
+
+/* fxpo_worker_new allocates the buffers of a worker. Nothing needs to be freed on failure. */
+enum fxpo_status
+fxpo_worker_new( struct fxpo_worker_t * worker,
+                 size_t                 max_chunks_per_tile,
+                 size_t                 max_parallel );
+
+void
+fxpo_worker_free( struct fxpo_worker_t * worker );
+
+/* fxpo_worker_warm resolves every provider host and opens builder->warm_connections keep-alive connections
+   to each, so that the first tile of the worker does not wait for DNS, TCP and TLS handshakes. */
+void
+fxpo_worker_warm( const struct fxpo_builder_t * builder,
+                  struct fxpo_worker_t *        worker );
+
+/* fxpo_build_tile fetches the chunks of tile and, depending on the builder's mode, caches them or
+   compresses them into the tile's DDS texture in tileset. The path of the texture is returned in dds_path.
+   Lower priority tiles leave connections and memory to interactive tiles. A progressive build first
+   writes a coarse texture from a single ancestor chunk, replaced once the full resolution one is compressed.
+   Returns FXPOS_CANCELLED if worker->cancelled is set before the tile is complete. */
+enum fxpo_status
+fxpo_build_tile( const struct fxpo_builder_t * builder,
+                 struct fxpo_worker_t *        worker,
+                 const char *                  tileset,
+                 const struct fxpo_tile_t *    tile,
+                 enum fxpo_priority            priority,
+                 bool                          progressive,
+                 char *                        dds_path,
+                 size_t                        dds_path_len );
+
+#endif
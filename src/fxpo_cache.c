@@ -0,0 +1,199 @@
+#include "fxpo_cache.h"
+#include "fxpo_log.h"
+#include "fxpo_alloc.h"
+#include "fxpo_thread.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <errno.h>
+#endif
+
+void
+fxpo_cache_new( struct fxpo_cache_t * const cache,
+                const char * const          root ) {
+
+  snprintf( cache->root, sizeof(cache->root), "%s", root );
+}
+
+void
+fxpo_cache_build_path( const struct fxpo_cache_t * const    cache,
+                       const struct fxpo_provider_t * const provider,
+                       const struct fxpo_chunk_t * const    chunk,
+                       char * const                         path,
+                       const size_t                         path_len ) {
+
+  snprintf( path, path_len, "%s/%s/%u/%u_%u.jpeg", cache->root, provider->name, chunk->zoom_level, chunk->x, chunk->y );
+}
+
+void
+fxpo_cache_build_tile_path( const struct fxpo_cache_t * const    cache,
+                            const struct fxpo_provider_t * const provider,
+                            const struct fxpo_tile_t * const     tile,
+                            char * const                         path,
+                            const size_t                         path_len ) {
+
+  snprintf( path, path_len, "%s/%s/packs/%u/%u_%u_%u.pack", cache->root, provider->name, tile->zoom_level, tile->x, tile->y, tile->chunks_per_side );
+}
+
+bool
+fxpo_cache_open_tile( const struct fxpo_cache_t * const    cache,
+                      const struct fxpo_provider_t * const provider,
+                      const struct fxpo_tile_t * const     tile,
+                      struct fxpo_pack_t * const           pack ) {
+
+  char path[MAX_PATH_LENGTH];
+  fxpo_cache_build_tile_path( cache, provider, tile, path, sizeof(path) );
+
+  return fxpo_pack_open( pack, path );
+}
+
+/* fxpo_cache_mkdir creates a directory. An already existing directory is not an error. */
+static bool
+fxpo_cache_mkdir( const char * const path ) {
+
+#ifdef _WIN32
+  return CreateDirectoryA( path, NULL ) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+  return mkdir( path, 0755 ) == 0 || errno == EEXIST;
+#endif
+}
+
+/* fxpo_cache_mkdirs creates every missing parent directory of path. */
+static enum fxpo_status
+fxpo_cache_mkdirs( const char * const path ) {
+
+  char dir[MAX_PATH_LENGTH];
+  snprintf( dir, sizeof(dir), "%s", path );
+
+  /* Skip the drive or root so only directories below it are created. */
+  char * p = dir;
+  if( p[0] != '\0' && p[1] == ':' ) p += 2;
+  while( *p == '/' || *p == '\\' ) p++;
+
+  for( ; *p != '\0'; p++ ) {
+    if( *p != '/' && *p != '\\' ) continue;
+
+    const char separator = *p;
+    *p = '\0';
+    if( !fxpo_cache_mkdir( dir ) ) {
+      FXPO_LOG_ERROR( "fxpo_cache_mkdirs(): could not create directory=%s", dir );
+      return FXPOS_INVALID_STATE;
+    }
+    *p = separator;
+  }
+
+  return FXPOS_OK;
+}
+
+/* fxpo_cache_read reads the file at path into data. Returns false if the file does not exist. */
+static bool
+fxpo_cache_read( const char * const              path,
+                 struct fxpo_http_data_t * const data ) {
+
+  FILE * const f = fopen( path, "rb" );
+  if( f == NULL ) return false;
+
+  if( data == NULL ) {
+    fclose( f );
+    return true;
+  }
+
+  fseek( f, 0, SEEK_END );
+  const long size = ftell( f );
+  fseek( f, 0, SEEK_SET );
+
+  if( size <= 0 ) {
+    fclose( f );
+    return false;
+  }
+
+  if( data->buf_len < (size_t)size ) {
+    uint8_t * const buf = fxpo_realloc( data->buf, (size_t)size );
+    if( buf == NULL ) {
+      fclose( f );
+      return false;
+    }
+
+    data->buf     = buf;
+    data->buf_len = (size_t)size;
+  }
+
+  data->size = fread( data->buf, 1, (size_t)size, f );
+  fclose( f );
+
+  return data->size == (size_t)size;
+}
+
+bool
+fxpo_cache_lookup( const struct fxpo_cache_t * const    cache,
+                   const struct fxpo_provider_t * const provider,
+                   const struct fxpo_pack_t * const     pack,
+                   struct fxpo_chunk_t * const          chunk,
+                   const uint8_t                        min_zoom_level,
+                   struct fxpo_http_data_t * const      data ) {
+
+  struct fxpo_chunk_t candidate = *chunk;
+  char                path[MAX_PATH_LENGTH];
+
+  while( true ) {
+    const struct fxpo_pack_entry_t * const entry = pack != NULL ? fxpo_pack_find( pack, &candidate ) : NULL;
+    if( entry != NULL ) {
+      if( data != NULL ) fxpo_http_data_borrow( data, pack->data + entry->offset, entry->length, entry->hash );
+      *chunk = candidate;
+      return true;
+    }
+
+    fxpo_cache_build_path( cache, provider, &candidate, path, sizeof(path) );
+
+    if( fxpo_cache_read( path, data ) ) {
+      *chunk = candidate;
+      return true;
+    }
+
+    if( candidate.zoom_level <= min_zoom_level ) return false;
+    fxpo_ortho_downsample_chunk( &candidate );
+  }
+}
+
+enum fxpo_status
+fxpo_cache_write_tile( const struct fxpo_cache_t * const     cache,
+                       const struct fxpo_provider_t * const  provider,
+                       const struct fxpo_tile_t * const      tile,
+                       const struct fxpo_chunk_t * const     chunks,
+                       const struct fxpo_http_data_t * const res,
+                       const size_t * const                  selected,
+                       const size_t                          selected_len ) {
+
+  char path[MAX_PATH_LENGTH];
+  char tmp_path[MAX_PATH_LENGTH + 32];
+
+  fxpo_cache_build_tile_path( cache, provider, tile, path, sizeof(path) );
+  /* Threads building the same tile at different priorities must not write the same temporary file. */
+  snprintf( tmp_path, sizeof(tmp_path), "%s.%llx.tmp", path, (unsigned long long)fxpo_thread_id() );
+
+  FILE * f = fopen( tmp_path, "wb" );
+  if( f == NULL ) {
+    if( fxpo_cache_mkdirs( path ) != FXPOS_OK ) return FXPOS_INVALID_STATE;
+    f = fopen( tmp_path, "wb" );
+  }
+
+  if( f == NULL ) {
+    FXPO_LOG_ERROR( "fxpo_cache_write_tile(): could not open file=%s", tmp_path );
+    return FXPOS_INVALID_STATE;
+  }
+
+  const enum fxpo_status status = fxpo_pack_write( f, chunks, res, selected, selected_len );
+  if( fclose( f ) != 0 || status != FXPOS_OK ) {
+    FXPO_LOG_ERROR( "fxpo_cache_write_tile(): could not write file=%s", tmp_path );
+    remove( tmp_path );
+    return status != FXPOS_OK ? status : FXPOS_INVALID_STATE;
+  }
+
+  if( !fxpo_file_replace( tmp_path, path ) ) {
+    FXPO_LOG_ERROR( "fxpo_cache_write_tile(): could not rename file=%s", tmp_path );
+    remove( tmp_path );
+    return FXPOS_INVALID_STATE;
+  }
+
+  return FXPOS_OK;
+}
@@ -0,0 +1,70 @@
+#ifndef FXPO_CACHE_H
+#define FXPO_CACHE_H
+
+#include "fxpo_common.h"
+#include "fxpo_ortho.h"
+#include "fxpo_http.h"
+#include "fxpo_provider.h"
+#include "fxpo_pack.h"
+
+/* fxpo_cache_t is an on-disk store of raw chunk JPEGs. The chunks of a tile are stored together in a pack,
+   see fxpo_pack_t, laid out as <root>/<provider>/packs/<zl>/<x>_<y>_<chunks per side>.pack. Loose chunks
+   laid out as <root>/<provider>/<zl>/<x>_<y>.jpeg, as written by earlier versions, are still read.
+   It decouples fetching chunks from building textures so both can run on different machines or at different times. */
+struct fxpo_cache_t {
+  char root[MAX_PATH_LENGTH];
+};
+
+/* fxpo_cache_new opens the cache rooted at root. Directories are created on the first write. */
+void
+fxpo_cache_new( struct fxpo_cache_t * cache,
+                const char *          root );
+
+/* fxpo_cache_build_path builds the path of a chunk in the cache. */
+void
+fxpo_cache_build_path( const struct fxpo_cache_t *    cache,
+                       const struct fxpo_provider_t * provider,
+                       const struct fxpo_chunk_t *    chunk,
+                       char *                         path,
+                       size_t                         path_len );
+
+/* fxpo_cache_build_tile_path builds the path of the pack of a tile in the cache. */
+void
+fxpo_cache_build_tile_path( const struct fxpo_cache_t *    cache,
+                            const struct fxpo_provider_t * provider,
+                            const struct fxpo_tile_t *     tile,
+                            char *                         path,
+                            size_t                         path_len );
+
+/* fxpo_cache_open_tile maps the pack of tile into pack. Returns false if the tile has no pack. */
+bool
+fxpo_cache_open_tile( const struct fxpo_cache_t *    cache,
+                      const struct fxpo_provider_t * provider,
+                      const struct fxpo_tile_t *     tile,
+                      struct fxpo_pack_t *           pack );
+
+/* fxpo_cache_lookup finds chunk in the cache or, failing that, its closest ancestor not below min_zoom_level.
+   Each candidate is looked up in pack, if not NULL, then as a loose chunk. On success chunk is updated to
+   the cached chunk and, if data is not NULL, its JPEG is put into data. JPEGs found in pack are borrowed
+   from the mapping rather than copied, so data must be reset before pack is closed. */
+bool
+fxpo_cache_lookup( const struct fxpo_cache_t *    cache,
+                   const struct fxpo_provider_t * provider,
+                   const struct fxpo_pack_t *     pack,
+                   struct fxpo_chunk_t *          chunk,
+                   uint8_t                        min_zoom_level,
+                   struct fxpo_http_data_t *      data );
+
+/* fxpo_cache_write_tile stores the JPEGs res[i] of chunks[i] for the indices i in selected as the pack of
+   tile. The file is written under a temporary name and renamed into place so that readers never see a
+   partial pack. */
+enum fxpo_status
+fxpo_cache_write_tile( const struct fxpo_cache_t *     cache,
+                       const struct fxpo_provider_t *  provider,
+                       const struct fxpo_tile_t *      tile,
+                       const struct fxpo_chunk_t *     chunks,
+                       const struct fxpo_http_data_t * res,
+                       const size_t *                  selected,
+                       size_t                          selected_len );
+
+#endif
@@ -19,12 +19,109 @@
 #define strdup _strdup
 #endif
 
+#include "fxpo.h"
+
 #define MAX_PATH_LENGTH 1023
 
-enum fxpo_status {
-  FXPOS_OK = 0,
-  FXPOS_NULL_POINTER,
-  FXPOS_INVALID_STATE,
-};
+/* Chunks are decoded, assembled and upsampled as 8-bit BGRA pixels, or packed BGR pixels when built with
+   FXPO_TILE_BGR. Alpha is always opaque, dropping it cuts the memory traffic of those stages by a quarter. */
+#ifdef FXPO_TILE_BGR
+#define PIXEL_CHANNELS 3
+#else
+#define PIXEL_CHANNELS 4
+#endif
+
+/* Thread-local storage for any thread, unlike OpenMP threadprivate which only covers threads of OpenMP teams. */
+#ifdef _MSC_VER
+#define FXPO_THREAD_LOCAL __declspec(thread)
+#else
+#define FXPO_THREAD_LOCAL _Thread_local
+#endif
+
+/* Atomics shared between threads outside of OpenMP constructs. MSVC's OpenMP 2.0 has no atomic reads
+   or writes and C11 atomics are experimental in MSVC, so use the platform primitives. */
+#ifdef _WIN32
+static inline int64_t
+fxpo_atomic_load( const volatile int64_t * const ptr ) {
+
+  /* Aligned 64-bit volatile reads have acquire semantics on x64 with /volatile:ms. */
+  return *ptr;
+}
+
+static inline void
+fxpo_atomic_store( volatile int64_t * const ptr,
+                   const int64_t            value ) {
+
+  InterlockedExchange64( ptr, value );
+}
+
+static inline int64_t
+fxpo_atomic_add( volatile int64_t * const ptr,
+                 const int64_t            value ) {
+
+  return InterlockedExchangeAdd64( ptr, value ) + value;
+}
+#else
+static inline int64_t
+fxpo_atomic_load( const volatile int64_t * const ptr ) {
+
+  return __atomic_load_n( ptr, __ATOMIC_ACQUIRE );
+}
+
+static inline void
+fxpo_atomic_store( volatile int64_t * const ptr,
+                   const int64_t            value ) {
+
+  __atomic_store_n( ptr, value, __ATOMIC_RELEASE );
+}
+
+static inline int64_t
+fxpo_atomic_add( volatile int64_t * const ptr,
+                 const int64_t            value ) {
+
+  return __atomic_add_fetch( ptr, value, __ATOMIC_ACQ_REL );
+}
+#endif
+
+/* fxpo_file_replace renames tmp_path to path, replacing any existing file atomically. */
+static inline bool
+fxpo_file_replace( const char * const tmp_path,
+                   const char * const path ) {
+
+#ifdef _WIN32
+  return MoveFileExA( tmp_path, path, MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+  return rename( tmp_path, path ) == 0;
+#endif
+}
+
+/* fxpo_sleep_ms suspends the calling thread for at least ms milliseconds. */
+static inline void
+fxpo_sleep_ms( const uint32_t ms ) {
+
+#ifdef _WIN32
+  Sleep( ms );
+#else
+  const struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+  nanosleep( &ts, NULL );
+#endif
+}
+
+/* fxpo_time_s returns the seconds elapsed on a monotonic clock since an arbitrary point, for measuring
+   intervals on any thread. */
+static inline double
+fxpo_time_s() {
+
+#ifdef _WIN32
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency( &frequency );
+  QueryPerformanceCounter( &counter );
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
 
 #endif
\ No newline at end of file
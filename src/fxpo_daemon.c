@@ -0,0 +1,500 @@
+#include "fxpo_daemon.h"
+#include "fxpo_log.h"
+#include "fxpo_alloc.h"
+#include "fxpo_thread.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+typedef SOCKET fxpo_socket_t;
+
+#define FXPO_INVALID_SOCKET INVALID_SOCKET
+#define FXPO_SEND_FLAGS     0
+#define fxpo_socket_close   closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+typedef int fxpo_socket_t;
+
+#define FXPO_INVALID_SOCKET (-1)
+/* Report a client that went away as an error rather than raising SIGPIPE. */
+#define FXPO_SEND_FLAGS     MSG_NOSIGNAL
+#define fxpo_socket_close   close
+#endif
+
+/* fxpo_daemon_upload_t is a texture waiting to be streamed to a connection by the sender thread. */
+struct fxpo_daemon_upload_t {
+  struct fxpo_daemon_upload_t * next;
+  fxpo_socket_t                 sock;
+  char                          path[MAX_PATH_LENGTH];
+};
+
+struct fxpo_daemon_t {
+  struct fxpo_context_t * ctx;
+  volatile int64_t        stopping;
+
+  /* Textures are streamed by a thread of their own so that slow clients do not hold up the workers. */
+  struct fxpo_thread_t          sender;
+  struct fxpo_mutex_t           lock;
+  /* Signalled when an upload is queued or the sender is stopping. */
+  struct fxpo_cond_t            queued;
+  struct fxpo_daemon_upload_t * uploads;
+  struct fxpo_daemon_upload_t * uploads_tail;
+  bool                          sender_stopping;
+};
+
+/* fxpo_daemon_request_t is the connection waiting for a texture. */
+struct fxpo_daemon_request_t {
+  struct fxpo_daemon_t * daemon;
+  fxpo_socket_t          sock;
+  /* Respond with the DDS contents instead of its path. */
+  bool                   send_dds;
+  /* Answered with the preview of a progressive request, the connection is closed. */
+  bool                   answered;
+};
+
+static bool
+fxpo_daemon_send( const fxpo_socket_t sock,
+                  const char *        buf,
+                  size_t              len ) {
+
+  while( len > 0 ) {
+    const int sent = send( sock, buf, (int)(len < INT32_MAX ? len : INT32_MAX), FXPO_SEND_FLAGS );
+    if( sent <= 0 ) return false;
+    buf += sent;
+    len -= (size_t)sent;
+  }
+
+  return true;
+}
+
+static void
+fxpo_daemon_respond( const fxpo_socket_t sock,
+                     const uint32_t      status_code,
+                     const char *        reason,
+                     const char *        body ) {
+
+  char         header[256];
+  const size_t body_len   = strlen( body );
+  const int    header_len = snprintf( header, sizeof(header),
+                                      "HTTP/1.1 %u %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                                      status_code, reason, body_len );
+
+  if( !fxpo_daemon_send( sock, header, (size_t)header_len ) || !fxpo_daemon_send( sock, body, body_len ) ) {
+    FXPO_LOG_WARN( "fxpo_daemon_respond(): client closed the connection" );
+  }
+}
+
+/* fxpo_daemon_respond_file streams the file at path as the response body. */
+static void
+fxpo_daemon_respond_file( const fxpo_socket_t sock,
+                          const char *        path ) {
+
+  FILE * const f = fopen( path, "rb" );
+  if( f == NULL ) {
+    fxpo_daemon_respond( sock, 500, "Internal Server Error", "could not open texture\n" );
+    return;
+  }
+
+  fseek( f, 0, SEEK_END );
+  const long size = ftell( f );
+  fseek( f, 0, SEEK_SET );
+
+  char      buf[64 * 1024];
+  const int header_len = snprintf( buf, sizeof(buf),
+                                   "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: %ld\r\nConnection: close\r\n\r\n",
+                                   size );
+
+  bool   sent = fxpo_daemon_send( sock, buf, (size_t)header_len );
+  size_t len;
+  while( sent && (len = fread( buf, 1, sizeof(buf), f )) > 0 ) sent = fxpo_daemon_send( sock, buf, len );
+
+  if( !sent ) FXPO_LOG_WARN( "fxpo_daemon_respond_file(): client closed the connection" );
+
+  fclose( f );
+}
+
+/* fxpo_daemon_sender_main streams queued textures until the daemon stops and none is left. */
+static void
+fxpo_daemon_sender_main( void * const arg ) {
+
+  struct fxpo_daemon_t * const daemon = arg;
+
+  fxpo_mutex_lock( &daemon->lock );
+  while( true ) {
+    while( daemon->uploads == NULL && !daemon->sender_stopping ) fxpo_cond_wait( &daemon->queued, &daemon->lock );
+
+    struct fxpo_daemon_upload_t * const upload = daemon->uploads;
+    if( upload == NULL ) break;
+
+    daemon->uploads = upload->next;
+    if( daemon->uploads == NULL ) daemon->uploads_tail = NULL;
+    fxpo_mutex_unlock( &daemon->lock );
+
+    fxpo_daemon_respond_file( upload->sock, upload->path );
+    fxpo_socket_close( upload->sock );
+    fxpo_free( upload );
+
+    fxpo_mutex_lock( &daemon->lock );
+  }
+  fxpo_mutex_unlock( &daemon->lock );
+}
+
+/* fxpo_daemon_queue_upload hands the connection of request to the sender thread to stream the texture at
+   path. Returns false if it could not be queued. */
+static bool
+fxpo_daemon_queue_upload( const struct fxpo_daemon_request_t * const request,
+                          const char * const                         path ) {
+
+  struct fxpo_daemon_t * const        daemon = request->daemon;
+  struct fxpo_daemon_upload_t * const upload = fxpo_malloc( sizeof(struct fxpo_daemon_upload_t) );
+  if( upload == NULL || strlen( path ) >= sizeof(upload->path) ) {
+    fxpo_free( upload );
+    return false;
+  }
+
+  upload->next = NULL;
+  upload->sock = request->sock;
+  strcpy( upload->path, path );
+
+  fxpo_mutex_lock( &daemon->lock );
+  if( daemon->uploads_tail != NULL ) daemon->uploads_tail->next = upload;
+  else daemon->uploads = upload;
+  daemon->uploads_tail = upload;
+  fxpo_cond_signal( &daemon->queued );
+  fxpo_mutex_unlock( &daemon->lock );
+
+  return true;
+}
+
+/* fxpo_daemon_answer answers the connection waiting for a texture and closes it, or hands it to the
+   sender thread to stream the texture. */
+static void
+fxpo_daemon_answer( struct fxpo_daemon_request_t * const request,
+                    const struct fxpo_result_t * const   result ) {
+
+  request->answered = true;
+
+  if( result->status == FXPOS_CANCELLED ) {
+    fxpo_daemon_respond( request->sock, 503, "Service Unavailable", "shutting down\n" );
+  } else if( result->status != FXPOS_OK ) {
+    fxpo_daemon_respond( request->sock, 500, "Internal Server Error", "failed to build texture\n" );
+  } else if( request->send_dds ) {
+    if( fxpo_daemon_queue_upload( request, result->dds_path ) ) return;
+    fxpo_daemon_respond( request->sock, 500, "Internal Server Error", "out of memory\n" );
+  } else {
+    char body[MAX_PATH_LENGTH + 1];
+    snprintf( body, sizeof(body), "%s\n", result->dds_path );
+    fxpo_daemon_respond( request->sock, 200, "OK", body );
+  }
+
+  fxpo_socket_close( request->sock );
+}
+
+/* fxpo_daemon_preview answers a progressive request as soon as its coarse texture is written. The
+   simulator loads it right away and picks up the full resolution texture when it is reloaded. */
+static void
+fxpo_daemon_preview( const struct fxpo_result_t * const result,
+                     void * const                       user ) {
+
+  fxpo_daemon_answer( user, result );
+}
+
+/* fxpo_daemon_done answers the connection unless a preview already did. Runs on the worker that built it,
+   textures are streamed by the sender thread. */
+static void
+fxpo_daemon_done( const struct fxpo_result_t * const result,
+                  void * const                       user ) {
+
+  struct fxpo_daemon_request_t * const request = user;
+
+  if( !request->answered ) fxpo_daemon_answer( request, result );
+  fxpo_free( request );
+}
+
+/* fxpo_daemon_read_request reads the request line and headers. Request bodies are not used by the API. */
+static bool
+fxpo_daemon_read_request( const fxpo_socket_t sock,
+                          char *              buf,
+                          const size_t        buf_len ) {
+
+  size_t len = 0;
+
+  while( len + 1 < buf_len ) {
+    const int received = recv( sock, buf + len, (int)(buf_len - len - 1), 0 );
+    if( received <= 0 ) return false;
+
+    len     += (size_t)received;
+    buf[len] = '\0';
+    if( strstr( buf, "\r\n\r\n" ) != NULL ) return true;
+  }
+
+  return false;
+}
+
+/* fxpo_daemon_parse_query parses the query parameters of a request. */
+static bool
+fxpo_daemon_parse_query( char *                        query,
+                         struct fxpo_request_t * const request,
+                         bool * const                  send_dds ) {
+
+  static const char * const priorities[FXPO_PRIORITY_COUNT] = {
+    [FXPO_PRIORITY_INTERACTIVE] = "priority=interactive",
+    [FXPO_PRIORITY_PREFETCH]    = "priority=prefetch",
+    [FXPO_PRIORITY_BACKGROUND]  = "priority=background",
+  };
+
+  for( char * param = query; param != NULL && *param != '\0'; ) {
+    char * const next = strchr( param, '&' );
+    if( next != NULL ) *next = '\0';
+
+    enum fxpo_priority p;
+    for( p = 0; p < FXPO_PRIORITY_COUNT && strcmp( param, priorities[p] ) != 0; p++ );
+
+    if( p < FXPO_PRIORITY_COUNT ) request->priority = p;
+    else if( !strcmp( param, "format=dds" ) ) *send_dds = true;
+    else if( !strcmp( param, "format=path" ) ) *send_dds = false;
+    else if( !strcmp( param, "rebuild=1" ) ) request->rebuild = true;
+    else if( !strcmp( param, "progressive=1" ) ) request->progressive = true;
+    else return false;
+
+    param = next != NULL ? next + 1 : NULL;
+  }
+
+  return true;
+}
+
+/* fxpo_daemon_queue_tile queues a tile request, e.g. /tiles/+57-006/63568_40144_BI17.dds?format=dds
+   Returns true if a worker answers the connection. */
+static bool
+fxpo_daemon_queue_tile( struct fxpo_daemon_t * const daemon,
+                        const fxpo_socket_t          sock,
+                        char *                       target ) {
+
+  struct fxpo_request_t request  = { .priority = FXPO_PRIORITY_INTERACTIVE, .done = fxpo_daemon_done, .preview = fxpo_daemon_preview };
+  bool                  send_dds = false;
+
+  char * query = strchr( target, '?' );
+  if( query != NULL ) *query++ = '\0';
+
+  char * const tileset  = target + strlen( "/tiles/" );
+  char * const dds_name = strchr( tileset, '/' );
+  if( dds_name == NULL || !fxpo_daemon_parse_query( query, &request, &send_dds ) ) {
+    fxpo_daemon_respond( sock, 400, "Bad Request", "invalid tile\n" );
+    return false;
+  }
+  *dds_name = '\0';
+
+  struct fxpo_daemon_request_t * const connection = fxpo_malloc( sizeof(struct fxpo_daemon_request_t) );
+  if( connection == NULL ) {
+    fxpo_daemon_respond( sock, 500, "Internal Server Error", "out of memory\n" );
+    return false;
+  }
+  *connection = (struct fxpo_daemon_request_t) { .daemon = daemon, .sock = sock, .send_dds = send_dds };
+
+  request.tileset  = tileset;
+  request.dds_name = dds_name + 1;
+  request.user     = connection;
+
+  const enum fxpo_status status = fxpo_context_build( daemon->ctx, &request, NULL );
+  if( status == FXPOS_OK ) return true;
+
+  fxpo_free( connection );
+
+  if( status == FXPOS_QUEUE_FULL ) fxpo_daemon_respond( sock, 503, "Service Unavailable", "too many requests\n" );
+  else if( status == FXPOS_INVALID_STATE ) fxpo_daemon_respond( sock, 400, "Bad Request", "invalid tile\n" );
+  else fxpo_daemon_respond( sock, 500, "Internal Server Error", "could not queue tile\n" );
+
+  return false;
+}
+
+/* fxpo_daemon_queue_tileset queues every texture of a tileset, e.g. /tilesets/+57-006?priority=prefetch */
+static void
+fxpo_daemon_queue_tileset( struct fxpo_daemon_t * const daemon,
+                           const fxpo_socket_t          sock,
+                           char *                       target ) {
+
+  struct fxpo_request_t request  = { .priority = FXPO_PRIORITY_BACKGROUND };
+  bool                  send_dds = false;
+
+  char * query = strchr( target, '?' );
+  if( query != NULL ) *query++ = '\0';
+
+  request.tileset = target + strlen( "/tilesets/" );
+
+  size_t                 tile_num = 0;
+  const enum fxpo_status status   = fxpo_daemon_parse_query( query, &request, &send_dds ) && !send_dds
+                                    ? fxpo_context_build_tileset( daemon->ctx, &request, &tile_num )
+                                    : FXPOS_INVALID_STATE;
+
+  if( status == FXPOS_OK ) {
+    char body[64];
+    snprintf( body, sizeof(body), "queued %zu tiles\n", tile_num );
+    fxpo_daemon_respond( sock, 202, "Accepted", body );
+  } else if( status == FXPOS_NOT_FOUND ) {
+    fxpo_daemon_respond( sock, 404, "Not Found", "no terrain files found\n" );
+  } else if( status == FXPOS_QUEUE_FULL ) {
+    fxpo_daemon_respond( sock, 503, "Service Unavailable", "too many requests\n" );
+  } else if( status == FXPOS_INVALID_STATE ) {
+    fxpo_daemon_respond( sock, 400, "Bad Request", "invalid tileset\n" );
+  } else {
+    fxpo_daemon_respond( sock, 500, "Internal Server Error", "could not queue tileset\n" );
+  }
+}
+
+/* fxpo_daemon_accept reads a request from a new connection and either answers it or queues it for a worker. */
+static void
+fxpo_daemon_accept( struct fxpo_daemon_t * const daemon,
+                    const fxpo_socket_t          sock ) {
+
+#ifdef _WIN32
+  const DWORD recv_timeout = DAEMON_RECV_TIMEOUT_MS;
+  const DWORD send_timeout = DAEMON_SEND_TIMEOUT_MS;
+#else
+  const struct timeval recv_timeout = { .tv_sec = DAEMON_RECV_TIMEOUT_MS / 1000, .tv_usec = (DAEMON_RECV_TIMEOUT_MS % 1000) * 1000 };
+  const struct timeval send_timeout = { .tv_sec = DAEMON_SEND_TIMEOUT_MS / 1000, .tv_usec = (DAEMON_SEND_TIMEOUT_MS % 1000) * 1000 };
+#endif
+  setsockopt( sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&recv_timeout, sizeof(recv_timeout) );
+  setsockopt( sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&send_timeout, sizeof(send_timeout) );
+
+  char request[DAEMON_MAX_REQUEST_SIZE];
+  if( !fxpo_daemon_read_request( sock, request, sizeof(request) ) ) {
+    fxpo_daemon_respond( sock, 400, "Bad Request", "malformed request\n" );
+    fxpo_socket_close( sock );
+    return;
+  }
+
+  /* Request line, e.g. GET /tiles/+57-006/63568_40144_BI17.dds HTTP/1.1 */
+  char * const method = request;
+  char * const target = strchr( method, ' ' );
+  if( target == NULL ) {
+    fxpo_daemon_respond( sock, 400, "Bad Request", "malformed request\n" );
+    fxpo_socket_close( sock );
+    return;
+  }
+  *target = '\0';
+  target[1 + strcspn( target + 1, " \r\n" )] = '\0';
+
+  FXPO_LOG_DEBUG( "daemon request method=%s target=%s", method, target + 1 );
+
+  if( !strcmp( method, "GET" ) && !strcmp( target + 1, "/health" ) ) {
+    fxpo_daemon_respond( sock, 200, "OK", "ok\n" );
+  } else if( !strcmp( method, "POST" ) && !strcmp( target + 1, "/shutdown" ) ) {
+    FXPO_LOG_INFO( "daemon shutdown requested" );
+    fxpo_atomic_store( &daemon->stopping, 1 );
+    fxpo_daemon_respond( sock, 200, "OK", "shutting down\n" );
+  } else if( !strcmp( method, "POST" ) && !strncmp( target + 1, "/tilesets/", strlen( "/tilesets/" ) ) ) {
+    fxpo_daemon_queue_tileset( daemon, sock, target + 1 );
+  } else if( !strcmp( method, "GET" ) && !strncmp( target + 1, "/tiles/", strlen( "/tiles/" ) ) ) {
+    /* The worker answers and closes the connection. */
+    if( fxpo_daemon_queue_tile( daemon, sock, target + 1 ) ) return;
+  } else {
+    fxpo_daemon_respond( sock, 404, "Not Found", "not found\n" );
+  }
+
+  fxpo_socket_close( sock );
+}
+
+static fxpo_socket_t
+fxpo_daemon_listen( const uint16_t port ) {
+
+  const fxpo_socket_t sock = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+  if( sock == FXPO_INVALID_SOCKET ) {
+    FXPO_LOG_ERROR( "fxpo_daemon_listen(): could not create socket" );
+    return FXPO_INVALID_SOCKET;
+  }
+
+  const int reuse = 1;
+  setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse) );
+
+  /* Only accept requests from this machine. */
+  struct sockaddr_in addr = { 0 };
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons( port );
+  addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+  if( bind( sock, (const struct sockaddr *)&addr, sizeof(addr) ) != 0 || listen( sock, SOMAXCONN ) != 0 ) {
+    FXPO_LOG_ERROR( "fxpo_daemon_listen(): could not listen on port=%u", port );
+    fxpo_socket_close( sock );
+    return FXPO_INVALID_SOCKET;
+  }
+
+  return sock;
+}
+
+enum fxpo_status
+fxpo_daemon_run( struct fxpo_context_t * const ctx,
+                 const uint16_t                port ) {
+
+#ifdef _WIN32
+  WSADATA wsa;
+  if( WSAStartup( MAKEWORD( 2, 2 ), &wsa ) != 0 ) {
+    FXPO_LOG_ERROR( "fxpo_daemon_run(): could not initialise Winsock" );
+    return FXPOS_INVALID_STATE;
+  }
+#endif
+
+  const fxpo_socket_t listen_sock = fxpo_daemon_listen( port );
+  if( listen_sock == FXPO_INVALID_SOCKET ) {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return FXPOS_INVALID_STATE;
+  }
+
+  struct fxpo_daemon_t daemon = { .ctx = ctx, .stopping = 0 };
+  fxpo_mutex_new( &daemon.lock );
+  fxpo_cond_new( &daemon.queued );
+
+  if( !fxpo_thread_start( &daemon.sender, fxpo_daemon_sender_main, &daemon ) ) {
+    FXPO_LOG_ERROR( "fxpo_daemon_run(): could not start sender thread" );
+    fxpo_cond_free( &daemon.queued );
+    fxpo_mutex_free( &daemon.lock );
+    fxpo_socket_close( listen_sock );
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return FXPOS_INVALID_STATE;
+  }
+
+  FXPO_LOG_INFO( "daemon listening on http://127.0.0.1:%u", port );
+
+  /* The calling thread accepts connections, the context's workers build tiles and answer them. */
+  while( !fxpo_atomic_load( &daemon.stopping ) && !fxpo_context_is_interrupted( ctx ) ) {
+    fd_set readable;
+    FD_ZERO( &readable );
+    FD_SET( listen_sock, &readable );
+
+    /* Wake up regularly to notice a shutdown. */
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = DAEMON_ACCEPT_TIMEOUT_MS * 1000 };
+    if( select( (int)listen_sock + 1, &readable, NULL, NULL, &timeout ) <= 0 ) continue;
+
+    const fxpo_socket_t sock = accept( listen_sock, NULL, NULL );
+    if( sock != FXPO_INVALID_SOCKET ) fxpo_daemon_accept( &daemon, sock );
+  }
+
+  /* Answer requests that were still waiting when the daemon stopped, then finish streaming textures. */
+  fxpo_context_cancel_all( ctx );
+  fxpo_context_wait( ctx );
+
+  fxpo_mutex_lock( &daemon.lock );
+  daemon.sender_stopping = true;
+  fxpo_cond_signal( &daemon.queued );
+  fxpo_mutex_unlock( &daemon.lock );
+
+  fxpo_thread_join( &daemon.sender );
+  fxpo_cond_free( &daemon.queued );
+  fxpo_mutex_free( &daemon.lock );
+
+  fxpo_socket_close( listen_sock );
+#ifdef _WIN32
+  WSACleanup();
+#endif
+
+  return FXPOS_OK;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef FXPO_DAEMON_H
+#define FXPO_DAEMON_H
+
+#include "fxpo_common.h"
+
+#define DAEMON_DEFAULT_PORT      8765
+/* Maximum number of requests of each priority waiting for a worker. Further requests are rejected with 503. */
+#define DAEMON_QUEUE_CAPACITY    4096
+/* Maximum size of a request line and headers. */
+#define DAEMON_MAX_REQUEST_SIZE  4096
+#define DAEMON_ACCEPT_TIMEOUT_MS 100
+#define DAEMON_RECV_TIMEOUT_MS   1000
+/* Longest a client may stall the sender thread streaming textures, see format=dds. */
+#define DAEMON_SEND_TIMEOUT_MS   5000
+/* Workers that only build interactive tiles, so that one is always free when the simulator needs a tile. */
+#define DAEMON_INTERACTIVE_WORKERS( workers ) ((workers) > 1 ? ((workers) / 8 > 1 ? (workers) / 8 : 1) : 0)
+
+/* fxpo_daemon_run serves tile build requests on localhost port until a shutdown request is received or
+   ctx is interrupted.
+   Requests are built by the workers of ctx, which keep their HTTP connections, buffers and the
+   compressor warm between requests and take the highest priority request waiting.
+
+   GET  /tiles/<tileset>/<dds_name>[?format=dds][&rebuild=1][&progressive=1][&priority=interactive|prefetch|background]
+        Builds the texture unless it exists and returns its path, or its contents with format=dds.
+        With progressive=1 the response is sent once a coarse texture is written, which the full
+        resolution texture replaces later. Defaults to interactive priority.
+   POST /tilesets/<tileset>[?rebuild=1][&progressive=1][&priority=interactive|prefetch|background]
+        Queues every texture of a tileset and returns without waiting. Defaults to background priority.
+   GET  /health
+   POST /shutdown */
+enum fxpo_status
+fxpo_daemon_run( struct fxpo_context_t * ctx,
+                 uint16_t                port );
+
+#endif
\ No newline at end of file
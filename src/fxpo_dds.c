@@ -0,0 +1,120 @@
+#include "fxpo_dds.h"
+#include "fxpo_log.h"
+
+#define DDS_MAGIC              0x20534444u
+#define DDS_HEADER_SIZE        124
+#define DDS_PIXELFORMAT_SIZE   32
+#define DDSD_CAPS              0x1u
+#define DDSD_HEIGHT            0x2u
+#define DDSD_WIDTH             0x4u
+#define DDSD_PIXELFORMAT       0x1000u
+#define DDSD_MIPMAPCOUNT       0x20000u
+#define DDSD_LINEARSIZE        0x80000u
+#define DDPF_FOURCC            0x4u
+#define DDSCAPS_COMPLEX        0x8u
+#define DDSCAPS_TEXTURE        0x1000u
+#define DDSCAPS_MIPMAP         0x400000u
+#define DDS_FOURCC_DXT1        0x31545844u
+
+/* fxpo_dds_writer_t writes a texture to a file or through a fxpo_texture_io_t. */
+struct fxpo_dds_writer_t {
+  const struct fxpo_texture_io_t * io;
+  void *                           handle;
+  FILE *                           file;
+};
+
+static bool
+fxpo_dds_write( const struct fxpo_dds_writer_t * const writer,
+                const void * const                     data,
+                const size_t                           len ) {
+
+  if( writer->io != NULL ) return writer->io->write( writer->handle, data, len, writer->io->user );
+  return fwrite( data, 1, len, writer->file ) == len;
+}
+
+/* fxpo_dds_block_bc1 encodes a block of a single colour. Both endpoints are the colour rounded to
+   RGB565 and every index selects the first endpoint. */
+static void
+fxpo_dds_block_bc1( const uint8_t * const colour,
+                    uint8_t * const       block ) {
+
+  const uint32_t b = ((uint32_t)colour[0] * 31 + 127) / 255;
+  const uint32_t g = ((uint32_t)colour[1] * 63 + 127) / 255;
+  const uint32_t r = ((uint32_t)colour[2] * 31 + 127) / 255;
+  const uint16_t endpoint = (uint16_t)(r << 11 | g << 5 | b);
+
+  block[0] = (uint8_t)(endpoint & 0xff);
+  block[1] = (uint8_t)(endpoint >> 8);
+  block[2] = block[0];
+  block[3] = block[1];
+  memset( &block[4], 0, 4 );
+}
+
+enum fxpo_status
+fxpo_dds_write_uniform( const uint32_t                         width,
+                        const uint8_t * const                  colour,
+                        const char * const                     path,
+                        const struct fxpo_texture_io_t * const io ) {
+
+  uint32_t mips = 1;
+  while( (width >> (mips - 1)) > 1 ) mips++;
+
+  const uint32_t blocks_per_side = (width + 3) / 4;
+
+  /* The magic followed by the little-endian header, see DDS_HEADER and DDS_PIXELFORMAT. */
+  uint32_t header[1 + DDS_HEADER_SIZE / 4] = { 0 };
+  header[0]  = DDS_MAGIC;
+  header[1]  = DDS_HEADER_SIZE;
+  header[2]  = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+  header[3]  = width;
+  header[4]  = width;
+  header[5]  = blocks_per_side * blocks_per_side * DDS_BC1_BLOCK_SIZE;
+  header[7]  = mips;
+  header[19] = DDS_PIXELFORMAT_SIZE;
+  header[20] = DDPF_FOURCC;
+  header[21] = DDS_FOURCC_DXT1;
+  header[27] = DDSCAPS_COMPLEX | DDSCAPS_TEXTURE | DDSCAPS_MIPMAP;
+
+  uint8_t blocks[DDS_WRITE_BLOCKS * DDS_BC1_BLOCK_SIZE];
+  fxpo_dds_block_bc1( colour, blocks );
+  for( size_t i = 1; i < DDS_WRITE_BLOCKS; i++ ) memcpy( &blocks[i * DDS_BC1_BLOCK_SIZE], blocks, DDS_BC1_BLOCK_SIZE );
+
+  struct fxpo_dds_writer_t writer = { .io = NULL };
+  if( io != NULL && io->open != NULL ) {
+    writer.io     = io;
+    writer.handle = io->open( path, io->user );
+  } else {
+    writer.file = fopen( path, "wb" );
+  }
+
+  if( writer.handle == NULL && writer.file == NULL ) {
+    FXPO_LOG_ERROR( "fxpo_dds_write_uniform(): failed to open texture=%s", path );
+    return FXPOS_INVALID_STATE;
+  }
+
+  bool ok = fxpo_dds_write( &writer, header, sizeof(header) );
+
+  for( uint32_t mip = 0; mip < mips && ok; mip++ ) {
+    const size_t mip_blocks_per_side = ((width >> mip) + 3) / 4;
+    size_t       remaining           = mip_blocks_per_side * mip_blocks_per_side;
+
+    while( remaining > 0 && ok ) {
+      const size_t n = remaining < DDS_WRITE_BLOCKS ? remaining : DDS_WRITE_BLOCKS;
+      ok         = fxpo_dds_write( &writer, blocks, n * DDS_BC1_BLOCK_SIZE );
+      remaining -= n;
+    }
+  }
+
+  if( writer.io != NULL ) {
+    writer.io->close( writer.handle, ok, writer.io->user );
+  } else if( fclose( writer.file ) != 0 ) {
+    ok = false;
+  }
+
+  if( !ok ) {
+    FXPO_LOG_ERROR( "fxpo_dds_write_uniform(): failed to write texture=%s", path );
+    return FXPOS_INVALID_STATE;
+  }
+
+  return FXPOS_OK;
+}
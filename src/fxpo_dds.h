@@ -0,0 +1,20 @@
+#ifndef FXPO_DDS_H
+#define FXPO_DDS_H
+
+#include "fxpo_common.h"
+
+/* BC1 stores each 4x4 block of pixels in 8 bytes. */
+#define DDS_BC1_BLOCK_SIZE 8
+/* Blocks written at once by fxpo_dds_write_uniform. */
+#define DDS_WRITE_BLOCKS   512
+
+/* fxpo_dds_write_uniform writes a width x width BC1 texture of a single BGRA colour with its full mip
+   chain, laid out like the textures compressed by NVTT. A flat colour stays the same in every mip, so
+   no pixels are encoded. The texture is written through io if io->open is set, otherwise to path. */
+enum fxpo_status
+fxpo_dds_write_uniform( uint32_t                         width,
+                        const uint8_t *                  colour,
+                        const char *                     path,
+                        const struct fxpo_texture_io_t * io );
+
+#endif
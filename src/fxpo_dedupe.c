@@ -0,0 +1,130 @@
+#include "fxpo_dedupe.h"
+#include "fxpo_alloc.h"
+
+void
+fxpo_dedupe_new( struct fxpo_dedupe_t * const dedupe ) {
+
+  memset( dedupe, 0, sizeof(struct fxpo_dedupe_t) );
+  fxpo_mutex_new( &dedupe->lock );
+}
+
+void
+fxpo_dedupe_free( struct fxpo_dedupe_t * const dedupe ) {
+
+  for( size_t i = 0; i < DEDUPE_CAPACITY; i++ ) {
+    fxpo_free( dedupe->entries[i].jpeg );
+    fxpo_free( dedupe->entries[i].pixels );
+  }
+  fxpo_mutex_free( &dedupe->lock );
+}
+
+uint64_t
+fxpo_dedupe_hash( const uint8_t * const jpeg,
+                  const size_t          jpeg_len ) {
+
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for( size_t i = 0; i < jpeg_len; i++ ) {
+    hash ^= jpeg[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+/* fxpo_dedupe_find returns the entry holding jpeg or DEDUPE_CAPACITY. Must hold the lock. */
+static size_t
+fxpo_dedupe_find( const struct fxpo_dedupe_t * const dedupe,
+                  const uint64_t                     hash,
+                  const uint8_t * const              jpeg,
+                  const size_t                       jpeg_len ) {
+
+  for( size_t i = 0; i < DEDUPE_CAPACITY; i++ ) {
+    const struct fxpo_dedupe_entry_t * const entry = &dedupe->entries[i];
+    if( entry->pixels != NULL && entry->hash == hash && entry->jpeg_len == jpeg_len && !memcmp( entry->jpeg, jpeg, jpeg_len ) ) return i;
+  }
+
+  return DEDUPE_CAPACITY;
+}
+
+const uint8_t *
+fxpo_dedupe_acquire( struct fxpo_dedupe_t * const dedupe,
+                     const uint64_t               hash,
+                     const uint8_t * const        jpeg,
+                     const size_t                 jpeg_len,
+                     size_t * const               entry ) {
+
+  const uint8_t * pixels = NULL;
+
+  fxpo_mutex_lock( &dedupe->lock );
+  *entry = fxpo_dedupe_find( dedupe, hash, jpeg, jpeg_len );
+
+  if( *entry < DEDUPE_CAPACITY ) {
+    dedupe->entries[*entry].refs++;
+    dedupe->entries[*entry].last_used = ++dedupe->clock;
+    pixels = dedupe->entries[*entry].pixels;
+  } else {
+    const size_t slot = (size_t)(hash % DEDUPE_SEEN_CAPACITY);
+    if( dedupe->seen[slot].hash != hash ) {
+      dedupe->seen[slot].hash  = hash;
+      dedupe->seen[slot].count = 0;
+    }
+    dedupe->seen[slot].count++;
+  }
+  fxpo_mutex_unlock( &dedupe->lock );
+
+  fxpo_atomic_add( pixels != NULL ? &dedupe->reused : &dedupe->decoded, 1 );
+
+  return pixels;
+}
+
+void
+fxpo_dedupe_release( struct fxpo_dedupe_t * const dedupe,
+                     const size_t                 entry ) {
+
+  fxpo_mutex_lock( &dedupe->lock );
+  dedupe->entries[entry].refs--;
+  fxpo_mutex_unlock( &dedupe->lock );
+}
+
+void
+fxpo_dedupe_offer( struct fxpo_dedupe_t * const dedupe,
+                   const uint64_t               hash,
+                   const uint8_t * const        jpeg,
+                   const size_t                 jpeg_len,
+                   const uint8_t * const        pixels ) {
+
+  fxpo_mutex_lock( &dedupe->lock );
+
+  const size_t slot = (size_t)(hash % DEDUPE_SEEN_CAPACITY);
+  if( dedupe->seen[slot].hash != hash || dedupe->seen[slot].count < 2 || fxpo_dedupe_find( dedupe, hash, jpeg, jpeg_len ) < DEDUPE_CAPACITY ) {
+    fxpo_mutex_unlock( &dedupe->lock );
+    return;
+  }
+
+  /* Replace the least recently used entry no worker is reading. */
+  struct fxpo_dedupe_entry_t * victim = NULL;
+  for( size_t i = 0; i < DEDUPE_CAPACITY; i++ ) {
+    struct fxpo_dedupe_entry_t * const entry = &dedupe->entries[i];
+    if( entry->refs == 0 && (victim == NULL || entry->last_used < victim->last_used) ) victim = entry;
+  }
+
+  /* Copied under the lock so that readers never see a partial image. Entries are rarely replaced. */
+  if( victim != NULL && victim->pixels == NULL ) victim->pixels = fxpo_malloc( DEDUPE_IMAGE_SIZE );
+  if( victim != NULL && victim->jpeg_capacity < jpeg_len ) {
+    uint8_t * const buf = fxpo_realloc( victim->jpeg, jpeg_len );
+    if( buf != NULL ) {
+      victim->jpeg          = buf;
+      victim->jpeg_capacity = jpeg_len;
+    }
+  }
+
+  if( victim != NULL && victim->pixels != NULL && victim->jpeg_capacity >= jpeg_len ) {
+    memcpy( victim->jpeg, jpeg, jpeg_len );
+    memcpy( victim->pixels, pixels, DEDUPE_IMAGE_SIZE );
+    victim->hash      = hash;
+    victim->jpeg_len  = jpeg_len;
+    victim->last_used = ++dedupe->clock;
+  }
+
+  fxpo_mutex_unlock( &dedupe->lock );
+}
@@ -0,0 +1,76 @@
+#ifndef FXPO_DEDUPE_H
+#define FXPO_DEDUPE_H
+
+#include "fxpo_common.h"
+#include "fxpo_thread.h"
+#include "fxpo_ortho.h"
+#include "fxpo_tile.h"
+
+/* Decoded chunks kept for reuse, each a CHUNK_SIZE x CHUNK_SIZE image laid out like the tile buffer. */
+#define DEDUPE_CAPACITY      64
+#define DEDUPE_IMAGE_SIZE    ((size_t)CHUNK_SIZE * CHUNK_SIZE * PIXEL_CHANNELS)
+/* Slots counting how often recent JPEGs were seen. Collisions only cost a decode. */
+#define DEDUPE_SEEN_CAPACITY 4096
+
+/* fxpo_dedupe_entry_t is a decoded chunk and the JPEG it was decoded from. */
+struct fxpo_dedupe_entry_t {
+  uint64_t  hash;
+  uint8_t * jpeg;
+  size_t    jpeg_len;
+  size_t    jpeg_capacity;
+  uint8_t * pixels;
+  /* Workers reading pixels. Only unreferenced entries are replaced. */
+  int64_t   refs;
+  uint64_t  last_used;
+};
+
+/* fxpo_dedupe_t maps byte-identical chunk JPEGs, e.g. open ocean or a provider's missing-imagery
+   placeholder, to a single decoded image shared by every tile using them. Only JPEGs seen more
+   than once are kept, so unique chunks cost a hash and nothing else. */
+struct fxpo_dedupe_t {
+  struct fxpo_dedupe_entry_t entries[DEDUPE_CAPACITY];
+  struct {
+    uint64_t hash;
+    uint32_t count;
+  } seen[DEDUPE_SEEN_CAPACITY];
+  uint64_t            clock;
+  struct fxpo_mutex_t lock;
+
+  /* Chunks decoded and chunks served from a previous decode. */
+  volatile int64_t decoded;
+  volatile int64_t reused;
+};
+
+void
+fxpo_dedupe_new( struct fxpo_dedupe_t * dedupe );
+
+void
+fxpo_dedupe_free( struct fxpo_dedupe_t * dedupe );
+
+/* fxpo_dedupe_hash returns the FNV-1a hash of a JPEG. */
+uint64_t
+fxpo_dedupe_hash( const uint8_t * jpeg,
+                  size_t          jpeg_len );
+
+/* fxpo_dedupe_acquire returns the decoded image of jpeg if it is held, otherwise NULL after counting
+   jpeg as seen. A returned image stays valid until fxpo_dedupe_release is called with entry. */
+const uint8_t *
+fxpo_dedupe_acquire( struct fxpo_dedupe_t * dedupe,
+                     uint64_t               hash,
+                     const uint8_t *        jpeg,
+                     size_t                 jpeg_len,
+                     size_t *               entry );
+
+void
+fxpo_dedupe_release( struct fxpo_dedupe_t * dedupe,
+                     size_t                 entry );
+
+/* fxpo_dedupe_offer keeps a copy of the decoded image of jpeg if jpeg was seen before and an entry is free. */
+void
+fxpo_dedupe_offer( struct fxpo_dedupe_t * dedupe,
+                   uint64_t               hash,
+                   const uint8_t *        jpeg,
+                   size_t                 jpeg_len,
+                   const uint8_t *        pixels );
+
+#endif
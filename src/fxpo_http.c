@@ -2,58 +2,379 @@
 #include "fxpo_log.h"
 #include "fxpo_ortho.h"
 #include "fxpo_alloc.h"
+#include "fxpo_archive.h"
 
 #define HTTP_TIMEOUT_MS     1000
-#define INITIAL_BUFFER_SIZE 15000 /* Average chunk JPEG size is 11kb */
+/* Longest wait for transfers before checking whether the requests were cancelled. */
+#define HTTP_CANCEL_CHECK_MS 10
+/* Resolved provider hosts rarely change during a run. */
+#define HTTP_DNS_CACHE_TIMEOUT_S 600L
+/* Weight of the latest request in the moving averages of a host's performance. */
+#define HTTP_HOST_EWMA_WEIGHT    0.1
+/* Latency assumed of a host before its first request completes. */
+#define HTTP_HOST_INITIAL_LATENCY_S 0.1
 #define USER_AGENT_EDGE_118 "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36 Edg/118.0.2088.76"
 
-void
+/* DNS lookups and TLS sessions are shared by the handles of every thread, so that a host is resolved
+   and a full TLS handshake is made once rather than once per thread. */
+static CURLSH *           fxpo_curl_share;
+static struct fxpo_mutex_t fxpo_curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void
+fxpo_curl_share_lock( CURL * const           handle,
+                      const curl_lock_data   data,
+                      const curl_lock_access access,
+                      void * const           user ) {
+
+  (void)handle; (void)access; (void)user;
+  fxpo_mutex_lock( &fxpo_curl_share_locks[data] );
+}
+
+static void
+fxpo_curl_share_unlock( CURL * const         handle,
+                        const curl_lock_data data,
+                        void * const         user ) {
+
+  (void)handle; (void)user;
+  fxpo_mutex_unlock( &fxpo_curl_share_locks[data] );
+}
+
+/* libcurl allocates through fxpo_allocator so that an embedding application accounts for it. */
+static void *
+fxpo_curl_malloc( const size_t size ) {
+
+  return fxpo_allocator.malloc( size, fxpo_allocator.user );
+}
+
+static void
+fxpo_curl_free( void * const ptr ) {
+
+  fxpo_free( ptr );
+}
+
+static void *
+fxpo_curl_realloc( void * const ptr,
+                   const size_t size ) {
+
+  return fxpo_allocator.realloc( ptr, size, fxpo_allocator.user );
+}
+
+static char *
+fxpo_curl_strdup( const char * const str ) {
+
+  const size_t len = strlen( str ) + 1;
+  char * const dup = fxpo_curl_malloc( len );
+  if( dup != NULL ) memcpy( dup, str, len );
+  return dup;
+}
+
+static void *
+fxpo_curl_calloc( const size_t num,
+                  const size_t size ) {
+
+  void * const ptr = fxpo_curl_malloc( num * size );
+  if( ptr != NULL ) memset( ptr, 0, num * size );
+  return ptr;
+}
+
+enum fxpo_status
 fxpo_http_init() {
 
-  curl_global_init( CURL_GLOBAL_ALL );
+  if( curl_global_init_mem( CURL_GLOBAL_ALL, fxpo_curl_malloc, fxpo_curl_free, fxpo_curl_realloc, fxpo_curl_strdup, fxpo_curl_calloc ) != CURLE_OK ) {
+    FXPO_LOG_ERROR( "fxpo_http_init(): failed to initialise libcurl" );
+    return FXPOS_INVALID_STATE;
+  }
+
+  for( size_t i = 0; i < CURL_LOCK_DATA_LAST; i++ ) fxpo_mutex_new( &fxpo_curl_share_locks[i] );
+
+  /* Requests still work without sharing, only colder. */
+  if( (fxpo_curl_share = curl_share_init()) != NULL ) {
+    curl_share_setopt( fxpo_curl_share, CURLSHOPT_LOCKFUNC, fxpo_curl_share_lock );
+    curl_share_setopt( fxpo_curl_share, CURLSHOPT_UNLOCKFUNC, fxpo_curl_share_unlock );
+    curl_share_setopt( fxpo_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS );
+    curl_share_setopt( fxpo_curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION );
+  } else {
+    FXPO_LOG_WARN( "fxpo_http_init(): failed to create share handle" );
+  }
+
+  return FXPOS_OK;
 }
 
 void
 fxpo_http_clean() {
 
+  if( fxpo_curl_share != NULL ) curl_share_cleanup( fxpo_curl_share );
+  fxpo_curl_share = NULL;
+  for( size_t i = 0; i < CURL_LOCK_DATA_LAST; i++ ) fxpo_mutex_free( &fxpo_curl_share_locks[i] );
+
   curl_global_cleanup();
 }
 
-void
+enum fxpo_status
 fxpo_http_multi_context_new( struct fxpo_http_multi_context_t * const ctx,
                              const size_t                             num_handles,
                              const size_t                             max_open_conns ) {
 
-  ctx->multi_handle = curl_multi_init();
+  ctx->easy_handles_len = 0;
+  ctx->easy_handles     = fxpo_malloc( sizeof(CURL *) * num_handles );
+  ctx->idle_handles     = fxpo_malloc( sizeof(CURL *) * num_handles );
+  ctx->transfers        = fxpo_malloc( sizeof(struct fxpo_http_transfer_t) * num_handles );
+  ctx->multi_handle     = curl_multi_init();
+
+  if( ctx->easy_handles == NULL || ctx->idle_handles == NULL || ctx->transfers == NULL || ctx->multi_handle == NULL ) {
+    fxpo_http_multi_context_free( ctx );
+    return FXPOS_OUT_OF_MEMORY;
+  }
+
   curl_multi_setopt( ctx->multi_handle, CURLMOPT_MAXCONNECTS, max_open_conns );
 
-  ctx->easy_handles_len = num_handles;
-  ctx->easy_handles     = fxpo_malloc( sizeof(CURL *) * num_handles );
-  for( size_t i = 0; i < num_handles; i++ ) ctx->easy_handles[i] = curl_easy_init();
+  for( ; ctx->easy_handles_len < num_handles; ctx->easy_handles_len++ ) {
+    if( (ctx->easy_handles[ctx->easy_handles_len] = curl_easy_init()) == NULL ) {
+      fxpo_http_multi_context_free( ctx );
+      return FXPOS_OUT_OF_MEMORY;
+    }
+    ctx->transfers[ctx->easy_handles_len].active = false;
+  }
+
+  return FXPOS_OK;
 }
 
 void
 fxpo_http_multi_context_free( struct fxpo_http_multi_context_t * const ctx ) {
 
   for( size_t i = 0; i < ctx->easy_handles_len; i++ ) curl_easy_cleanup( ctx->easy_handles[i] );
-  free( ctx->easy_handles );
+  fxpo_free( ctx->easy_handles );
+  fxpo_free( ctx->idle_handles );
+  fxpo_free( ctx->transfers );
+  ctx->easy_handles     = NULL;
+  ctx->idle_handles     = NULL;
+  ctx->transfers        = NULL;
   ctx->easy_handles_len = 0;
 
-  curl_multi_cleanup( ctx->multi_handle );
+  if( ctx->multi_handle != NULL ) curl_multi_cleanup( ctx->multi_handle );
+  ctx->multi_handle = NULL;
+}
+
+/* fxpo_token_bucket_new creates a full bucket. A burst of 0 holds one second's worth of tokens, and the
+   bucket holds at least min_burst. */
+static void
+fxpo_token_bucket_new( struct fxpo_token_bucket_t * const bucket,
+                       const double                       rate,
+                       const double                       burst,
+                       const double                       min_burst,
+                       const double                       now ) {
+
+  bucket->rate   = rate;
+  bucket->burst  = fmax( burst > 0 ? burst : rate, min_burst );
+  bucket->tokens = bucket->burst;
+  bucket->last   = now;
+}
+
+/* fxpo_token_bucket_wait refills bucket and returns the seconds until it holds need tokens. */
+static double
+fxpo_token_bucket_wait( struct fxpo_token_bucket_t * const bucket,
+                        const double                       need,
+                        const double                       now ) {
+
+  if( bucket->rate <= 0 ) return 0;
+
+  bucket->tokens = fmin( bucket->burst, bucket->tokens + (now - bucket->last) * bucket->rate );
+  bucket->last   = now;
+
+  return bucket->tokens >= need ? 0 : (need - bucket->tokens) / bucket->rate;
+}
+
+void
+fxpo_http_rate_new( struct fxpo_http_rate_t * const              rate,
+                    const struct fxpo_http_rate_config_t * const total,
+                    const struct fxpo_http_rate_config_t * const host_limit,
+                    const char * const * const                   hosts,
+                    const size_t                                 hosts_len ) {
+
+  const double now = fxpo_time_s();
+
+  /* A request bucket must hold at least one request to ever admit one. */
+  fxpo_token_bucket_new( &rate->requests, total->requests_per_second, total->request_burst, 1.0, now );
+  fxpo_token_bucket_new( &rate->bytes, total->bytes_per_second, total->byte_burst, 0.0, now );
+
+  rate->hosts_len = hosts_len < HTTP_MAX_RATE_HOSTS ? hosts_len : HTTP_MAX_RATE_HOSTS;
+  for( size_t i = 0; i < rate->hosts_len; i++ ) {
+    rate->hosts[i].host = hosts[i];
+    fxpo_token_bucket_new( &rate->hosts[i].requests, host_limit->requests_per_second, host_limit->request_burst, 1.0, now );
+    fxpo_token_bucket_new( &rate->hosts[i].bytes, host_limit->bytes_per_second, host_limit->byte_burst, 0.0, now );
+    rate->hosts[i].latency   = HTTP_HOST_INITIAL_LATENCY_S;
+    rate->hosts[i].errors    = 0;
+    rate->hosts[i].in_flight = 0;
+  }
+
+  rate->random = 0x9E3779B97F4A7C15ull;
+
+  fxpo_mutex_new( &rate->lock );
 }
 
 void
+fxpo_http_rate_free( struct fxpo_http_rate_t * const rate ) {
+
+  fxpo_mutex_free( &rate->lock );
+}
+
+/* fxpo_http_url_host returns the host of url and its length in len. */
+static const char *
+fxpo_http_url_host( const char * url,
+                    size_t * const len ) {
+
+  const char * const scheme = strstr( url, "://" );
+  if( scheme != NULL ) url = scheme + 3;
+
+  *len = strcspn( url, ":/" );
+  return url;
+}
+
+/* fxpo_http_rate_host returns the index of the host of url in rate->hosts, or hosts_len if it has no limits of its own. */
+static size_t
+fxpo_http_rate_host( const struct fxpo_http_rate_t * const rate,
+                     const char * const                    url ) {
+
+  size_t             len;
+  const char * const host = fxpo_http_url_host( url, &len );
+
+  size_t i;
+  for( i = 0; i < rate->hosts_len; i++ ) {
+    if( strlen( rate->hosts[i].host ) == len && !strncmp( rate->hosts[i].host, host, len ) ) break;
+  }
+
+  return i;
+}
+
+/* fxpo_http_rate_host_wait returns the seconds until the limits of host allow a request. Requires rate->lock. */
+static double
+fxpo_http_rate_host_wait( struct fxpo_http_rate_t * const rate,
+                          const size_t                    host,
+                          const double                    now ) {
+
+  return fmax( fxpo_token_bucket_wait( &rate->hosts[host].requests, 1, now ), fxpo_token_bucket_wait( &rate->hosts[host].bytes, 0, now ) );
+}
+
+/* fxpo_http_rate_host_cost estimates how long a request sent to host now would take. A failure counts as
+   a timeout and requests in flight queue up on the host's connections. Requires rate->lock. */
+static double
+fxpo_http_rate_host_cost( const struct fxpo_http_rate_t * const rate,
+                          const size_t                          host ) {
+
+  const double latency = rate->hosts[host].latency + rate->hosts[host].errors * (HTTP_TIMEOUT_MS / 1000.0);
+  return latency * (double)(rate->hosts[host].in_flight + 1);
+}
+
+/* fxpo_http_rate_select picks the better of two random hosts, so that slow hosts get less traffic without
+   every thread piling onto the same fastest one. Hosts the limits admit a request to now are preferred.
+   Requires rate->lock. */
+static size_t
+fxpo_http_rate_select( struct fxpo_http_rate_t * const rate,
+                       const double                    now ) {
+
+  if( rate->hosts_len < 2 ) return 0;
+
+  /* splitmix64 */
+  uint64_t z = (rate->random += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  z ^= z >> 31;
+
+  const size_t a = (size_t)(z % rate->hosts_len);
+  const size_t b = (a + 1 + (size_t)((z >> 32) % (rate->hosts_len - 1))) % rate->hosts_len;
+
+  const bool a_ready = fxpo_http_rate_host_wait( rate, a, now ) == 0;
+  const bool b_ready = fxpo_http_rate_host_wait( rate, b, now ) == 0;
+  if( a_ready != b_ready ) return a_ready ? a : b;
+
+  return fxpo_http_rate_host_cost( rate, a ) <= fxpo_http_rate_host_cost( rate, b ) ? a : b;
+}
+
+/* fxpo_http_rate_admit takes a request for url from the limits of rate and returns 0, or the seconds until
+   the limits allow it. host is set to the host the request is sent to, chosen by fxpo_http_rate_select if
+   select is set and url's host is one of rate's. force admits the request regardless, e.g. a retry.
+   A request admitted is in flight until fxpo_http_rate_done. */
+static double
+fxpo_http_rate_admit( struct fxpo_http_rate_t * const rate,
+                      const char * const              url,
+                      const bool                      select,
+                      const bool                      force,
+                      size_t * const                  host ) {
+
+  *host = fxpo_http_rate_host( rate, url );
+
+  fxpo_mutex_lock( &rate->lock );
+  const double now = fxpo_time_s();
+
+  if( select && *host < rate->hosts_len ) *host = fxpo_http_rate_select( rate, now );
+
+  double wait = fmax( fxpo_token_bucket_wait( &rate->requests, 1, now ), fxpo_token_bucket_wait( &rate->bytes, 0, now ) );
+  if( *host < rate->hosts_len ) wait = fmax( wait, fxpo_http_rate_host_wait( rate, *host, now ) );
+
+  if( wait == 0 || force ) {
+    rate->requests.tokens -= 1;
+    if( *host < rate->hosts_len ) {
+      rate->hosts[*host].requests.tokens -= 1;
+      rate->hosts[*host].in_flight++;
+    }
+  }
+  fxpo_mutex_unlock( &rate->lock );
+
+  return wait;
+}
+
+/* fxpo_http_rate_done charges the bytes of a completed response to the limits of rate and updates the
+   performance of its host. */
+static void
+fxpo_http_rate_done( struct fxpo_http_rate_t * const rate,
+                     const size_t                    host,
+                     const double                    seconds,
+                     const double                    bytes,
+                     const bool                      failed ) {
+
+  fxpo_mutex_lock( &rate->lock );
+  rate->bytes.tokens -= bytes;
+  if( host < rate->hosts_len ) {
+    rate->hosts[host].bytes.tokens -= bytes;
+    rate->hosts[host].in_flight--;
+    /* Failures say little about how fast the host answers, only how often it fails. */
+    if( !failed ) rate->hosts[host].latency += HTTP_HOST_EWMA_WEIGHT * (seconds - rate->hosts[host].latency);
+    rate->hosts[host].errors += HTTP_HOST_EWMA_WEIGHT * ((failed ? 1.0 : 0.0) - rate->hosts[host].errors);
+  }
+  fxpo_mutex_unlock( &rate->lock );
+}
+
+/* fxpo_http_rate_abandon ends a request to host cut short by another request failing. */
+static void
+fxpo_http_rate_abandon( struct fxpo_http_rate_t * const rate,
+                        const size_t                    host ) {
+
+  if( host >= rate->hosts_len ) return;
+
+  fxpo_mutex_lock( &rate->lock );
+  rate->hosts[host].in_flight--;
+  fxpo_mutex_unlock( &rate->lock );
+}
+
+enum fxpo_status
 fxpo_http_data_new( struct fxpo_http_data_t * const data ) {
 
-  data->buf     = fxpo_malloc( INITIAL_BUFFER_SIZE );
-  data->buf_len = INITIAL_BUFFER_SIZE;
+  data->buf     = fxpo_malloc( HTTP_INITIAL_BUFFER_SIZE );
+  data->buf_len = data->buf != NULL ? HTTP_INITIAL_BUFFER_SIZE : 0;
   data->size    = 0;
+  data->failed  = false;
+  data->hash    = 0;
+  data->owned   = NULL;
+
+  return data->buf != NULL ? FXPOS_OK : FXPOS_OUT_OF_MEMORY;
 }
 
 void
 fxpo_http_data_free( struct fxpo_http_data_t * const data ) {
 
-  free( data->buf );
+  fxpo_http_data_reset( data );
+  fxpo_free( data->buf );
+  data->buf     = NULL;
   data->buf_len = 0;
   data->size    = 0;
 }
@@ -61,8 +382,35 @@ fxpo_http_data_free( struct fxpo_http_data_t * const data ) {
 void
 fxpo_http_data_reset( struct fxpo_http_data_t * const data ) {
 
+  if( data->owned != NULL ) {
+    data->buf     = data->owned;
+    data->buf_len = data->owned_len;
+    data->owned   = NULL;
+  }
+
   /* No need to set the buffer contents to 0, we'll overwrite it anyway. */
-  data->size = 0;
+  data->size   = 0;
+  data->failed = false;
+  data->hash   = 0;
+}
+
+void
+fxpo_http_data_borrow( struct fxpo_http_data_t * const data,
+                       const uint8_t * const           buf,
+                       const size_t                    size,
+                       const uint64_t                  hash ) {
+
+  if( data->owned == NULL ) {
+    data->owned     = data->buf;
+    data->owned_len = data->buf_len;
+  }
+
+  /* Nothing writes to a response with data before it is reset. */
+  data->buf     = (uint8_t *)buf;
+  data->buf_len = size;
+  data->size    = size;
+  data->failed  = false;
+  data->hash    = hash;
 }
 
 static size_t
@@ -77,7 +425,11 @@ fxpo_write_callback( char * chunk,
   size_t req_len = data->size + rsize + 1;
 
   if( data->buf_len < req_len ) {
-    data->buf     = fxpo_realloc( data->buf, req_len );
+    uint8_t * const buf = fxpo_realloc( data->buf, req_len );
+    /* Returning less than rsize fails the transfer with CURLE_WRITE_ERROR. */
+    if( buf == NULL ) return 0;
+
+    data->buf     = buf;
     data->buf_len = req_len;
   }
 
@@ -88,22 +440,124 @@ fxpo_write_callback( char * chunk,
   return rsize;
 }
 
+/* fxpo_http_setup_handle sets the options common to every request. */
 static void
-fxpo_http_add_request( CURLM * const                   multi_handle,
-                       CURL * const                    curl,
-                       const char *                    url,
-                       struct fxpo_http_data_t * const res,
-                       const bool                      is_head ) {
+fxpo_http_setup_handle( CURL * const curl ) {
+
+  curl_easy_setopt( curl, CURLOPT_USERAGENT, USER_AGENT_EDGE_118 );
+  curl_easy_setopt( curl, CURLOPT_ACCEPT_ENCODING, "" );   /* Enable all supported encodings. */
+  curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, fxpo_write_callback );
+  curl_easy_setopt( curl, CURLOPT_DNS_CACHE_TIMEOUT, HTTP_DNS_CACHE_TIMEOUT_S );
+  if( fxpo_curl_share != NULL ) curl_easy_setopt( curl, CURLOPT_SHARE, fxpo_curl_share );
+}
+
+/* fxpo_http_xferinfo_callback aborts a transfer as soon as its requests are cancelled, also in the middle of
+   receiving a response. */
+static int
+fxpo_http_xferinfo_callback( void * const     user,
+                             const curl_off_t dltotal,
+                             const curl_off_t dlnow,
+                             const curl_off_t ultotal,
+                             const curl_off_t ulnow ) {
+
+  (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+  return fxpo_atomic_load( (volatile int64_t *)user ) != 0;
+}
+
+/* fxpo_http_add_request starts the request of transfer on curl. If rate is set, the request is sent to
+   the host transfer was admitted to. */
+static void
+fxpo_http_add_request( CURLM * const                       multi_handle,
+                       CURL * const                        curl,
+                       const struct fxpo_http_rate_t *     rate,
+                       struct fxpo_http_transfer_t * const transfer,
+                       const char *                        url,
+                       struct fxpo_http_data_t * const     res,
+                       const bool                          is_head ) {
+
+  char bound_url[MAX_URL_LENGTH];
+  if( rate != NULL && transfer->host < rate->hosts_len ) {
+    size_t             host_len;
+    const char * const host = fxpo_http_url_host( url, &host_len );
+
+    /* Keeps the host of the URL if the other one does not fit. */
+    const int len = snprintf( bound_url, sizeof(bound_url), "%.*s%s%s", (int)(host - url), url, rate->hosts[transfer->host].host, host + host_len );
+    if( len > 0 && (size_t)len < sizeof(bound_url) ) url = bound_url;
+  }
 
   curl_easy_setopt( curl, CURLOPT_URL, url );
   if( is_head ) curl_easy_setopt( curl, CURLOPT_HEADERDATA, res );
   else curl_easy_setopt( curl, CURLOPT_WRITEDATA, res );
 
+  transfer->active = true;
   curl_multi_add_handle( multi_handle, curl );
 }
 
+/* fxpo_http_abandon stops every transfer of ctx still in flight. */
+static void
+fxpo_http_abandon( const struct fxpo_http_multi_context_t * const ctx,
+                   const struct fxpo_http_policy_t * const        policy ) {
+
+  for( size_t j = 0; j < ctx->easy_handles_len; j++ ) {
+    struct fxpo_http_transfer_t * const transfer = &ctx->transfers[j];
+    if( !transfer->active ) continue;
+
+    curl_multi_remove_handle( ctx->multi_handle, ctx->easy_handles[j] );
+    if( policy->rate != NULL ) fxpo_http_rate_abandon( policy->rate, transfer->host );
+    transfer->active = false;
+  }
+}
+
+/* fxpo_http_replay serves the requests of fxpo_http_get_multi from policy->archive. Responses arrive
+   together once the recorded latencies would have elapsed on handles_len handles. */
+static enum fxpo_status
+fxpo_http_replay( const struct fxpo_http_policy_t * const policy,
+                  const char                              urls[][MAX_URL_LENGTH],
+                  const size_t                            url_len,
+                  struct fxpo_http_data_t * const         res,
+                  const bool                              is_head,
+                  const size_t                            handles_len ) {
+
+  double total   = 0.0;
+  double longest = 0.0;
+
+  for( size_t i = 0; i < url_len; i++ ) {
+    if( res[i].size > 0 || res[i].failed ) continue;
+
+    double                 seconds = 0.0;
+    const enum fxpo_status status  = fxpo_archive_get( policy->archive, urls[i], is_head, &res[i], &seconds );
+    if( status == FXPOS_NOT_FOUND && policy->tolerate_failures ) {
+      FXPO_LOG_WARN( "fxpo_http_replay(): no response recorded for url=%s", urls[i] );
+      res[i].failed = true;
+    } else if( status == FXPOS_NOT_FOUND ) {
+      FXPO_LOG_ERROR( "fxpo_http_replay(): no response recorded for url=%s", urls[i] );
+      return status;
+    } else if( status != FXPOS_OK ) {
+      return status;
+    } else if( res[i].failed && !policy->tolerate_failures ) {
+      FXPO_LOG_ERROR( "fxpo_http_replay(): recorded request failed for url=%s", urls[i] );
+      return FXPOS_INVALID_STATE;
+    }
+
+    total += seconds;
+    if( seconds > longest ) longest = seconds;
+  }
+
+  /* The slowest response, or the handles kept busy by all of them, whichever takes longer. */
+  const double wait     = policy->archive->latency_scale * (total / (double)handles_len > longest ? total / (double)handles_len : longest);
+  const double deadline = fxpo_time_s() + wait;
+  for( double now = fxpo_time_s(); now < deadline; now = fxpo_time_s() ) {
+    if( policy->cancelled != NULL && fxpo_atomic_load( policy->cancelled ) ) return FXPOS_CANCELLED;
+    const double left = (deadline - now) * 1000.0;
+    fxpo_sleep_ms( left < HTTP_CANCEL_CHECK_MS ? (uint32_t)left + 1 : HTTP_CANCEL_CHECK_MS );
+  }
+
+  return policy->cancelled != NULL && fxpo_atomic_load( policy->cancelled ) ? FXPOS_CANCELLED : FXPOS_OK;
+}
+
 enum fxpo_status
 fxpo_http_get_multi( const struct fxpo_http_multi_context_t * const ctx,
+                     const struct fxpo_http_policy_t * const        policy,
                      const char                                     urls[][MAX_URL_LENGTH],
                      const size_t                                   url_len,
                      struct fxpo_http_data_t * const                res,
@@ -111,7 +565,8 @@ fxpo_http_get_multi( const struct fxpo_http_multi_context_t * const ctx,
 
   CURLM * const multi_handle = ctx->multi_handle;
   CURL ** const curls        = ctx->easy_handles;
-  size_t i, j;
+  CURL ** const idle         = ctx->idle_handles;
+  size_t i = 0;
   size_t completed = 0;
 
   if( curls == NULL || multi_handle == NULL ) {
@@ -119,28 +574,30 @@ fxpo_http_get_multi( const struct fxpo_http_multi_context_t * const ctx,
     return FXPOS_NULL_POINTER;
   }
 
-  /* Add initial requests.
-     `i` tracks position in `urls` and `res`, `j` tracks position in the CURL handle array. */
-  for( i = 0, j = 0; j < ctx->easy_handles_len && i < url_len; i++ ) {
-    /* Mark request as completed if there's already response data. */
-    if( res[i].size > 0 ) {
-      completed++;
-      continue;
-    }
+  size_t handles_len = ctx->easy_handles_len;
+  if( policy->max_concurrent > 0 && policy->max_concurrent < handles_len ) handles_len = policy->max_concurrent;
 
-    /* Re-use handles. */
+  if( policy->archive != NULL && policy->archive->replay ) return fxpo_http_replay( policy, urls, url_len, res, is_head, handles_len );
+
+  /* Re-use handles. */
+  size_t idle_len = 0;
+  for( size_t j = 0; j < handles_len && j < url_len; j++ ) {
     curl_easy_reset( curls[j] );
 
     if( is_head ) curl_easy_setopt( curls[j], CURLOPT_NOBODY, 1L );
-    curl_easy_setopt( curls[j], CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1 );
-    curl_easy_setopt( curls[j], CURLOPT_USERAGENT, USER_AGENT_EDGE_118 );
-    curl_easy_setopt( curls[j], CURLOPT_ACCEPT_ENCODING, "" );   /* Enable all supported encodings. */
-    curl_easy_setopt( curls[j], CURLOPT_WRITEFUNCTION, fxpo_write_callback );
+    curl_easy_setopt( curls[j], CURLOPT_HTTP_VERSION, policy->http_version );
+    fxpo_http_setup_handle( curls[j] );
+    curl_easy_setopt( curls[j], CURLOPT_PRIVATE, (void *)&ctx->transfers[j] );
+    if( policy->cancelled != NULL ) {
+      curl_easy_setopt( curls[j], CURLOPT_XFERINFOFUNCTION, fxpo_http_xferinfo_callback );
+      curl_easy_setopt( curls[j], CURLOPT_XFERINFODATA, (void *)policy->cancelled );
+      curl_easy_setopt( curls[j], CURLOPT_NOPROGRESS, 0L );
+    }
 
     /* Uncomment to enable libcurl verbose logging. */
-    /* curl_easy_setopt( curls[i], CURLOPT_VERBOSE, 1L ); */
+    /* curl_easy_setopt( curls[j], CURLOPT_VERBOSE, 1L ); */
 
-    fxpo_http_add_request( multi_handle, curls[j++], urls[i], &res[i], is_head );
+    idle[idle_len++] = curls[j];
   }
 
   int32_t running_handles = 0;
@@ -148,44 +605,107 @@ fxpo_http_get_multi( const struct fxpo_http_multi_context_t * const ctx,
   const CURLMsg * msg;
   CURLMcode code;
 
-  do {
+  while( true ) {
+    if( policy->cancelled != NULL && fxpo_atomic_load( policy->cancelled ) ) {
+      fxpo_http_abandon( ctx, policy );
+      return FXPOS_CANCELLED;
+    }
+
+    /* Start requests on idle handles as far as the rate limits allow.
+       `i` tracks position in `urls` and `res`. Requests with response data are already complete. */
+    double wait = 0;
+    while( idle_len > 0 ) {
+      for( ; i < url_len && (res[i].size > 0 || res[i].failed); i++, completed++ );
+      if( i == url_len ) break;
+
+      CURL * const                  curl     = idle[idle_len - 1];
+      struct fxpo_http_transfer_t * transfer = NULL;
+      curl_easy_getinfo( curl, CURLINFO_PRIVATE, (void **)&transfer );
+
+      transfer->request = i;
+      transfer->host    = 0;
+      if( policy->rate != NULL && (wait = fxpo_http_rate_admit( policy->rate, urls[i], policy->select_host, false, &transfer->host )) > 0 ) break;
+
+      idle_len--;
+      fxpo_http_add_request( multi_handle, curl, policy->rate, transfer, urls[i], &res[i], is_head );
+      i++;
+    }
+
+    if( completed == url_len ) break;
+
     code = curl_multi_perform( multi_handle, &running_handles );
-    if( code == CURLM_OK && running_handles > 0 ) {
-      code = curl_multi_poll( multi_handle, NULL, 0, HTTP_TIMEOUT_MS, NULL );
+    if( code == CURLM_OK && (running_handles > 0 || wait > 0) ) {
+      /* Wake up when the rate limits allow the next request, or regularly to notice a cancellation. */
+      const int max_ms     = policy->cancelled != NULL ? HTTP_CANCEL_CHECK_MS : HTTP_TIMEOUT_MS;
+      const int timeout_ms = wait > 0 && wait * 1000.0 < max_ms ? (int)(wait * 1000.0) + 1 : max_ms;
+      code = curl_multi_poll( multi_handle, NULL, 0, timeout_ms, NULL );
     }
 
     if( code != CURLM_OK ) {
       FXPO_LOG_ERROR( "fxpo_http_get_multi(): curl multi operation failed (%d): %s", code, curl_multi_strerror( code ) );
+      fxpo_http_abandon( ctx, policy );
       return FXPOS_INVALID_STATE;
     }
 
     do {
       msg = curl_multi_info_read( multi_handle, &msgs_in_queue );
       if( msg && msg->msg == CURLMSG_DONE ) {
-        curl_multi_remove_handle( multi_handle, msg->easy_handle );
+        CURL * const                  curl     = msg->easy_handle;
+        const CURLcode                result   = msg->data.result;
+        struct fxpo_http_transfer_t * transfer = NULL;
+        curl_easy_getinfo( curl, CURLINFO_PRIVATE, (void **)&transfer );
+
+        curl_multi_remove_handle( multi_handle, curl );
+        transfer->active = false;
+
+        curl_off_t total_us = 0;
+        curl_easy_getinfo( curl, CURLINFO_TOTAL_TIME_T, &total_us );
+
+        if( policy->rate != NULL ) {
+          /* Servers answer errors and throttling with a status code rather than a failed transfer. */
+          long       status      = 0;
+          curl_off_t body_size   = 0;
+          long       header_size = 0;
+          curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &status );
+          curl_easy_getinfo( curl, CURLINFO_SIZE_DOWNLOAD_T, &body_size );
+          curl_easy_getinfo( curl, CURLINFO_HEADER_SIZE, &header_size );
+          /* A cancelled request says nothing about the host. */
+          const bool failed = (result != CURLE_OK && result != CURLE_ABORTED_BY_CALLBACK) || status >= 500 || status == 429;
+          fxpo_http_rate_done( policy->rate, transfer->host, (double)total_us / 1e6, (double)body_size + (double)header_size, failed );
+        }
 
-        if( msg->data.result == CURLE_OPERATION_TIMEDOUT ) {
+        if( result == CURLE_ABORTED_BY_CALLBACK ) {
+          fxpo_http_abandon( ctx, policy );
+          return FXPOS_CANCELLED;
+        } else if( result == CURLE_OPERATION_TIMEDOUT ) {
           FXPO_LOG_WARN( "fxpo_http_get_multi(): curl operation timed out, retrying" );
 
-          /* Retry indefinitely. TODO a more robust retry logic. */
-          curl_multi_add_handle( multi_handle, msg->easy_handle );
-        } else if( msg->data.result != CURLE_OK ) {
-          FXPO_LOG_ERROR( "fxpo_http_get_multi(): curl operation failed (%d): %s", msg->data.result, curl_easy_strerror( msg->data.result ) );
+          /* Retry indefinitely, on the host then performing best. TODO a more robust retry logic. */
+          fxpo_http_data_reset( &res[transfer->request] );
+          if( policy->rate != NULL ) fxpo_http_rate_admit( policy->rate, urls[transfer->request], policy->select_host, true, &transfer->host );
+          fxpo_http_add_request( multi_handle, curl, policy->rate, transfer, urls[transfer->request], &res[transfer->request], is_head );
+        } else if( result != CURLE_OK && policy->tolerate_failures ) {
+          FXPO_LOG_WARN( "fxpo_http_get_multi(): curl operation failed (%d): %s", result, curl_easy_strerror( result ) );
+
+          fxpo_http_data_reset( &res[transfer->request] );
+          res[transfer->request].failed = true;
+          if( policy->archive != NULL ) fxpo_archive_put( policy->archive, urls[transfer->request], is_head, &res[transfer->request], (double)total_us / 1e6 );
+          completed++;
+          idle[idle_len++] = curl;
+        } else if( result != CURLE_OK ) {
+          FXPO_LOG_ERROR( "fxpo_http_get_multi(): curl operation failed (%d): %s", result, curl_easy_strerror( result ) );
+          fxpo_http_abandon( ctx, policy );
           return FXPOS_INVALID_STATE;
         } else {
+          if( policy->archive != NULL ) fxpo_archive_put( policy->archive, urls[transfer->request], is_head, &res[transfer->request], (double)total_us / 1e6 );
           completed++;
 
-          /* Find the next request that needs to be made. */
-          for( ; res[i].size > 0 && i < url_len; i++, completed++ );
-          /* If there are more requests left, re-use the just completed handle for it. */
-          if( i < url_len ) {
-            fxpo_http_add_request( multi_handle, msg->easy_handle, urls[i], &res[i], is_head );
-            i++;
-          }
+          /* The handle takes the next request that needs to be made. */
+          idle[idle_len++] = curl;
         }
       }
     } while( msg );
-  } while( completed < url_len );
+  }
 
   return FXPOS_OK;
 }
@@ -199,9 +719,7 @@ fxpo_http_get( const char *                    url,
   if( curl == NULL ) return FXPOS_NULL_POINTER;
 
   curl_easy_setopt( curl, CURLOPT_URL, url );
-  curl_easy_setopt( curl, CURLOPT_USERAGENT, USER_AGENT_EDGE_118 );
-  curl_easy_setopt( curl, CURLOPT_ACCEPT_ENCODING, "" );
-  curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, fxpo_write_callback );
+  fxpo_http_setup_handle( curl );
   curl_easy_setopt( curl, CURLOPT_WRITEDATA, res );
 
   const CURLcode ret = curl_easy_perform( curl );
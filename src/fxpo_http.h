@@ -3,13 +3,96 @@
 
 #include <curl/curl.h>
 #include "fxpo_common.h"
+#include "fxpo_thread.h"
 
 #define MAX_URL_LENGTH 255
 
+#define HTTP_INITIAL_BUFFER_SIZE 15000 /* Average chunk JPEG size is 11kb */
+/* Hosts with limits of their own in a fxpo_http_rate_t. */
+#define HTTP_MAX_RATE_HOSTS      8
+
+struct fxpo_archive_t;
+
+/* fxpo_http_transfer_t is the request an easy handle of a multi context is making. */
+struct fxpo_http_transfer_t {
+  /* Index of the request in the urls passed to fxpo_http_get_multi. */
+  size_t request;
+  /* Index of the host the request was sent to in the fxpo_http_rate_t, or its hosts_len. */
+  size_t host;
+  bool   active;
+};
+
 struct fxpo_http_multi_context_t {
   CURLM * multi_handle;
   CURL ** easy_handles;
   size_t  easy_handles_len;
+  /* Handles waiting for a request, used by fxpo_http_get_multi. */
+  CURL ** idle_handles;
+  /* Transfer of each easy handle, also its CURLOPT_PRIVATE. */
+  struct fxpo_http_transfer_t * transfers;
+};
+
+/* fxpo_http_rate_config_t limits the rate of requests and received bytes. 0 means unlimited. */
+struct fxpo_http_rate_config_t {
+  double requests_per_second;
+  /* Requests that may be sent at once after an idle period. 0 for one second's worth. */
+  double request_burst;
+  double bytes_per_second;
+  /* Bytes that may be received at once after an idle period. 0 for one second's worth. */
+  double byte_burst;
+};
+
+/* fxpo_token_bucket_t refills at rate tokens per second up to burst. Byte buckets go negative as
+   responses arrive and admit no request until they are paid back. */
+struct fxpo_token_bucket_t {
+  double rate;
+  double burst;
+  double tokens;
+  double last;
+};
+
+/* fxpo_http_rate_t limits requests to a server as a whole and to each of its hosts. It is shared by
+   every thread, so that the server sees a steady rate just under its throttling threshold rather than
+   bursts from each thread followed by penalties. It also tracks how each host performs, so that
+   requests can be sent to the hosts answering fastest. */
+struct fxpo_http_rate_t {
+  struct fxpo_token_bucket_t requests;
+  struct fxpo_token_bucket_t bytes;
+
+  struct {
+    const char *               host;
+    struct fxpo_token_bucket_t requests;
+    struct fxpo_token_bucket_t bytes;
+    /* Moving averages of the seconds a request takes and of the share of requests failing. */
+    double                     latency;
+    double                     errors;
+    size_t                     in_flight;
+  } hosts[HTTP_MAX_RATE_HOSTS];
+  size_t hosts_len;
+
+  /* State of the generator picking the hosts compared for each request. */
+  uint64_t random;
+
+  struct fxpo_mutex_t lock;
+};
+
+/* fxpo_http_policy_t controls how fxpo_http_get_multi talks to a server. */
+struct fxpo_http_policy_t {
+  /* Maximum number of requests in flight, 0 to use every handle of the multi context. */
+  size_t max_concurrent;
+  /* CURL_HTTP_VERSION_* to negotiate. */
+  long   http_version;
+  /* Rate limits shared with other threads. NULL if unlimited. */
+  struct fxpo_http_rate_t * rate;
+  /* Send each request to the better of two hosts of rate rather than the host in its URL. */
+  bool                      select_host;
+  /* Mark failed requests in their fxpo_http_data_t and complete the others rather than failing them all. */
+  bool                      tolerate_failures;
+  /* Drops every request in flight and fails with FXPOS_CANCELLED once set to non-zero. May be NULL. */
+  volatile int64_t *        cancelled;
+  /* Records every response in the archive or, if it is a replay, serves the requests from it without
+     the network. NULL for neither. */
+  struct fxpo_archive_t *   archive;
 };
 
 struct fxpo_http_data_t {
@@ -19,17 +102,24 @@ struct fxpo_http_data_t {
   size_t buf_len;
   /* Size of useful data in buf. */
   size_t size;
+  /* The request failed, see fxpo_http_policy_t.tolerate_failures. */
+  bool   failed;
+  /* fxpo_dedupe_hash of the response if it was stored with it, 0 otherwise. */
+  uint64_t hash;
+  /* Buffer of the data while buf borrows a response, see fxpo_http_data_borrow. NULL otherwise. */
+  uint8_t * owned;
+  size_t    owned_len;
 };
 
 /* fxpo_http_init initialises the context required to make HTTP requests. */
-void
+enum fxpo_status
 fxpo_http_init();
 
 /* fxpo_http_clean cleans up the HTTP request context. */
 void
 fxpo_http_clean();
 
-void
+enum fxpo_status
 fxpo_http_multi_context_new( struct fxpo_http_multi_context_t * ctx,
                              size_t                             num_handles,
                              size_t                             max_open_conns );
@@ -37,18 +127,40 @@ fxpo_http_multi_context_new( struct fxpo_http_multi_context_t * ctx,
 void
 fxpo_http_multi_context_free( struct fxpo_http_multi_context_t * ctx );
 
+/* fxpo_http_rate_new initialises the limits of a server. total applies to every request, host_limit
+   separately to each of hosts. */
+void
+fxpo_http_rate_new( struct fxpo_http_rate_t *              rate,
+                    const struct fxpo_http_rate_config_t * total,
+                    const struct fxpo_http_rate_config_t * host_limit,
+                    const char * const *                   hosts,
+                    size_t                                 hosts_len );
+
+void
+fxpo_http_rate_free( struct fxpo_http_rate_t * rate );
+
 /* fxpo_http_data_new allocates the data structure required to store the result of HTTP requests.
    This can be reused across multiple HTTP requests. */
-void
+enum fxpo_status
 fxpo_http_data_new( struct fxpo_http_data_t * data );
 
 /* fxpo_http_data_free releases memory associated with the result of an HTTP request. */
 void
 fxpo_http_data_free( struct fxpo_http_data_t * data );
 
+/* fxpo_http_data_reset empties data, returning a borrowed response. */
 void
 fxpo_http_data_reset( struct fxpo_http_data_t * data );
 
+/* fxpo_http_data_borrow makes data refer to the response buf of size bytes without copying it, e.g. in a
+   mapped file. buf must outlive the borrow and is never written to. data must be reset before it is
+   reused. */
+void
+fxpo_http_data_borrow( struct fxpo_http_data_t * data,
+                       const uint8_t *           buf,
+                       size_t                    size,
+                       uint64_t                  hash );
+
 /* fxpo_http_get sends a synchronous HTTP GET request to the given url and returns the response
    buffer and length in res. res must be initialised via fxpo_http_data_new. */
 enum fxpo_status
@@ -56,9 +168,13 @@ fxpo_http_get( const char *              url,
                struct fxpo_http_data_t * res );
 
 /* fxpo_http_get_multi sends a multiple HTTP GET request to the given urls and returns the response
-   buffers in res. Each res must be initialised via fxpo_http_data_new. */
+   buffers in res. Each res must be initialised via fxpo_http_data_new. Requests wait for the rate
+   limits of policy without holding up transfers in flight. With policy->select_host, the host of each
+   URL is replaced by the one chosen when the request is sent. Requests with response data or marked
+   failed are skipped. See fxpo_http_policy_t.archive for recording and replaying responses. */
 enum fxpo_status
 fxpo_http_get_multi( const struct fxpo_http_multi_context_t * ctx,
+                     const struct fxpo_http_policy_t *        policy,
                      const char                               urls[][MAX_URL_LENGTH],
                      size_t                                   url_len,
                      struct fxpo_http_data_t *                res,
@@ -1,90 +1,138 @@
 #include "fxpo_jpeg.h"
 #include "fxpo_log.h"
-#include "fxpo_alloc.h"
 
-enum fxpo_status
-fxpo_jpeg_decode( uint8_t * const jpegbuf,
-                  const size_t    jpegbuf_len,
-                  uint8_t **      imgbuf,
-                  size_t *        imgbuf_len ) {
+tjhandle
+fxpo_jpeg_new() {
 
   tjhandle h = tj3Init( TJINIT_DECOMPRESS );
+  if( h == NULL ) FXPO_LOG_ERROR( "fxpo_jpeg_new(): failed to init decompression handle" );
 
-  if( h == NULL ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to init decompression handle" );
-    return FXPOS_NULL_POINTER;
-  }
+  return h;
+}
 
-  if( tj3DecompressHeader( h, jpegbuf, jpegbuf_len ) < 0 ) {
+void
+fxpo_jpeg_free( tjhandle h ) {
+
+  if( h != NULL ) tj3Destroy( h );
+}
+
+enum fxpo_status
+fxpo_jpeg_decode( tjhandle                    h,
+                  const uint8_t * const       jpegbuf,
+                  const size_t                jpegbuf_len,
+                  struct fxpo_arena_t * const arena,
+                  uint8_t **                  imgbuf,
+                  size_t *                    imgbuf_len ) {
+
+  /* The handle keeps the scaling factor of the previous decode. */
+  if( tj3SetScalingFactor( h, TJUNSCALED ) < 0 || tj3DecompressHeader( h, jpegbuf, jpegbuf_len ) < 0 ) {
     FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to decompress JPEG header: %s", tj3GetErrorStr( h ) );
-    tj3Destroy( h );
     return FXPOS_INVALID_STATE;
   }
 
-  const int width      = tj3Get( h, TJPARAM_JPEGWIDTH );
-  const size_t dst_len = width * tj3Get( h, TJPARAM_JPEGHEIGHT ) * COLOUR_CHANNELS;
-  uint8_t * const dst  = fxpo_aligned_malloc(dst_len);
+  /* Chunks are blitted and upsampled assuming their size. */
+  const int width  = tj3Get( h, TJPARAM_JPEGWIDTH );
+  const int height = tj3Get( h, TJPARAM_JPEGHEIGHT );
+  if( width != CHUNK_SIZE || height != CHUNK_SIZE ) {
+    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): unexpected JPEG size %dx%d", width, height );
+    return FXPOS_INVALID_STATE;
+  }
+
+  const size_t    dst_len = (size_t)width * height * PIXEL_CHANNELS;
+  uint8_t * const dst     = fxpo_arena_alloc( arena, dst_len );
+
+  if( dst == NULL ) return FXPOS_OUT_OF_MEMORY;
 
-  if( tj3Decompress8( h, jpegbuf, jpegbuf_len, dst, width*COLOUR_CHANNELS, PIXEL_FORMAT ) < 0 ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to decompress JPEG image: %s", tj3GetErrorCode( h ) );
-    tj3Destroy( h );
-    free( dst );
+  if( tj3Decompress8( h, jpegbuf, jpegbuf_len, dst, width*PIXEL_CHANNELS, PIXEL_FORMAT ) < 0 ) {
+    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to decompress JPEG image: %s", tj3GetErrorStr( h ) );
     return FXPOS_INVALID_STATE;
   }
 
   *imgbuf     = dst;
   *imgbuf_len = dst_len;
 
-  tj3Destroy( h );
-
   return FXPOS_OK;
 }
 
 enum fxpo_status
-fxpo_jpeg_cropped_decode( uint8_t * const jpegbuf,
-                          const size_t    jpegbuf_len,
-                          uint8_t **      imgbuf,
-                          size_t *        imgbuf_len,
-                          const uint32_t  crop_x,
-                          const uint32_t  crop_y,
-                          const uint32_t  crop_w,
-                          const uint32_t  crop_h ) {
-
-  tjhandle h = tj3Init( TJINIT_DECOMPRESS );
-
-  if( h == NULL ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to init decompression handle" );
-    return FXPOS_NULL_POINTER;
-  }
+fxpo_jpeg_decode_half( tjhandle              h,
+                       const uint8_t * const jpegbuf,
+                       const size_t          jpegbuf_len,
+                       const uint32_t        width,
+                       uint8_t * const       dst,
+                       const size_t          stride ) {
 
   if( tj3DecompressHeader( h, jpegbuf, jpegbuf_len ) < 0 ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to decompress JPEG header: %s", tj3GetErrorStr( h ) );
-    tj3Destroy( h );
+    FXPO_LOG_ERROR( "fxpo_jpeg_decode_half(): failed to decompress JPEG header: %s", tj3GetErrorStr( h ) );
     return FXPOS_INVALID_STATE;
   }
 
-  /* Only decompress the specified region which be divisible by MCU block size (8x8). */
-  const tjregion region = { .x = (int)crop_x, .y = (int)crop_y, .w = (int)crop_w, .h = (int)crop_h };
-  if( tj3SetCroppingRegion( h, region ) < 0 ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to set cropping region: %s", tj3GetErrorCode( h ) );
-    tj3Destroy( h );
+  if( tj3Get( h, TJPARAM_JPEGWIDTH ) != (int)width || tj3Get( h, TJPARAM_JPEGHEIGHT ) != (int)width ) {
+    FXPO_LOG_ERROR( "fxpo_jpeg_decode_half(): unexpected JPEG size %dx%d", tj3Get( h, TJPARAM_JPEGWIDTH ), tj3Get( h, TJPARAM_JPEGHEIGHT ) );
     return FXPOS_INVALID_STATE;
   }
 
-  const size_t dst_len = crop_w * crop_h * COLOUR_CHANNELS;
-  uint8_t * const dst  = fxpo_aligned_malloc(dst_len);
-
-  if( tj3Decompress8( h, jpegbuf, jpegbuf_len, dst,  0, PIXEL_FORMAT ) < 0 ) {
-    FXPO_LOG_ERROR( "fxpo_jpeg_decode(): failed to decompress JPEG image: %s", tj3GetErrorCode( h ) );
-    tj3Destroy( h );
-    free( dst );
+  /* Only runs a 4x4 inverse DCT per block. */
+  const tjscalingfactor scale = { 1, 2 };
+  if( tj3SetScalingFactor( h, scale ) < 0 || tj3Decompress8( h, jpegbuf, jpegbuf_len, dst, (int)stride, PIXEL_FORMAT ) < 0 ) {
+    FXPO_LOG_ERROR( "fxpo_jpeg_decode_half(): failed to decompress JPEG image at 1/2 scale: %s", tj3GetErrorStr( h ) );
     return FXPOS_INVALID_STATE;
   }
 
-  *imgbuf     = dst;
-  *imgbuf_len = dst_len;
+  return FXPOS_OK;
+}
 
-  tj3Destroy( h );
+bool
+fxpo_jpeg_check( tjhandle              h,
+                 const uint8_t * const jpegbuf,
+                 const size_t          jpegbuf_len ) {
 
-  return FXPOS_OK;
+  return jpegbuf_len > 0 && tj3DecompressHeader( h, jpegbuf, jpegbuf_len ) == 0
+         && tj3Get( h, TJPARAM_JPEGWIDTH ) == CHUNK_SIZE && tj3Get( h, TJPARAM_JPEGHEIGHT ) == CHUNK_SIZE;
+}
+
+bool
+fxpo_jpeg_uniform_colour( tjhandle                    h,
+                          const uint8_t * const       jpegbuf,
+                          const size_t                jpegbuf_len,
+                          struct fxpo_arena_t * const arena,
+                          uint8_t * const             colour ) {
+
+  if( jpegbuf_len > JPEG_UNIFORM_MAX_SIZE ) return false;
+
+  const size_t arena_mark = fxpo_arena_mark( arena );
+  bool         uniform    = false;
+
+  /* Each pixel covers 2x2 pixels of the image, so gradients and fine texture within an 8x8 block that
+     leave its average flat are still seen. */
+  const tjscalingfactor scale = { 1, 2 };
+  if( tj3DecompressHeader( h, jpegbuf, jpegbuf_len ) < 0 || tj3SetScalingFactor( h, scale ) < 0 ) goto cleanup;
+
+  const int    width  = TJSCALED( tj3Get( h, TJPARAM_JPEGWIDTH ), scale );
+  const int    height = TJSCALED( tj3Get( h, TJPARAM_JPEGHEIGHT ), scale );
+  const size_t pixels = (size_t)width * height;
+  uint8_t * const dst = fxpo_arena_alloc( arena, pixels * PIXEL_CHANNELS );
+
+  if( dst == NULL || pixels == 0 || tj3Decompress8( h, jpegbuf, jpegbuf_len, dst, width*PIXEL_CHANNELS, PIXEL_FORMAT ) < 0 ) goto cleanup;
+
+  uniform = true;
+  for( size_t c = 0; c < 3 && uniform; c++ ) {
+    uint8_t lo  = UINT8_MAX, hi = 0;
+    size_t  sum = 0;
+    for( size_t i = 0; i < pixels; i++ ) {
+      const uint8_t v = dst[i*PIXEL_CHANNELS + c];
+      if( v < lo ) lo = v;
+      if( v > hi ) hi = v;
+      sum += v;
+    }
+
+    uniform   = hi - lo <= JPEG_UNIFORM_MAX_RANGE;
+    colour[c] = (uint8_t)((sum + pixels / 2) / pixels);
+  }
+  for( size_t c = 3; c < PIXEL_CHANNELS; c++ ) colour[c] = UINT8_MAX;
+
+cleanup:
+  fxpo_arena_rewind( arena, arena_mark );
+
+  return uniform;
 }
@@ -3,24 +3,61 @@
 
 #include <turbojpeg.h>
 #include "fxpo_common.h"
+#include "fxpo_alloc.h"
+#include "fxpo_ortho.h"
 
-#define PIXEL_FORMAT    TJPF_BGRA
-#define COLOUR_CHANNELS tjPixelSize[TJPF_BGRA]
+/* Chunks are decoded with the layout of the tile buffer, see PIXEL_CHANNELS. */
+#define PIXEL_FORMAT (PIXEL_CHANNELS == 3 ? TJPF_BGR : TJPF_BGRA)
 
+/* Flat chunks, e.g. open water, compress to a fraction of the size of detailed ones. Larger JPEGs
+   are not classified so that detailed chunks do not pay for a second decode. */
+#define JPEG_UNIFORM_MAX_SIZE  (2 * 1024)
+/* Largest difference between the lightest and darkest pixel of a channel in a uniform chunk. */
+#define JPEG_UNIFORM_MAX_RANGE 6
+
+/* fxpo_jpeg_new creates a decompressor. Each worker reuses one for every JPEG it reads. Returns NULL on failure. */
+tjhandle
+fxpo_jpeg_new();
+
+void
+fxpo_jpeg_free( tjhandle h );
+
+/* fxpo_jpeg_decode decodes a JPEG image of CHUNK_SIZE x CHUNK_SIZE pixels into a pixel buffer allocated
+   from arena. Returns FXPOS_INVALID_STATE for any other size. */
 enum fxpo_status
-fxpo_jpeg_decode( uint8_t *  jpegbuf,
-                  size_t     jpegbuf_len,
-                  uint8_t ** imgbuf,
-                  size_t *   imgbuf_len );
+fxpo_jpeg_decode( tjhandle              h,
+                  const uint8_t *       jpegbuf,
+                  size_t                jpegbuf_len,
+                  struct fxpo_arena_t * arena,
+                  uint8_t **            imgbuf,
+                  size_t *              imgbuf_len );
 
+/* fxpo_jpeg_decode_half decodes a width x width JPEG image at 1/2 scale through DCT scaling into dst with a
+   row stride of stride, e.g. straight into the first mip of a tile. Smaller scales are left to a box filter
+   of the result, which costs less than decoding the entropy-coded data again.
+   Returns FXPOS_INVALID_STATE if the image is not width pixels wide and high. */
 enum fxpo_status
-fxpo_jpeg_cropped_decode( uint8_t *  jpegbuf,
-                          size_t     jpegbuf_len,
-                          uint8_t ** imgbuf,
-                          size_t *   imgbuf_len,
-                          uint32_t   crop_x,
-                          uint32_t   crop_y,
-                          uint32_t   crop_w,
-                          uint32_t   crop_h );
+fxpo_jpeg_decode_half( tjhandle        h,
+                       const uint8_t * jpegbuf,
+                       size_t          jpegbuf_len,
+                       uint32_t        width,
+                       uint8_t *       dst,
+                       size_t          stride );
+
+/* fxpo_jpeg_check tells whether jpegbuf starts with a readable JPEG header of a CHUNK_SIZE x CHUNK_SIZE image,
+   e.g. rather than an error page or a provider's image of another size. */
+bool
+fxpo_jpeg_check( tjhandle        h,
+                 const uint8_t * jpegbuf,
+                 size_t          jpegbuf_len );
+
+/* fxpo_jpeg_uniform_colour tells whether a JPEG image is a single flat colour, returned as BGRA in colour.
+   The image is classified at 1/2 scale. Scratch memory is taken from arena and released before returning. */
+bool
+fxpo_jpeg_uniform_colour( tjhandle              h,
+                          const uint8_t *       jpegbuf,
+                          size_t                jpegbuf_len,
+                          struct fxpo_arena_t * arena,
+                          uint8_t *             colour );
 
 #endif
\ No newline at end of file
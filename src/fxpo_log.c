@@ -1,5 +1,13 @@
 #include "fxpo_common.h"
 #include "fxpo_log.h"
+#include "fxpo_alloc.h"
+#include "fxpo_thread.h"
+
+/* Records buffered per thread. Must be a power of two. */
+#define LOG_RING_CAPACITY     256
+#define LOG_MESSAGE_LENGTH    480
+#define LOG_MAX_RINGS         256
+#define LOG_FLUSH_INTERVAL_MS 10
 
 static const char * const FXPO_LOG_LEVEL_STR[] = {
   "INFO",
@@ -9,6 +17,53 @@ static const char * const FXPO_LOG_LEVEL_STR[] = {
   "DEBUG",
 };
 
+/* fxpo_log_record_t is a formatted message waiting to be written by the logger thread. */
+struct fxpo_log_record_t {
+  FILE *              stream;
+  enum fxpo_log_level level;
+  time_t              time;
+  /* Number of the thread that logged the message, see fxpo_log_thread_num. */
+  uint32_t            thread_num;
+  char                msg[LOG_MESSAGE_LENGTH];
+};
+
+/* fxpo_log_ring_t is a single-producer single-consumer queue of records owned by one thread. Rings are
+   never freed, the ring of a thread that exited is handed to the next thread that logs once it is drained. */
+struct fxpo_log_ring_t {
+  /* Number of records pushed, only written by the owning thread. */
+  volatile int64_t head;
+  /* Number of records written, only written by the logger thread. */
+  volatile int64_t         tail;
+  /* A thread owns the ring. */
+  volatile int64_t         owned;
+  struct fxpo_log_record_t records[LOG_RING_CAPACITY];
+};
+
+uint32_t fxpo_log_levels = (1u << FXPO_LOG_LEVEL_TITLE) | (1u << FXPO_LOG_LEVEL_INFO) | (1u << FXPO_LOG_LEVEL_WARN)
+                           | (1u << FXPO_LOG_LEVEL_ERROR) | (1u << FXPO_LOG_LEVEL_DEBUG);
+
+static struct fxpo_log_ring_t * fxpo_log_rings[LOG_MAX_RINGS];
+static volatile int64_t         fxpo_log_rings_len  = 0;
+static struct fxpo_mutex_t      fxpo_log_rings_lock = FXPO_MUTEX_INIT;
+static volatile int64_t         fxpo_log_running    = 0;
+static volatile int64_t         fxpo_log_threads    = 0;
+
+/* Held while writing records, by the logger thread as well as by threads writing synchronously. */
+static struct fxpo_mutex_t fxpo_log_write_lock = FXPO_MUTEX_INIT;
+
+static FXPO_THREAD_LOCAL struct fxpo_log_ring_t * fxpo_log_ring       = NULL;
+static FXPO_THREAD_LOCAL uint32_t                 fxpo_log_thread_num = 0;
+
+/* Hands the ring of an exiting thread back, see fxpo_log_release_ring. */
+#ifdef _WIN32
+static DWORD            fxpo_log_ring_key;
+#else
+static pthread_key_t    fxpo_log_ring_key;
+#endif
+static volatile int64_t fxpo_log_ring_key_created = 0;
+
+static struct fxpo_thread_t fxpo_log_thread;
+
 static inline const char *
 fxpo_log_level_str( const enum fxpo_log_level level ) {
 
@@ -16,46 +71,238 @@ fxpo_log_level_str( const enum fxpo_log_level level ) {
   return "UNKNOWN";
 }
 
+bool
+fxpo_log_set_level( const char * const name ) {
+
+  uint32_t levels = 1u << FXPO_LOG_LEVEL_ERROR;
+
+  if( !strcmp( name, "error" ) ) {
+    fxpo_log_levels = levels;
+    return true;
+  }
+
+  levels |= 1u << FXPO_LOG_LEVEL_WARN;
+  if( !strcmp( name, "warn" ) ) {
+    fxpo_log_levels = levels;
+    return true;
+  }
+
+  levels |= (1u << FXPO_LOG_LEVEL_TITLE) | (1u << FXPO_LOG_LEVEL_INFO);
+  if( !strcmp( name, "info" ) ) {
+    fxpo_log_levels = levels;
+    return true;
+  }
+
+  levels |= 1u << FXPO_LOG_LEVEL_DEBUG;
+  if( !strcmp( name, "debug" ) ) {
+    fxpo_log_levels = levels;
+    return true;
+  }
+
+  return false;
+}
+
+/* fxpo_log_write writes a record to its stream. Called with fxpo_log_write_lock held. */
+static void
+fxpo_log_write( const struct fxpo_log_record_t * const record ) {
+
+  /* Formatting the timestamp is costly, only do it once per second. */
+  static time_t cached_time = 0;
+  static char   cached_buf[20];
+
+  if( record->time != cached_time || cached_buf[0] == '\0' ) {
+    strftime( cached_buf, sizeof(cached_buf), "%Y-%m-%d %H:%M:%S", localtime( &record->time ) );
+    cached_time = record->time;
+  }
+
+#ifdef _WIN32
+  HANDLE console    = NULL;
+  DWORD  std_handle = STD_OUTPUT_HANDLE;
+  WORD   colour     = 0;
+
+  switch( record->level ) {
+    case FXPO_LOG_LEVEL_TITLE: colour = FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY; break;
+    case FXPO_LOG_LEVEL_WARN:  colour = FOREGROUND_RED | FOREGROUND_GREEN; break;
+    case FXPO_LOG_LEVEL_ERROR: colour = FOREGROUND_RED; std_handle = STD_ERROR_HANDLE; break;
+    case FXPO_LOG_LEVEL_DEBUG: colour = FOREGROUND_INTENSITY; break;
+    default: break;
+  }
+
+  if( colour > 0 ) {
+    console = GetStdHandle( std_handle );
+    SetConsoleTextAttribute( console, colour );
+  }
+#endif
+  fprintf( record->stream, "%s %s [%u] %s", cached_buf, fxpo_log_level_str( record->level ), record->thread_num, record->msg );
+#ifdef _WIN32
+  if( console != NULL ) SetConsoleTextAttribute( console, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE );
+#endif
+}
+
+/* fxpo_log_drain writes every pending record and returns the number of records written. */
+static size_t
+fxpo_log_drain() {
+
+  size_t written = 0;
+
+  fxpo_mutex_lock( &fxpo_log_write_lock );
+
+  const int64_t rings_len = fxpo_atomic_load( &fxpo_log_rings_len );
+  for( int64_t r = 0; r < rings_len; r++ ) {
+    struct fxpo_log_ring_t * const ring = fxpo_log_rings[r];
+
+    const int64_t head = fxpo_atomic_load( &ring->head );
+    int64_t       tail = ring->tail;
+
+    for( ; tail < head; tail++, written++ ) fxpo_log_write( &ring->records[tail & (LOG_RING_CAPACITY - 1)] );
+
+    /* Hand the slots back to the producer. */
+    fxpo_atomic_store( &ring->tail, tail );
+  }
+
+  if( written > 0 ) {
+    fflush( stdout );
+    fflush( stderr );
+  }
+
+  fxpo_mutex_unlock( &fxpo_log_write_lock );
+
+  return written;
+}
+
+static void
+fxpo_log_thread_main( void * const arg ) {
+
+  (void)arg;
+
+  while( fxpo_atomic_load( &fxpo_log_running ) ) {
+    if( fxpo_log_drain() == 0 ) fxpo_sleep_ms( LOG_FLUSH_INTERVAL_MS );
+  }
+
+  fxpo_log_drain();
+}
+
+/* fxpo_log_release_ring runs when a thread owning ring exits. The records left in it are still written. */
+#ifdef _WIN32
+static VOID WINAPI
+#else
+static void
+#endif
+fxpo_log_release_ring( void * const ring ) {
+
+  if( ring != NULL ) fxpo_atomic_store( &((struct fxpo_log_ring_t *)ring)->owned, 0 );
+}
+
+/* fxpo_log_thread_ring returns the ring of the calling thread, registering it on first use. */
+static struct fxpo_log_ring_t *
+fxpo_log_thread_ring() {
+
+  if( fxpo_log_ring != NULL ) return fxpo_log_ring;
+
+  fxpo_mutex_lock( &fxpo_log_rings_lock );
+
+  /* Rings of exited threads are only reused once drained, so that records are written in order. */
+  struct fxpo_log_ring_t * ring      = NULL;
+  const int64_t            rings_len = fxpo_log_rings_len;
+  for( int64_t r = 0; r < rings_len && ring == NULL; r++ ) {
+    struct fxpo_log_ring_t * const candidate = fxpo_log_rings[r];
+    if( !fxpo_atomic_load( &candidate->owned ) && fxpo_atomic_load( &candidate->tail ) == candidate->head ) ring = candidate;
+  }
+
+  /* Without a ring the thread writes its messages synchronously. */
+  if( ring == NULL && rings_len < LOG_MAX_RINGS && (ring = fxpo_malloc( sizeof(struct fxpo_log_ring_t) )) != NULL ) {
+    ring->head = 0;
+    ring->tail = 0;
+
+    fxpo_log_rings[rings_len] = ring;
+    fxpo_atomic_store( &fxpo_log_rings_len, rings_len + 1 );
+  }
+
+  if( ring != NULL ) {
+    fxpo_atomic_store( &ring->owned, 1 );
+#ifdef _WIN32
+    FlsSetValue( fxpo_log_ring_key, ring );
+#else
+    pthread_setspecific( fxpo_log_ring_key, ring );
+#endif
+    fxpo_log_ring = ring;
+  }
+
+  fxpo_mutex_unlock( &fxpo_log_rings_lock );
+
+  return fxpo_log_ring;
+}
+
+void
+fxpo_log_start() {
+
+  if( fxpo_atomic_load( &fxpo_log_running ) ) return;
+
+  /* Threads only take rings while the logger is running, the key outlives a restart. */
+  if( !fxpo_atomic_load( &fxpo_log_ring_key_created ) ) {
+#ifdef _WIN32
+    fxpo_log_ring_key = FlsAlloc( fxpo_log_release_ring );
+    if( fxpo_log_ring_key == FLS_OUT_OF_INDEXES ) return;
+#else
+    if( pthread_key_create( &fxpo_log_ring_key, fxpo_log_release_ring ) != 0 ) return;
+#endif
+    fxpo_atomic_store( &fxpo_log_ring_key_created, 1 );
+  }
+
+  fxpo_atomic_store( &fxpo_log_running, 1 );
+
+  if( !fxpo_thread_start( &fxpo_log_thread, fxpo_log_thread_main, NULL ) ) fxpo_atomic_store( &fxpo_log_running, 0 );
+}
+
+void
+fxpo_log_stop() {
+
+  if( !fxpo_atomic_load( &fxpo_log_running ) ) return;
+
+  fxpo_atomic_store( &fxpo_log_running, 0 );
+
+  fxpo_thread_join( &fxpo_log_thread );
+}
+
 void
 fxpo_log( FILE * const              stream,
           const enum fxpo_log_level level,
           const char *              fmt,
           ... ) {
 
-  char buf[20];
+  struct fxpo_log_ring_t * const ring = fxpo_atomic_load( &fxpo_log_running ) ? fxpo_log_thread_ring() : NULL;
 
-  const time_t            now     = time( NULL );
-  const struct tm * const tm_info = localtime( &now );
+  struct fxpo_log_record_t   local;
+  struct fxpo_log_record_t * record = &local;
+
+  if( ring != NULL ) {
+    /* Wait for the logger thread to free up a slot rather than dropping messages. */
+    while( ring->head - fxpo_atomic_load( &ring->tail ) >= LOG_RING_CAPACITY ) fxpo_sleep_ms( 1 );
+    record = &ring->records[ring->head & (LOG_RING_CAPACITY - 1)];
+  }
 
-  strftime( buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", tm_info );
+  record->stream      = stream;
+  record->level       = level;
+  record->time        = time( NULL );
+  /* Threads are numbered in the order they first log, workers outside of OpenMP included. */
+  if( fxpo_log_thread_num == 0 ) fxpo_log_thread_num = (uint32_t)fxpo_atomic_add( &fxpo_log_threads, 1 );
+  record->thread_num = fxpo_log_thread_num;
 
   va_list args;
   va_start( args, fmt );
-  #pragma omp critical
-  {
-#ifdef _WIN32
-    HANDLE console    = NULL;
-    DWORD  std_handle = STD_OUTPUT_HANDLE;
-    WORD   colour     = 0;
-
-    switch( level ) {
-      case FXPO_LOG_LEVEL_TITLE: colour = FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY; break;
-      case FXPO_LOG_LEVEL_WARN:  colour = FOREGROUND_RED | FOREGROUND_GREEN; break;
-      case FXPO_LOG_LEVEL_ERROR: colour = FOREGROUND_RED; std_handle = STD_ERROR_HANDLE; break;
-      case FXPO_LOG_LEVEL_DEBUG: colour = FOREGROUND_INTENSITY; break;
-      default: break;
-    }
-
-    if( colour > 0 ) {
-      console = GetStdHandle( std_handle );
-      SetConsoleTextAttribute( console, colour );
-    }
-#endif
-    fprintf( stream, "%s %s [%d/%d] ", buf, fxpo_log_level_str( level ), omp_get_num_threads(), omp_get_thread_num()+1 );
-    vfprintf( stream, fmt, args );
-#ifdef _WIN32
-    if( console != NULL ) SetConsoleTextAttribute( console, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE );
-#endif
-  }
+  const int len = vsnprintf( record->msg, sizeof(record->msg), fmt, args );
   va_end( args );
+
+  /* Keep the line break of truncated messages. */
+  if( len >= (int)sizeof(record->msg) ) record->msg[sizeof(record->msg) - 2] = '\n';
+
+  if( ring != NULL ) {
+    /* Publish the record to the logger thread. */
+    fxpo_atomic_store( &ring->head, ring->head + 1 );
+    return;
+  }
+
+  fxpo_mutex_lock( &fxpo_log_write_lock );
+  fxpo_log_write( record );
+  fxpo_mutex_unlock( &fxpo_log_write_lock );
 }
@@ -2,6 +2,8 @@
 #define FXPO_LOG_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 enum fxpo_log_level {
   FXPO_LOG_LEVEL_TITLE,
@@ -11,21 +13,40 @@ enum fxpo_log_level {
   FXPO_LOG_LEVEL_DEBUG,
 };
 
+/* Bit mask of enabled log levels. Checked before any formatting takes place. */
+extern uint32_t fxpo_log_levels;
+
+#define FXPO_LOG_ENABLED( level ) ( (fxpo_log_levels & (1u << (level))) != 0 )
+
 void
 fxpo_log( FILE *              stream,
           enum fxpo_log_level level,
           const char *        fmt,
           ... );
 
-#define FXPO_LOG_TITLE( fmt, ... ) fxpo_log( stdout, FXPO_LOG_LEVEL_TITLE, fmt "\n", ## __VA_ARGS__ )
-#define FXPO_LOG_INFO( fmt, ... )  fxpo_log( stdout, FXPO_LOG_LEVEL_INFO,  fmt "\n", ## __VA_ARGS__ )
-#define FXPO_LOG_WARN( fmt, ... )  fxpo_log( stdout, FXPO_LOG_LEVEL_WARN,  fmt "\n", ## __VA_ARGS__ )
-#define FXPO_LOG_ERROR( fmt, ... ) fxpo_log( stderr, FXPO_LOG_LEVEL_ERROR, fmt "\n", ## __VA_ARGS__ )
+/* fxpo_log_set_level enables messages of level name ("error", "warn", "info" or "debug") and every
+   more severe level. Returns false if the name is unknown. */
+bool
+fxpo_log_set_level( const char * name );
+
+/* fxpo_log_start starts the background thread writing log messages. Until it is started, and after
+   it is stopped, messages are written synchronously by the calling thread. */
+void
+fxpo_log_start();
+
+/* fxpo_log_stop flushes pending messages and stops the background thread. */
+void
+fxpo_log_stop();
+
+#define FXPO_LOG_TITLE( fmt, ... ) ( FXPO_LOG_ENABLED( FXPO_LOG_LEVEL_TITLE ) ? fxpo_log( stdout, FXPO_LOG_LEVEL_TITLE, fmt "\n", ## __VA_ARGS__ ) : (void)0 )
+#define FXPO_LOG_INFO( fmt, ... )  ( FXPO_LOG_ENABLED( FXPO_LOG_LEVEL_INFO )  ? fxpo_log( stdout, FXPO_LOG_LEVEL_INFO,  fmt "\n", ## __VA_ARGS__ ) : (void)0 )
+#define FXPO_LOG_WARN( fmt, ... )  ( FXPO_LOG_ENABLED( FXPO_LOG_LEVEL_WARN )  ? fxpo_log( stdout, FXPO_LOG_LEVEL_WARN,  fmt "\n", ## __VA_ARGS__ ) : (void)0 )
+#define FXPO_LOG_ERROR( fmt, ... ) ( FXPO_LOG_ENABLED( FXPO_LOG_LEVEL_ERROR ) ? fxpo_log( stderr, FXPO_LOG_LEVEL_ERROR, fmt "\n", ## __VA_ARGS__ ) : (void)0 )
 
 #ifdef NDEBUG
 #define FXPO_LOG_DEBUG( fmt, ... ) do {} while( 0 )
 #else
-#define FXPO_LOG_DEBUG( fmt, ... ) fxpo_log( stdout, FXPO_LOG_LEVEL_DEBUG, fmt "\n", ## __VA_ARGS__ )
+#define FXPO_LOG_DEBUG( fmt, ... ) ( FXPO_LOG_ENABLED( FXPO_LOG_LEVEL_DEBUG ) ? fxpo_log( stdout, FXPO_LOG_LEVEL_DEBUG, fmt "\n", ## __VA_ARGS__ ) : (void)0 )
 #endif
 
-#endif
\ No newline at end of file
+#endif
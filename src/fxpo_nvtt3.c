@@ -1,35 +1,128 @@
 #include "fxpo_log.h"
 #include "fxpo_nvtt3.h"
 
+/* fxpo_nvtt3_writer_t is the texture written through a fxpo_texture_io_t by the calling thread.
+   NVTT's output handlers take no user pointer. */
+struct fxpo_nvtt3_writer_t {
+  const struct fxpo_texture_io_t * io;
+  void *                           handle;
+  bool                             ok;
+};
+
+static FXPO_THREAD_LOCAL struct fxpo_nvtt3_writer_t fxpo_nvtt3_writer;
+
+#ifdef FXPO_TILE_BGR
+/* 8-bit channel values as NVTT's normalised floats. */
+static float fxpo_nvtt3_unorm[256];
+#endif
+
+static void
+fxpo_nvtt3_begin_image( int size,
+                        int width,
+                        int height,
+                        int depth,
+                        int face,
+                        int miplevel ) {
+
+  (void)size; (void)width; (void)height; (void)depth; (void)face; (void)miplevel;
+}
+
+static NvttBoolean
+fxpo_nvtt3_write( const void * data,
+                  int          size ) {
+
+  struct fxpo_nvtt3_writer_t * const writer = &fxpo_nvtt3_writer;
+  if( writer->ok ) writer->ok = writer->io->write( writer->handle, data, (size_t)size, writer->io->user );
+  return writer->ok ? NVTT_True : NVTT_False;
+}
+
+static void
+fxpo_nvtt3_end_image() {
+}
+
 bool
 fxpo_nvtt3_is_cuda_enabled() {
 
   return nvttIsCudaSupported() == NVTT_True;
 }
 
+size_t
+fxpo_nvtt3_memory_estimate( const uint32_t width,
+                            const uint32_t height ) {
+
+  /* Surfaces store 4 float channels per pixel, building the next mip keeps both levels alive. */
+  const size_t surface_size = (size_t)width * height * 4 * sizeof(float);
+  return surface_size + surface_size / 4;
+}
+
+/* fxpo_nvtt3_set_image replaces the contents of surface with the width x height image data. */
+static bool
+fxpo_nvtt3_set_image( NvttSurface * const   surface,
+                      const int             width,
+                      const int             height,
+                      const uint8_t * const data ) {
+
+#ifdef FXPO_TILE_BGR
+  /* NVTT takes no 3 channel input. Converting straight into its float channels spares a BGRA copy of the image. */
+  if( nvttSurfaceSetImage( surface, width, height, 1 ) == NVTT_False ) return false;
+
+  float * const r = nvttSurfaceChannel( surface, 0 );
+  float * const g = nvttSurfaceChannel( surface, 1 );
+  float * const b = nvttSurfaceChannel( surface, 2 );
+  float * const a = nvttSurfaceChannel( surface, 3 );
+
+  const size_t pixels = (size_t)width * (size_t)height;
+  for( size_t i = 0; i < pixels; i++ ) {
+    b[i] = fxpo_nvtt3_unorm[data[i*3]];
+    g[i] = fxpo_nvtt3_unorm[data[i*3 + 1]];
+    r[i] = fxpo_nvtt3_unorm[data[i*3 + 2]];
+    a[i] = 1.0f;
+  }
+
+  return true;
+#else
+  return nvttSurfaceSetImageData( surface, NVTT_InputFormat_BGRA_8UB, width, height, 1, data, NVTT_False, NULL ) == NVTT_True;
+#endif
+}
+
 void
 fxpo_nvtt3_init() {
 
   nvttUseCurrentDevice();
+
+#ifdef FXPO_TILE_BGR
+  for( int v = 0; v < 256; v++ ) fxpo_nvtt3_unorm[v] = (float)v / 255.0f;
+#endif
 }
 
-void
+enum fxpo_status
 fxpo_nvtt3_context_new( struct fxpo_nvtt3_context_t * const ctx ) {
 
-  ctx->context = nvttCreateContext();
+  ctx->context   = nvttCreateContext();
+  ctx->comp_opts = nvttCreateCompressionOptions();
+
+  if( ctx->context == NULL || ctx->comp_opts == NULL ) {
+    FXPO_LOG_ERROR( "fxpo_nvtt3_context_new(): failed to create NVTT context" );
+    fxpo_nvtt3_context_free( ctx );
+    return FXPOS_OUT_OF_MEMORY;
+  }
+
   if( nvttIsCudaSupported() == NVTT_True ) {
     nvttSetContextCudaAcceleration( ctx->context, NVTT_True );
   }
 
-  ctx->comp_opts = nvttCreateCompressionOptions();
   nvttSetCompressionOptionsFormat( ctx->comp_opts, NVTT_Format_BC1 );
+
+  return FXPOS_OK;
 }
 
 void
 fxpo_nvtt3_context_free( struct fxpo_nvtt3_context_t * const ctx ) {
 
-  nvttDestroyContext( ctx->context );
-  nvttDestroyCompressionOptions( ctx->comp_opts );
+  if( ctx->context != NULL ) nvttDestroyContext( ctx->context );
+  if( ctx->comp_opts != NULL ) nvttDestroyCompressionOptions( ctx->comp_opts );
+  ctx->context   = NULL;
+  ctx->comp_opts = NULL;
 }
 
 enum fxpo_status
@@ -37,21 +130,41 @@ fxpo_nvtt3_compress( const struct fxpo_nvtt3_context_t * const ctx,
                      const uint32_t                            width,
                      const uint32_t                            height,
                      const uint8_t *                           data,
-                     const char *                              outfile ) {
+                     const uint8_t * const * const             mip_data,
+                     const size_t                              mip_data_len,
+                     const char *                              outfile,
+                     const struct fxpo_texture_io_t * const    io,
+                     const volatile int64_t * const            cancelled ) {
 
   enum fxpo_status state = FXPOS_OK;
 
   NvttSurface * const surface = nvttCreateSurface();
   NvttOutputOptions * out_opt = NULL;
 
-  if( nvttSurfaceSetImageData( surface, NVTT_InputFormat_BGRA_8UB, (int)width, (int)height, 1, data, NVTT_False, NULL ) == NVTT_False ) {
+  struct fxpo_nvtt3_writer_t * const writer = &fxpo_nvtt3_writer;
+  *writer = (struct fxpo_nvtt3_writer_t) { .io = NULL };
+
+  if( !fxpo_nvtt3_set_image( surface, (int)width, (int)height, data ) ) {
     FXPO_LOG_ERROR( "fxpo_nvtt3_compress(): failed set image surface" );
     state = FXPOS_INVALID_STATE;
     goto cleanup;
   }
 
   out_opt = nvttCreateOutputOptions();
-  nvttSetOutputOptionsFileName( out_opt, outfile );
+
+  if( io != NULL && io->open != NULL ) {
+    if( (writer->handle = io->open( outfile, io->user )) == NULL ) {
+      FXPO_LOG_ERROR( "fxpo_nvtt3_compress(): failed to open texture=%s", outfile );
+      state = FXPOS_INVALID_STATE;
+      goto cleanup;
+    }
+
+    writer->io = io;
+    writer->ok = true;
+    nvttSetOutputOptionsOutputHandler( out_opt, fxpo_nvtt3_begin_image, fxpo_nvtt3_write, fxpo_nvtt3_end_image );
+  } else {
+    nvttSetOutputOptionsFileName( out_opt, outfile );
+  }
 
   const int mips = nvttSurfaceCountMipmaps( surface, 1 );
 
@@ -63,6 +176,11 @@ fxpo_nvtt3_compress( const struct fxpo_nvtt3_context_t * const ctx,
   }
 
   for( int mip = 0; mip < mips; mip++ ) {
+    if( cancelled != NULL && fxpo_atomic_load( cancelled ) ) {
+      state = FXPOS_CANCELLED;
+      goto cleanup;
+    }
+
     if( nvttContextCompress( ctx->context, surface, 0, mip, ctx->comp_opts, out_opt ) == NVTT_False ) {
       FXPO_LOG_ERROR( "fxpo_nvtt3_compress(): failed to compress mip %d", mip );
       state = FXPOS_INVALID_STATE;
@@ -71,6 +189,18 @@ fxpo_nvtt3_compress( const struct fxpo_nvtt3_context_t * const ctx,
 
     if( mip == mips - 1 ) break;
 
+    /* Mips given by the caller replace the surface rather than being filtered from it. */
+    if( (size_t)mip < mip_data_len ) {
+      const int mip_width  = width >> (mip + 1) > 0 ? (int)(width >> (mip + 1)) : 1;
+      const int mip_height = height >> (mip + 1) > 0 ? (int)(height >> (mip + 1)) : 1;
+      if( !fxpo_nvtt3_set_image( surface, mip_width, mip_height, mip_data[mip] ) ) {
+        FXPO_LOG_ERROR( "fxpo_nvtt3_compress(): failed to set mip %d surface", mip+1 );
+        state = FXPOS_INVALID_STATE;
+        goto cleanup;
+      }
+      continue;
+    }
+
     nvttSurfaceToLinearFromSrgb( surface, NULL );
     if( nvttSurfaceBuildNextMipmapDefaults( surface, NVTT_MipmapFilter_Box, 1, NULL ) == NVTT_False ) {
       FXPO_LOG_ERROR( "fxpo_nvtt3_compress(): failed to build next mip %d", mip+1 );
@@ -81,6 +211,10 @@ fxpo_nvtt3_compress( const struct fxpo_nvtt3_context_t * const ctx,
   }
 
 cleanup:
+  if( writer->io != NULL ) {
+    writer->io->close( writer->handle, state == FXPOS_OK && writer->ok, writer->io->user );
+    writer->io = NULL;
+  }
   if( out_opt != NULL ) nvttDestroyOutputOptions( out_opt );
   if( surface != NULL ) nvttDestroySurface( surface );
 
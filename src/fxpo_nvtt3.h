@@ -12,20 +12,35 @@ struct fxpo_nvtt3_context_t {
 void
 fxpo_nvtt3_init();
 
-void
+enum fxpo_status
 fxpo_nvtt3_context_new( struct fxpo_nvtt3_context_t * ctx );
 
 void
 fxpo_nvtt3_context_free( struct fxpo_nvtt3_context_t * ctx );
 
+/* fxpo_nvtt3_compress compresses a BGRA image, or a packed BGR image when built with FXPO_TILE_BGR, with its mips to the DDS outfile. The first mip_data_len mips
+   below the image are taken from mip_data, mip_data[0] being half the size of data, and the remaining ones
+   are box-filtered from the last of them. mip_data may be NULL if mip_data_len is 0. The texture is written
+   through io if io->open is set, otherwise NVTT writes the file itself. Compression stops between mips
+   with FXPOS_CANCELLED once *cancelled is set, leaving outfile incomplete. cancelled may be NULL. */
 enum fxpo_status
 fxpo_nvtt3_compress( const struct fxpo_nvtt3_context_t * ctx,
                      uint32_t                            width,
                      uint32_t                            height,
                      const uint8_t *                     data,
-                     const char *                        outfile );
+                     const uint8_t * const *             mip_data,
+                     size_t                              mip_data_len,
+                     const char *                        outfile,
+                     const struct fxpo_texture_io_t *    io,
+                     const volatile int64_t *            cancelled );
 
 bool
 fxpo_nvtt3_is_cuda_enabled();
 
+/* fxpo_nvtt3_memory_estimate returns the approximate number of host bytes NVTT holds while
+   compressing a width x height image, i.e. the float surface plus the next mip being built. */
+size_t
+fxpo_nvtt3_memory_estimate( uint32_t width,
+                            uint32_t height );
+
 #endif
\ No newline at end of file
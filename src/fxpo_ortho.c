@@ -2,27 +2,44 @@
 #include "fxpo_common.h"
 #include "fxpo_log.h"
 #include "fxpo_alloc.h"
+#include "fxpo_provider.h"
 
 #define INITIAL_CAPACITY 100
 
-#define BI_CACHE_VARIANT_1 "14041" /* Latest. */
-#define BI_CACHE_VARIANT_2 "13816" /* Seems older, more green in UK. */
+static inline uint32_t
+fxpo_pow2( uint32_t pow ) {
+  return 1 << pow;
+}
 
-static const char * const FXPO_PROVIDER_STR[] = {
-  "BI",
-  "ARC"
-};
+enum fxpo_status
+fxpo_ortho_tile_origin( const struct fxpo_tile_t * const tile,
+                        uint32_t * const                 x,
+                        uint32_t * const                 y,
+                        uint8_t * const                  zoom_level ) {
+
+  *x          = tile->x;
+  *y          = tile->y;
+  *zoom_level = tile->zoom_level;
+
+  /* Every doubling of the texture size is one zoom level up, every halving one zoom level down. */
+  for( uint32_t side = DEFAULT_CHUNKS_PER_TILE_SIDE; side < tile->chunks_per_side; side *= 2 ) {
+    *x *= 2;
+    *y *= 2;
+    (*zoom_level)++;
+  }
 
-static inline const char *
-fxpo_provider_str( enum fxpo_provider provider ) {
+  for( uint32_t side = DEFAULT_CHUNKS_PER_TILE_SIDE; side > tile->chunks_per_side; side /= 2 ) {
+    *x /= 2;
+    *y /= 2;
+    (*zoom_level)--;
+  }
 
-  if( provider >= FXPO_PROVIDER_BI && provider < FXPO_PROVIDER_COUNT ) return FXPO_PROVIDER_STR[provider];
-  return "UNKNOWN";
-}
+  if( *zoom_level > MAX_ZOOM_LEVEL ) {
+    FXPO_LOG_ERROR( "fxpo_ortho_tile_origin(): texture size requires zl=%u above max_zl=%u", *zoom_level, MAX_ZOOM_LEVEL );
+    return FXPOS_INVALID_STATE;
+  }
 
-static inline uint32_t
-fxpo_pow2( uint32_t pow ) {
-  return 1 << pow;
+  return FXPOS_OK;
 }
 
 void
@@ -86,33 +103,12 @@ fxpo_ortho_wgs2tile( const double         lat,
   tile->y = (uint32_t)(y * map_size + 0.5) / 256;
 }
 
-enum fxpo_status
-fxpo_ortho_build_url( enum fxpo_provider                provider,
-                      const struct fxpo_chunk_t * const chunk,
-                      const char *                      quadkey,
-                      char *                            url,
-                      size_t                            url_len ) {
-
-  static uint8_t server_id = 0;
-  #pragma omp threadprivate(server_id)
-
-  switch( provider ) {
-    case FXPO_PROVIDER_BI: {
-      server_id = server_id % 4 + 1;
-      /* Use unencrypted HTTP endpoint to save time on TLS handshake. */
-      snprintf( url, url_len, "http://ecn.t%u.tiles.virtualearth.net/tiles/a%s.jpeg?g=" BI_CACHE_VARIANT_1, server_id, quadkey );
-      return FXPOS_OK;
-    }
-
-    case FXPO_PROVIDER_ARC: {
-      snprintf( url, url_len, "https://services.arcgisonline.com/ArcGIS/rest/services/World_Imagery/MapServer/tile/%u/%u/%u", chunk->zoom_level, chunk->y, chunk->x );
-      return FXPOS_OK;
-    }
+void
+fxpo_ortho_build_dds_name( const struct fxpo_tile_t * tile,
+                           char *                     name,
+                           size_t                     name_len ) {
 
-    default:
-      FXPO_LOG_ERROR( "fxpo_ortho_build_url(): unknown provider %u", provider );
-      return FXPOS_INVALID_STATE;
-  }
+  sprintf_s( name, name_len, "%u_%u_%s%u.dds", tile->y, tile->x, fxpo_provider_get( tile->provider )->name, tile->zoom_level );
 }
 
 void
@@ -123,7 +119,53 @@ fxpo_ortho_build_dds_path( const char *               scenery_path,
                            size_t                     path_len ) {
 
   sprintf_s( path, path_len, "%s/zOrtho4XP_%s/textures/%u_%u_%s%u.dds",
-             scenery_path, tileset, tile->y, tile->x, fxpo_provider_str( tile->provider ), tile->zoom_level );
+             scenery_path, tileset, tile->y, tile->x, fxpo_provider_get( tile->provider )->name, tile->zoom_level );
+}
+
+enum fxpo_status
+fxpo_ortho_parse_dds_name( const char * const         name,
+                           struct fxpo_tile_t * const tile ) {
+
+  /* Example: 63568_40144_BI17.dds */
+  char *         end;
+  const uint32_t y = (uint32_t)strtoul( name, &end, 10 );
+  if( end == name || *end != '_' ) goto invalid;
+
+  const char *   p = end + 1;
+  const uint32_t x = (uint32_t)strtoul( p, &end, 10 );
+  if( end == p || *end != '_' ) goto invalid;
+
+  enum fxpo_provider provider;
+  size_t             provider_str_len;
+
+  p = end + 1;
+  if( !fxpo_provider_from_prefix( p, &provider, &provider_str_len ) ) {
+    FXPO_LOG_ERROR( "fxpo_ortho_parse_dds_name(): unknown provider in name=%s", name );
+    return FXPOS_INVALID_STATE;
+  }
+
+  p += provider_str_len;
+  const unsigned long zoom_level = strtoul( p, &end, 10 );
+  if( end == p || strcmp( end, ".dds" ) != 0 ) goto invalid;
+
+  if( zoom_level > MAX_ZOOM_LEVEL ) {
+    FXPO_LOG_ERROR( "fxpo_ortho_parse_dds_name(): tile zl=%lu above max_zl=%u", zoom_level, MAX_ZOOM_LEVEL );
+    return FXPOS_INVALID_STATE;
+  }
+
+  *tile = (struct fxpo_tile_t) {
+    .x               = x,
+    .y               = y,
+    .zoom_level      = (uint8_t)zoom_level,
+    .provider        = provider,
+    .chunks_per_side = DEFAULT_CHUNKS_PER_TILE_SIDE,
+  };
+
+  return FXPOS_OK;
+
+invalid:
+  FXPO_LOG_ERROR( "fxpo_ortho_parse_dds_name(): invalid name=%s", name );
+  return FXPOS_INVALID_STATE;
 }
 
 inline static void
@@ -151,6 +193,16 @@ fxpo_qstrcmp( const void * a,
   return strcmp( *(const char **)a, *(const char **)b );
 }
 
+void
+fxpo_ortho_free_tiles( struct fxpo_tile_t ** const tiles,
+                       const size_t                tile_count ) {
+
+  if( tiles == NULL ) return;
+
+  for( size_t i = 0; i < tile_count; i++ ) fxpo_free( tiles[i] );
+  fxpo_free( tiles );
+}
+
 size_t
 fxpo_ortho_find_tiles( const char *           scenery_path,
                        const char *           tileset,
@@ -160,6 +212,9 @@ fxpo_ortho_find_tiles( const char *           scenery_path,
   char ** unique_files = NULL;
   size_t  files_len    = 0;
   size_t  tile_count   = 0;
+  bool    failed       = true;
+
+  *tiles = NULL;
 
   /*
      List all .ter files in the scenery path.
@@ -181,16 +236,29 @@ fxpo_ortho_find_tiles( const char *           scenery_path,
 
   size_t files_capacity = INITIAL_CAPACITY;
   files = fxpo_malloc( files_capacity * sizeof(char *) );
+  if( files == NULL ) {
+    FindClose( h );
+    goto cleanup;
+  }
 
   do {
     if( fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) continue;
 
     if( files_len == files_capacity ) {
+      char ** const grown = fxpo_realloc( files, files_capacity * 2 * sizeof(char *) );
+      if( grown == NULL ) {
+        FindClose( h );
+        goto cleanup;
+      }
+      files           = grown;
       files_capacity *= 2;
-      files           = fxpo_realloc( files, files_capacity * sizeof(char *) );
     }
 
-    files[files_len++] = strdup( fd.cFileName );
+    if( (files[files_len] = strdup( fd.cFileName )) == NULL ) {
+      FindClose( h );
+      goto cleanup;
+    }
+    files_len++;
   } while( FindNextFile( h, &fd ) );
 
   FindClose( h );
@@ -258,7 +326,7 @@ fxpo_ortho_find_tiles( const char *           scenery_path,
 
     /* Replace ter file name with DDS file name. Assumes for every .ter there's a DDS texture. */
     free( files[i] );
-    files[i] = strdup( value );
+    if( (files[i] = strdup( value )) == NULL ) goto cleanup;
   }
 
   /*
@@ -267,7 +335,9 @@ fxpo_ortho_find_tiles( const char *           scenery_path,
 
   qsort( files, files_len, sizeof(char *), fxpo_qstrcmp );
 
-  unique_files    = fxpo_malloc( files_len * sizeof(char *) );
+  unique_files = fxpo_malloc( files_len * sizeof(char *) );
+  if( unique_files == NULL ) goto cleanup;
+
   unique_files[0] = files[0];
   size_t unique_files_len = 1;
 
@@ -284,65 +354,41 @@ fxpo_ortho_find_tiles( const char *           scenery_path,
   size_t tiles_capacity = INITIAL_CAPACITY;
 
   *tiles = fxpo_malloc( tiles_capacity * sizeof(struct fxpo_tile_t *) );
+  if( *tiles == NULL ) goto cleanup;
 
   for( ; tile_count < unique_files_len; tile_count++ ) {
-    /* Extract components from file names.
-       Example: 63568_40144_BI17.dds */
-    const char * const y  = strtok( unique_files[tile_count], "_" );
-    const char * const x  = strtok( NULL, "_" );
-    const char * const zl = strtok( NULL, "." );
-
-    uint8_t            zoom_level = 0;
-    enum fxpo_provider provider;
-
-    /* Iterate over all supported providers. */
-    for( provider = 0; provider < FXPO_PROVIDER_COUNT; provider++ ) {
-      const char * provider_str     = fxpo_provider_str( provider );
-      const size_t provider_str_len = strlen( provider_str );
-
-      if( !strncmp( zl, provider_str, provider_str_len ) ) {
-        zoom_level = (uint8_t)strtoul( zl + provider_str_len, NULL, 10 );
-
-        if( zoom_level > MAX_ZOOM_LEVEL ) {
-          FXPO_LOG_ERROR( "fxpo_ortho_find_tiles(): tile zl=%u above max_zl=%u", zoom_level, MAX_ZOOM_LEVEL );
-          goto cleanup;
-        }
-
-        break;
-      }
-    }
-
-    if( provider == FXPO_PROVIDER_COUNT ) {
-      FXPO_LOG_ERROR( "fxpo_ortho_find_tiles(): unknown provider in file=%s", fd.cFileName );
-      goto cleanup;
-    }
+    struct fxpo_tile_t parsed;
+    if( fxpo_ortho_parse_dds_name( unique_files[tile_count], &parsed ) != FXPOS_OK ) goto cleanup;
 
     if( tile_count == tiles_capacity ) {
       /* Double the capacity if the buffer needs to be expanded. */
+      struct fxpo_tile_t ** const grown = fxpo_realloc( *tiles, tiles_capacity * 2 * sizeof(struct fxpo_tile_t *) );
+      if( grown == NULL ) goto cleanup;
+      *tiles          = grown;
       tiles_capacity *= 2;
-      *tiles          = fxpo_realloc( *tiles, tiles_capacity * sizeof(struct fxpo_tile_t *) );
     }
 
     struct fxpo_tile_t * const tile = fxpo_malloc( sizeof(struct fxpo_tile_t) );
-    tile->x          = strtoul( x, NULL, 10 );
-    tile->y          = strtoul( y, NULL, 10 );
-    tile->zoom_level = zoom_level;
-    tile->provider   = provider;
+    if( tile == NULL ) goto cleanup;
+    *tile = parsed;
 
     (*tiles)[tile_count] = tile;
   }
 
+  failed = false;
+
 cleanup:
   if( files != NULL ) {
     for( size_t i = 0; i < files_len; i++ ) free( files[i] );
-    free( files );
+    fxpo_free( files );
   }
 
-  if( unique_files != NULL ) free( unique_files );
+  fxpo_free( unique_files );
 
-  if( tile_count == 0 && *tiles != NULL ) {
-    free( *tiles );
-    *tiles = NULL;
+  if( failed ) {
+    fxpo_ortho_free_tiles( *tiles, tile_count );
+    *tiles     = NULL;
+    tile_count = 0;
   }
 
   return tile_count;
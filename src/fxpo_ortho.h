@@ -3,12 +3,12 @@
 
 #include "fxpo_common.h"
 
-#define CHUNK_SIZE           256
-#define CHUNKS_PER_TILE_SIDE 16
-#define CHUNKS_PER_TILE      CHUNKS_PER_TILE_SIDE * CHUNKS_PER_TILE_SIDE
-#define TILE_WIDTH           CHUNK_SIZE * CHUNKS_PER_TILE_SIDE
-#define TILE_HEIGHT          TILE_WIDTH
-#define TILE_SIZE            TILE_WIDTH * TILE_HEIGHT
+#define CHUNK_SIZE 256
+/* Ortho4XP tiles are 16x16 chunks (4096x4096 pixels) at the zoom level in their DDS file name.
+   Textures of other sizes cover the same area with chunks from a lower or higher zoom level. */
+#define DEFAULT_CHUNKS_PER_TILE_SIDE 16
+#define MAX_CHUNKS_PER_TILE_SIDE     32
+#define MAX_CHUNKS_PER_TILE          (MAX_CHUNKS_PER_TILE_SIDE * MAX_CHUNKS_PER_TILE_SIDE)
 
 #define MAX_ZOOM_LEVEL     22
 #define MAX_QUADKEY_LENGTH MAX_ZOOM_LEVEL
@@ -25,6 +25,8 @@ struct fxpo_tile_t {
   uint32_t y;
   uint8_t  zoom_level;
   enum fxpo_provider provider;
+  /* Number of chunks along each side of the texture, see DEFAULT_CHUNKS_PER_TILE_SIDE. */
+  uint32_t chunks_per_side;
 };
 
 struct fxpo_chunk_t {
@@ -50,6 +52,13 @@ fxpo_ortho_wgs2tile( double               lat,
                      uint8_t              zoom_level,
                      struct fxpo_tile_t * tile );
 
+/* fxpo_ortho_tile_origin returns the top-left chunk of a tile given its texture size. */
+enum fxpo_status
+fxpo_ortho_tile_origin( const struct fxpo_tile_t * tile,
+                        uint32_t *                 x,
+                        uint32_t *                 y,
+                        uint8_t *                  zoom_level );
+
 void
 fxpo_ortho_downsample_chunk( struct fxpo_chunk_t * chunk );
 
@@ -64,13 +73,11 @@ fxpo_ortho_chunk_bbox( uint32_t   downsampled_chunk_x,
                        uint32_t * w,
                        uint32_t * h );
 
-/* fxpo_ortho_build_url builds an HTTP URL to fetch the image associated with a chunk. */
-enum fxpo_status
-fxpo_ortho_build_url( enum fxpo_provider          provider,
-                      const struct fxpo_chunk_t * chunk,
-                      const char *                quadkey,
-                      char *                      url,
-                      size_t                      url_len );
+/* fxpo_ortho_build_dds_name writes the file name of the texture of tile, e.g. 63568_40144_BI17.dds. */
+void
+fxpo_ortho_build_dds_name( const struct fxpo_tile_t * tile,
+                           char *                     name,
+                           size_t                     name_len );
 
 void
 fxpo_ortho_build_dds_path( const char *               scenery_path,
@@ -79,9 +86,20 @@ fxpo_ortho_build_dds_path( const char *               scenery_path,
                            char *                     path,
                            size_t                     path_len );
 
+/* fxpo_ortho_parse_dds_name parses the file name of a texture such as 63568_40144_BI17.dds into tile. */
+enum fxpo_status
+fxpo_ortho_parse_dds_name( const char *         name,
+                           struct fxpo_tile_t * tile );
+
+/* fxpo_ortho_find_tiles lists the textures referenced by the .ter files of a tileset. Returns the
+   number of tiles, 0 on failure. Release tiles with fxpo_ortho_free_tiles. */
 size_t
 fxpo_ortho_find_tiles( const char *           scenery_path,
                        const char *           tileset,
                        struct fxpo_tile_t *** tiles );
 
+void
+fxpo_ortho_free_tiles( struct fxpo_tile_t ** tiles,
+                       size_t                tile_count );
+
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "fxpo_pack.h"
+#include "fxpo_log.h"
+#include "fxpo_alloc.h"
+#include "fxpo_dedupe.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* fxpo_pack_map maps the file at path read-only. Returns NULL if it cannot be mapped or is empty. */
+static const uint8_t *
+fxpo_pack_map( struct fxpo_pack_t * const pack,
+               const char * const         path ) {
+
+#ifdef _WIN32
+  const HANDLE file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+  if( file == INVALID_HANDLE_VALUE ) return NULL;
+
+  LARGE_INTEGER size;
+  if( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 ) {
+    CloseHandle( file );
+    return NULL;
+  }
+
+  /* The mapping keeps the file open. */
+  pack->mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+  CloseHandle( file );
+  if( pack->mapping == NULL ) return NULL;
+
+  const uint8_t * const data = MapViewOfFile( pack->mapping, FILE_MAP_READ, 0, 0, 0 );
+  if( data == NULL ) {
+    CloseHandle( pack->mapping );
+    return NULL;
+  }
+
+  pack->size = (size_t)size.QuadPart;
+  return data;
+#else
+  const int fd = open( path, O_RDONLY );
+  if( fd < 0 ) return NULL;
+
+  struct stat st;
+  if( fstat( fd, &st ) != 0 || st.st_size == 0 ) {
+    close( fd );
+    return NULL;
+  }
+
+  void * const data = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  close( fd );
+  if( data == MAP_FAILED ) return NULL;
+
+  /* Every chunk of the tile is read right away. */
+  madvise( data, (size_t)st.st_size, MADV_WILLNEED );
+
+  pack->size = (size_t)st.st_size;
+  return data;
+#endif
+}
+
+void
+fxpo_pack_close( struct fxpo_pack_t * const pack ) {
+
+  if( pack->data == NULL ) return;
+
+#ifdef _WIN32
+  UnmapViewOfFile( pack->data );
+  CloseHandle( pack->mapping );
+#else
+  munmap( (void *)pack->data, pack->size );
+#endif
+
+  *pack = (struct fxpo_pack_t) { .data = NULL };
+}
+
+bool
+fxpo_pack_open( struct fxpo_pack_t * const pack,
+                const char * const         path ) {
+
+  *pack = (struct fxpo_pack_t) { .data = NULL };
+
+  const uint8_t * const data = fxpo_pack_map( pack, path );
+  if( data == NULL ) return false;
+  pack->data = data;
+
+  /* The index and every JPEG must lie within the file. */
+  const struct fxpo_pack_header_t * const header = (const struct fxpo_pack_header_t *)data;
+  bool valid = pack->size >= sizeof(struct fxpo_pack_header_t) && !memcmp( header->magic, PACK_MAGIC, PACK_MAGIC_LEN )
+               && (pack->size - sizeof(struct fxpo_pack_header_t)) / sizeof(struct fxpo_pack_entry_t) >= header->count;
+
+  if( valid ) {
+    pack->entries = (const struct fxpo_pack_entry_t *)(data + sizeof(struct fxpo_pack_header_t));
+    pack->count   = header->count;
+  }
+
+  for( uint32_t i = 0; i < pack->count && valid; i++ ) {
+    valid = pack->entries[i].offset <= pack->size && pack->entries[i].length <= pack->size - pack->entries[i].offset;
+  }
+
+  if( !valid ) {
+    FXPO_LOG_ERROR( "fxpo_pack_open(): invalid pack file=%s", path );
+    fxpo_pack_close( pack );
+    return false;
+  }
+
+  return true;
+}
+
+const struct fxpo_pack_entry_t *
+fxpo_pack_find( const struct fxpo_pack_t * const  pack,
+                const struct fxpo_chunk_t * const chunk ) {
+
+  for( uint32_t i = 0; i < pack->count; i++ ) {
+    const struct fxpo_pack_entry_t * const entry = &pack->entries[i];
+    if( entry->x == chunk->x && entry->y == chunk->y && entry->zoom_level == chunk->zoom_level ) return entry;
+  }
+
+  return NULL;
+}
+
+enum fxpo_status
+fxpo_pack_write( FILE * const                          f,
+                 const struct fxpo_chunk_t * const     chunks,
+                 const struct fxpo_http_data_t * const res,
+                 const size_t * const                  selected,
+                 const size_t                          selected_len ) {
+
+  struct fxpo_pack_entry_t * const entries = fxpo_malloc( selected_len * sizeof(struct fxpo_pack_entry_t) + 1 );
+  if( entries == NULL ) return FXPOS_OUT_OF_MEMORY;
+
+  struct fxpo_pack_header_t header = { .count = (uint32_t)selected_len };
+  memcpy( header.magic, PACK_MAGIC, PACK_MAGIC_LEN );
+
+  uint64_t offset = sizeof(struct fxpo_pack_header_t) + selected_len * sizeof(struct fxpo_pack_entry_t);
+  for( size_t k = 0; k < selected_len; k++ ) {
+    const size_t i = selected[k];
+    entries[k] = (struct fxpo_pack_entry_t) {
+      .x          = chunks[i].x,
+      .y          = chunks[i].y,
+      .zoom_level = chunks[i].zoom_level,
+      .length     = (uint32_t)res[i].size,
+      .offset     = offset,
+      .hash       = fxpo_dedupe_hash( res[i].buf, res[i].size ),
+    };
+    offset += res[i].size;
+  }
+
+  bool written = fwrite( &header, sizeof(header), 1, f ) == 1
+                 && fwrite( entries, sizeof(struct fxpo_pack_entry_t), selected_len, f ) == selected_len;
+  for( size_t k = 0; k < selected_len && written; k++ ) {
+    written = fwrite( res[selected[k]].buf, 1, res[selected[k]].size, f ) == res[selected[k]].size;
+  }
+
+  fxpo_free( entries );
+  return written ? FXPOS_OK : FXPOS_INVALID_STATE;
+}
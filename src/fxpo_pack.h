@@ -0,0 +1,66 @@
+#ifndef FXPO_PACK_H
+#define FXPO_PACK_H
+
+#include "fxpo_common.h"
+#include "fxpo_ortho.h"
+#include "fxpo_http.h"
+
+#define PACK_MAGIC     "FXPOPAK1"
+#define PACK_MAGIC_LEN 8
+
+/* fxpo_pack_header_t starts a pack file. */
+struct fxpo_pack_header_t {
+  char     magic[PACK_MAGIC_LEN];
+  uint32_t count;
+  uint32_t reserved;
+};
+
+/* fxpo_pack_entry_t locates the JPEG of a chunk in a pack file. hash is fxpo_dedupe_hash of the JPEG. */
+struct fxpo_pack_entry_t {
+  uint32_t x;
+  uint32_t y;
+  uint32_t zoom_level;
+  uint32_t length;
+  uint64_t offset;
+  uint64_t hash;
+};
+
+/* fxpo_pack_t is a pack file mapped into memory. A pack holds the chunk JPEGs of a tile in a single file:
+   a fixed header, an index of count entries, then the JPEGs back to back. Reading a tile then costs
+   one open and one mapping instead of one open per chunk, and the JPEGs are decoded from the mapping
+   without being copied. */
+struct fxpo_pack_t {
+  const uint8_t *                  data;
+  size_t                           size;
+  const struct fxpo_pack_entry_t * entries;
+  uint32_t                         count;
+#ifdef _WIN32
+  HANDLE                           mapping;
+#endif
+};
+
+/* fxpo_pack_open maps the pack at path. Returns false if it does not exist or is not a valid pack. */
+bool
+fxpo_pack_open( struct fxpo_pack_t * pack,
+                const char *         path );
+
+/* fxpo_pack_close unmaps pack. Responses borrowed from it must have been reset. Closing a pack that
+   was not opened does nothing. */
+void
+fxpo_pack_close( struct fxpo_pack_t * pack );
+
+/* fxpo_pack_find returns the entry of chunk in pack or NULL. */
+const struct fxpo_pack_entry_t *
+fxpo_pack_find( const struct fxpo_pack_t *  pack,
+                const struct fxpo_chunk_t * chunk );
+
+/* fxpo_pack_write writes a pack of the JPEGs res[i] of chunks[i] for the indices i in selected to f.
+   The file is written front to back in a single pass. */
+enum fxpo_status
+fxpo_pack_write( FILE *                          f,
+                 const struct fxpo_chunk_t *     chunks,
+                 const struct fxpo_http_data_t * res,
+                 const size_t *                  selected,
+                 size_t                          selected_len );
+
+#endif
@@ -0,0 +1,249 @@
+#include "fxpo_progress.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Stages shown in reports, workers in none of them are idle. */
+static const char * const fxpo_progress_stage_names[] = { "probe", "fetch", "assemble", "compress" };
+#define PROGRESS_STAGES_SHOWN (sizeof(fxpo_progress_stage_names) / sizeof(fxpo_progress_stage_names[0]))
+
+static bool
+fxpo_progress_is_terminal( FILE * const stream ) {
+
+#ifdef _WIN32
+  return _isatty( _fileno( stream ) ) != 0;
+#else
+  return isatty( fileno( stream ) ) != 0;
+#endif
+}
+
+void
+fxpo_progress_new( struct fxpo_progress_t * const progress,
+                   const double                   interval ) {
+
+  memset( progress, 0, sizeof(struct fxpo_progress_t) );
+  progress->tty         = fxpo_progress_is_terminal( stderr );
+  progress->interval    = interval > 0 ? interval : progress->tty ? PROGRESS_TTY_INTERVAL_S : PROGRESS_JSON_INTERVAL_S;
+  progress->start       = fxpo_time_s();
+  progress->reported_at = progress->start;
+  fxpo_mutex_new( &progress->lock );
+}
+
+void
+fxpo_progress_free( struct fxpo_progress_t * const progress ) {
+
+  fxpo_mutex_free( &progress->lock );
+}
+
+void
+fxpo_progress_expect( struct fxpo_progress_t * const   progress,
+                      const struct fxpo_tile_t * const tile ) {
+
+  if( tile->zoom_level > MAX_ZOOM_LEVEL ) return;
+
+  fxpo_mutex_lock( &progress->lock );
+  progress->expected[tile->zoom_level]++;
+  fxpo_mutex_unlock( &progress->lock );
+}
+
+/* fxpo_progress_find returns the entry of started holding id or PROGRESS_MAX_STARTED. Must hold the lock. */
+static size_t
+fxpo_progress_find( const struct fxpo_progress_t * const progress,
+                    const uint64_t                       id ) {
+
+  size_t i = 0;
+  while( i < PROGRESS_MAX_STARTED && progress->started[i].id != id ) i++;
+  return i;
+}
+
+void
+fxpo_progress_on_stage( const uint64_t        id,
+                        const enum fxpo_stage stage,
+                        void * const          user ) {
+
+  struct fxpo_progress_t * const progress = user;
+  (void)stage;
+
+  /* The first stage of a tile starts its clock. Tiles beyond the table are counted without being timed. */
+  fxpo_mutex_lock( &progress->lock );
+  if( fxpo_progress_find( progress, id ) == PROGRESS_MAX_STARTED ) {
+    const size_t i = fxpo_progress_find( progress, 0 );
+    if( i < PROGRESS_MAX_STARTED ) {
+      progress->started[i].id    = id;
+      progress->started[i].start = fxpo_time_s();
+    }
+  }
+  fxpo_mutex_unlock( &progress->lock );
+}
+
+void
+fxpo_progress_on_done( struct fxpo_progress_t * const     progress,
+                       const struct fxpo_result_t * const result ) {
+
+  const double now = fxpo_time_s();
+
+  const char * name = strrchr( result->dds_path, '/' );
+  name = name != NULL ? name + 1 : result->dds_path;
+
+  struct fxpo_tile_t tile;
+  const bool         parsed = fxpo_ortho_parse_dds_name( name, &tile ) == FXPOS_OK && tile.zoom_level <= MAX_ZOOM_LEVEL;
+
+  fxpo_mutex_lock( &progress->lock );
+  progress->done++;
+  if( result->status != FXPOS_OK && result->status != FXPOS_CANCELLED ) progress->failed++;
+  if( parsed ) progress->finished[tile.zoom_level]++;
+
+  const size_t i = fxpo_progress_find( progress, result->id );
+  if( i < PROGRESS_MAX_STARTED ) {
+    const double seconds = now - progress->started[i].start;
+    progress->started[i].id = 0;
+
+    /* Only complete tiles tell what a tile costs. */
+    if( parsed && result->status == FXPOS_OK ) {
+      double * const cost = &progress->cost[tile.zoom_level];
+      *cost = *cost > 0 ? *cost + PROGRESS_COST_WEIGHT * (seconds - *cost) : seconds;
+      progress->work += seconds;
+      progress->timed++;
+    }
+  }
+  fxpo_mutex_unlock( &progress->lock );
+}
+
+/* fxpo_progress_work_left returns the worker seconds the tiles not yet done of count are expected to
+   take, or a negative value if no tile was timed yet. Must hold the lock. */
+static double
+fxpo_progress_work_left( const struct fxpo_progress_t * const progress,
+                         const size_t                         count ) {
+
+  if( progress->timed == 0 ) return -1.0;
+
+  const double average = progress->work / (double)progress->timed;
+
+  double work     = 0.0;
+  size_t expected = 0;
+  for( size_t z = 0; z <= MAX_ZOOM_LEVEL; z++ ) {
+    if( progress->expected[z] <= progress->finished[z] ) continue;
+
+    const size_t left = progress->expected[z] - progress->finished[z];
+    work     += (double)left * (progress->cost[z] > 0 ? progress->cost[z] : average);
+    expected += left;
+  }
+
+  /* Tiles that were not expected, or whose zoom level is unknown. */
+  const size_t left = count > progress->done ? count - progress->done : 0;
+  if( left > expected ) work += (double)(left - expected) * average;
+
+  return work;
+}
+
+/* fxpo_progress_format_duration writes seconds as e.g. 1h05m or 4m30s into buf. */
+static void
+fxpo_progress_format_duration( const double seconds,
+                               char * const buf,
+                               const size_t buf_len ) {
+
+  const unsigned long s = (unsigned long)(seconds + 0.5);
+  if( s >= 3600 ) snprintf( buf, buf_len, "%luh%02lum", s / 3600, s / 60 % 60 );
+  else snprintf( buf, buf_len, "%lum%02lus", s / 60, s % 60 );
+}
+
+static void
+fxpo_progress_report( struct fxpo_progress_t * const progress,
+                      struct fxpo_context_t * const  ctx,
+                      const size_t                   count,
+                      const bool                     last ) {
+
+  const double now = fxpo_time_s();
+
+  struct fxpo_stats_t stats;
+  fxpo_context_stats( ctx, &stats );
+
+  fxpo_mutex_lock( &progress->lock );
+  const size_t done      = progress->done;
+  const size_t failed    = progress->failed;
+  const double work      = progress->work;
+  const double work_left = fxpo_progress_work_left( progress, count );
+  fxpo_mutex_unlock( &progress->lock );
+
+  /* Rolling rates over PROGRESS_RATE_WINDOW_S. Until a window has passed, every second weighs the same. */
+  const double elapsed = now - progress->start;
+  const double dt      = now - progress->reported_at;
+  if( dt > 0 ) {
+    double weight = 1.0 - exp( -dt / PROGRESS_RATE_WINDOW_S );
+    if( dt / elapsed > weight ) weight = dt / elapsed;
+
+    const double chunks = (double)(stats.chunks_fetched - progress->reported_stats.chunks_fetched);
+    const double bytes  = (double)(stats.bytes_downloaded - progress->reported_stats.bytes_downloaded);
+    progress->work_rate  += weight * ((work - progress->reported_work) / dt - progress->work_rate);
+    progress->chunk_rate += weight * (chunks / dt - progress->chunk_rate);
+    progress->byte_rate  += weight * (bytes / dt - progress->byte_rate);
+  }
+  progress->reported_at    = now;
+  progress->reported_work  = work;
+  progress->reported_stats = stats;
+
+  const double eta = done >= count ? 0.0 : work_left >= 0 && progress->work_rate > 0 ? work_left / progress->work_rate : -1.0;
+
+  size_t idle = stats.workers;
+  for( size_t s = 0; s < PROGRESS_STAGES_SHOWN; s++ ) idle -= stats.workers_by_stage[s];
+
+  if( progress->tty ) {
+    char eta_str[32] = "--";
+    if( last ) fxpo_progress_format_duration( elapsed, eta_str, sizeof(eta_str) );
+    else if( eta >= 0 ) fxpo_progress_format_duration( eta, eta_str, sizeof(eta_str) );
+
+    char line[256];
+    int  len = snprintf( line, sizeof(line), "%zu/%zu tiles %.0f%%", done, count, count > 0 ? 100.0 * (double)done / (double)count : 100.0 );
+    if( failed > 0 ) len += snprintf( line + len, sizeof(line) - (size_t)len, " (%zu failed)", failed );
+    len += snprintf( line + len, sizeof(line) - (size_t)len, " | %.0f chunks/s %.1f MB/s |", progress->chunk_rate, progress->byte_rate / 1e6 );
+    for( size_t s = 0; s < PROGRESS_STAGES_SHOWN; s++ ) {
+      len += snprintf( line + len, sizeof(line) - (size_t)len, " %s %zu", fxpo_progress_stage_names[s], stats.workers_by_stage[s] );
+    }
+    len += snprintf( line + len, sizeof(line) - (size_t)len, " idle %zu | %s %s", idle, last ? "took" : "ETA", eta_str );
+
+    /* The cursor is left at the start of the line so that log messages replace it until the next report. */
+    fprintf( stderr, "%-*s%s", progress->line_len, line, last ? "\n" : "\r" );
+    fflush( stderr );
+    progress->line_len = len;
+    return;
+  }
+
+  const double workers = stats.workers > 0 ? (double)stats.workers : 1.0;
+
+  char eta_str[32] = "null";
+  if( eta >= 0 ) snprintf( eta_str, sizeof(eta_str), "%.0f", eta );
+
+  char utilisation[192];
+  int  len = 0;
+  for( size_t s = 0; s < PROGRESS_STAGES_SHOWN; s++ ) {
+    len += snprintf( utilisation + len, sizeof(utilisation) - (size_t)len, "\"%s\":%.2f,", fxpo_progress_stage_names[s], (double)stats.workers_by_stage[s] / workers );
+  }
+  snprintf( utilisation + len, sizeof(utilisation) - (size_t)len, "\"idle\":%.2f", (double)idle / workers );
+
+  fprintf( stderr, "{\"progress\":{\"elapsed\":%.1f,\"done\":%zu,\"failed\":%zu,\"total\":%zu,\"chunks_per_second\":%.1f,"
+                   "\"bytes_per_second\":%.0f,\"workers\":%zu,\"utilisation\":{%s},\"eta\":%s,\"last\":%s}}\n",
+           elapsed, done, failed, count, progress->chunk_rate, progress->byte_rate, stats.workers, utilisation, eta_str,
+           last ? "true" : "false" );
+  fflush( stderr );
+}
+
+void
+fxpo_progress_run( struct fxpo_progress_t * const progress,
+                   struct fxpo_context_t * const  ctx,
+                   const size_t                   count ) {
+
+  for( ;; ) {
+    fxpo_mutex_lock( &progress->lock );
+    const bool complete = progress->done >= count;
+    fxpo_mutex_unlock( &progress->lock );
+    if( complete ) break;
+
+    fxpo_sleep_ms( PROGRESS_POLL_MS );
+    if( fxpo_time_s() - progress->reported_at >= progress->interval ) fxpo_progress_report( progress, ctx, count, false );
+  }
+
+  fxpo_progress_report( progress, ctx, count, true );
+}
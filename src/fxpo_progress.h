@@ -0,0 +1,93 @@
+#ifndef FXPO_PROGRESS_H
+#define FXPO_PROGRESS_H
+
+#include "fxpo_common.h"
+#include "fxpo_thread.h"
+#include "fxpo_ortho.h"
+
+/* Seconds between reports on a terminal and otherwise, see fxpo_progress_new. */
+#define PROGRESS_TTY_INTERVAL_S  1.0
+#define PROGRESS_JSON_INTERVAL_S 10.0
+/* Milliseconds between checks for finished tiles while waiting for the next report. */
+#define PROGRESS_POLL_MS         100
+/* Seconds of history weighing the rolling rates, older intervals fade out exponentially. */
+#define PROGRESS_RATE_WINDOW_S   30.0
+/* Weight of the last tile in the rolling cost of its zoom level. */
+#define PROGRESS_COST_WEIGHT     0.1
+/* Tiles timed at once, more than the workers of any context. */
+#define PROGRESS_MAX_STARTED     256
+
+/* fxpo_progress_t reports the tiles done, the chunk and byte rates, what the workers are busy with and
+   an estimate of the time left while a batch of tiles is built. The estimate divides the work left, the
+   tiles remaining at each zoom level times the rolling time a worker took for one of them, by the
+   rolling rate at which work was done. Tiles of different zoom levels cost very different amounts of
+   work, so counting tiles alone would be off whenever the mix changes. */
+struct fxpo_progress_t {
+  /* Redraw a single line on a terminal, otherwise write a JSON object per line to stderr. */
+  bool   tty;
+  double interval;
+  double start;
+
+  /* Tiles expected of each zoom level, see fxpo_progress_expect, and those finished. */
+  size_t expected[MAX_ZOOM_LEVEL + 1];
+  size_t finished[MAX_ZOOM_LEVEL + 1];
+  /* Tiles finished whatever their status, and of them those that failed. */
+  size_t done;
+  size_t failed;
+  /* Rolling seconds a worker spends on a tile of each zoom level, 0 until one is timed. */
+  double cost[MAX_ZOOM_LEVEL + 1];
+  /* Worker seconds of every tile timed so far. */
+  double work;
+  size_t timed;
+  /* Start of the tiles being built by request id. Free entries have id 0. */
+  struct {
+    uint64_t id;
+    double   start;
+  } started[PROGRESS_MAX_STARTED];
+  struct fxpo_mutex_t lock;
+
+  /* State of the last report, only used by the thread calling fxpo_progress_run. */
+  double              reported_at;
+  double              reported_work;
+  struct fxpo_stats_t reported_stats;
+  /* Rolling worker seconds, chunks and bytes done per second. */
+  double              work_rate;
+  double              chunk_rate;
+  double              byte_rate;
+  /* Length of the line drawn on the terminal, to blank out what a shorter line leaves. */
+  int                 line_len;
+};
+
+/* fxpo_progress_new prepares progress for a batch. Reports go to the terminal if stderr is one, every
+   interval seconds or PROGRESS_TTY_INTERVAL_S or PROGRESS_JSON_INTERVAL_S if interval is 0. */
+void
+fxpo_progress_new( struct fxpo_progress_t * progress,
+                   double                   interval );
+
+void
+fxpo_progress_free( struct fxpo_progress_t * progress );
+
+/* fxpo_progress_expect weighs the estimate with tile, one of the tiles of the batch. Tiles not expected
+   are counted but cost the average of those that are. */
+void
+fxpo_progress_expect( struct fxpo_progress_t *   progress,
+                      const struct fxpo_tile_t * tile );
+
+/* fxpo_progress_on_stage is the fxpo_config_t.progress callback timing tiles, with progress as user. */
+void
+fxpo_progress_on_stage( uint64_t        id,
+                        enum fxpo_stage stage,
+                        void *          user );
+
+/* fxpo_progress_on_done counts the tile of result, to be called from its done callback. */
+void
+fxpo_progress_on_done( struct fxpo_progress_t *     progress,
+                       const struct fxpo_result_t * result );
+
+/* fxpo_progress_run reports the progress of ctx until count tiles are done, then writes a final report. */
+void
+fxpo_progress_run( struct fxpo_progress_t * progress,
+                   struct fxpo_context_t *  ctx,
+                   size_t                   count );
+
+#endif
@@ -0,0 +1,223 @@
+#include "fxpo_provider.h"
+#include "fxpo_log.h"
+
+#define BI_CACHE_VARIANT_1 "14041" /* Latest. */
+#define BI_CACHE_VARIANT_2 "13816" /* Seems older, more green in UK. */
+
+static struct fxpo_provider_t FXPO_PROVIDERS[FXPO_PROVIDER_COUNT] = {
+  [FXPO_PROVIDER_BI] = {
+    .name = "BI",
+    /* Use unencrypted HTTP endpoint to save time on TLS handshake. */
+    .url_template   = "http://{host}/tiles/a{quadkey}.jpeg?g=" BI_CACHE_VARIANT_1,
+    .hosts          = { "ecn.t1.tiles.virtualearth.net", "ecn.t2.tiles.virtualearth.net",
+                        "ecn.t3.tiles.virtualearth.net", "ecn.t4.tiles.virtualearth.net" },
+    .no_tile_header = "X-VE-Tile-Info: no-tile",
+    .max_zoom_level = 20,
+    .policy         = { .max_concurrent = 0, .http_version = CURL_HTTP_VERSION_1_1 },
+  },
+  [FXPO_PROVIDER_ARC] = {
+    .name           = "ARC",
+    .url_template   = "https://{host}/ArcGIS/rest/services/World_Imagery/MapServer/tile/{z}/{y}/{x}",
+    .hosts          = { "services.arcgisonline.com" },
+    /* FIXME (@bcsongor, 2023-11-29) Is there a more reliable way to check if Arc has an image for the given chunk? */
+    .no_tile_header = "Etag: vvvvvvvvvvvvf",
+    .max_zoom_level = 19,
+    .policy         = { .max_concurrent = 0, .http_version = CURL_HTTP_VERSION_1_1 },
+  },
+};
+
+static enum fxpo_status
+fxpo_provider_compile( struct fxpo_provider_t * const provider ) {
+
+  static const struct {
+    const char *        name;
+    enum fxpo_url_field field;
+  } placeholders[] = {
+    { "{host}",    FXPO_URL_FIELD_HOST },
+    { "{quadkey}", FXPO_URL_FIELD_QUADKEY },
+    { "{x}",       FXPO_URL_FIELD_X },
+    { "{y}",       FXPO_URL_FIELD_Y },
+    { "{z}",       FXPO_URL_FIELD_ZOOM_LEVEL },
+  };
+
+  for( provider->hosts_len = 0; provider->hosts_len < MAX_PROVIDER_HOSTS && provider->hosts[provider->hosts_len] != NULL; provider->hosts_len++ );
+
+  provider->segments_len = 0;
+
+  const char * p = provider->url_template;
+  while( *p != '\0' ) {
+    if( provider->segments_len == MAX_URL_TEMPLATE_SEGMENTS ) {
+      FXPO_LOG_ERROR( "fxpo_provider_compile(): too many segments in url_template=%s", provider->url_template );
+      return FXPOS_INVALID_STATE;
+    }
+
+    struct fxpo_url_segment_t * const segment = &provider->segments[provider->segments_len++];
+
+    size_t i;
+    for( i = 0; i < sizeof(placeholders) / sizeof(placeholders[0]); i++ ) {
+      const size_t len = strlen( placeholders[i].name );
+      if( !strncmp( p, placeholders[i].name, len ) ) {
+        *segment = (struct fxpo_url_segment_t) { .field = placeholders[i].field };
+        p       += len;
+        break;
+      }
+    }
+
+    if( i < sizeof(placeholders) / sizeof(placeholders[0]) ) continue;
+
+    /* Literal text runs until the next placeholder. */
+    const size_t len = strcspn( p + 1, "{" ) + 1;
+    *segment = (struct fxpo_url_segment_t) { .field = FXPO_URL_FIELD_LITERAL, .literal = p, .literal_len = len };
+    p       += len;
+  }
+
+  if( provider->hosts_len == 0 ) {
+    FXPO_LOG_ERROR( "fxpo_provider_compile(): provider=%s has no hosts", provider->name );
+    return FXPOS_INVALID_STATE;
+  }
+
+  return FXPOS_OK;
+}
+
+enum fxpo_status
+fxpo_provider_init() {
+
+  for( enum fxpo_provider p = 0; p < FXPO_PROVIDER_COUNT; p++ ) {
+    FXPO_PROVIDERS[p].id = p;
+    const enum fxpo_status status = fxpo_provider_compile( &FXPO_PROVIDERS[p] );
+    if( status != FXPOS_OK ) return status;
+  }
+
+  return FXPOS_OK;
+}
+
+const struct fxpo_provider_t *
+fxpo_provider_get( const enum fxpo_provider provider ) {
+
+  return &FXPO_PROVIDERS[provider];
+}
+
+bool
+fxpo_provider_from_prefix( const char * const         str,
+                           enum fxpo_provider * const provider,
+                           size_t * const             name_len ) {
+
+  for( enum fxpo_provider p = 0; p < FXPO_PROVIDER_COUNT; p++ ) {
+    const size_t len = strlen( FXPO_PROVIDERS[p].name );
+
+    if( !strncmp( str, FXPO_PROVIDERS[p].name, len ) ) {
+      *provider = p;
+      *name_len = len;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* fxpo_url_append_uint writes value in decimal to url and returns the number of characters written. */
+static inline size_t
+fxpo_url_append_uint( char * const url,
+                      uint32_t     value ) {
+
+  char   digits[10];
+  size_t len = 0;
+
+  do {
+    digits[len++] = (char)('0' + value % 10);
+    value        /= 10;
+  } while( value > 0 );
+
+  for( size_t i = 0; i < len; i++ ) url[i] = digits[len - i - 1];
+  return len;
+}
+
+enum fxpo_status
+fxpo_provider_build_url( const struct fxpo_provider_t * const provider,
+                         const struct fxpo_chunk_t * const    chunk,
+                         char * const                         url,
+                         const size_t                         url_len ) {
+
+  /* Longest field is a quadkey of MAX_QUADKEY_LENGTH characters. */
+  char   buf[MAX_URL_LENGTH + MAX_QUADKEY_LENGTH];
+  size_t len = 0;
+
+  for( size_t i = 0; i < provider->segments_len; i++ ) {
+    const struct fxpo_url_segment_t * const segment = &provider->segments[i];
+
+    if( len + MAX_QUADKEY_LENGTH >= MAX_URL_LENGTH ) {
+      FXPO_LOG_ERROR( "fxpo_provider_build_url(): url too long for provider=%s", provider->name );
+      return FXPOS_INVALID_STATE;
+    }
+
+    switch( segment->field ) {
+      case FXPO_URL_FIELD_LITERAL:
+        if( len + segment->literal_len >= MAX_URL_LENGTH ) {
+          FXPO_LOG_ERROR( "fxpo_provider_build_url(): url too long for provider=%s", provider->name );
+          return FXPOS_INVALID_STATE;
+        }
+        memcpy( &buf[len], segment->literal, segment->literal_len );
+        len += segment->literal_len;
+        break;
+
+      case FXPO_URL_FIELD_HOST: {
+        /* The host is chosen when the request is sent, see fxpo_http_policy_t.select_host. */
+        const char * const host = provider->hosts[0];
+
+        const size_t host_len = strlen( host );
+        if( len + host_len >= MAX_URL_LENGTH ) {
+          FXPO_LOG_ERROR( "fxpo_provider_build_url(): url too long for provider=%s", provider->name );
+          return FXPOS_INVALID_STATE;
+        }
+        memcpy( &buf[len], host, host_len );
+        len += host_len;
+        break;
+      }
+
+      case FXPO_URL_FIELD_QUADKEY:
+        fxpo_ortho_tile2quadkey( chunk->x, chunk->y, chunk->zoom_level, &buf[len] );
+        len += chunk->zoom_level;
+        break;
+
+      case FXPO_URL_FIELD_X:          len += fxpo_url_append_uint( &buf[len], chunk->x ); break;
+      case FXPO_URL_FIELD_Y:          len += fxpo_url_append_uint( &buf[len], chunk->y ); break;
+      case FXPO_URL_FIELD_ZOOM_LEVEL: len += fxpo_url_append_uint( &buf[len], chunk->zoom_level ); break;
+    }
+  }
+
+  if( len >= url_len ) {
+    FXPO_LOG_ERROR( "fxpo_provider_build_url(): url too long for provider=%s", provider->name );
+    return FXPOS_INVALID_STATE;
+  }
+
+  memcpy( url, buf, len );
+  url[len] = '\0';
+
+  return FXPOS_OK;
+}
+
+enum fxpo_status
+fxpo_provider_build_host_url( const struct fxpo_provider_t * const provider,
+                              const size_t                         host,
+                              char * const                         url,
+                              const size_t                         url_len ) {
+
+  /* Templates start with the scheme and the host, e.g. http://{host}/tiles/... */
+  const char * const field = strstr( provider->url_template, "{host}" );
+  if( field == NULL || host >= provider->hosts_len ) return FXPOS_INVALID_STATE;
+
+  const int len = snprintf( url, url_len, "%.*s%s/", (int)(field - provider->url_template), provider->url_template, provider->hosts[host] );
+  if( len < 0 || (size_t)len >= url_len ) {
+    FXPO_LOG_ERROR( "fxpo_provider_build_host_url(): url too long for provider=%s", provider->name );
+    return FXPOS_INVALID_STATE;
+  }
+
+  return FXPOS_OK;
+}
+
+bool
+fxpo_provider_is_no_tile( const struct fxpo_provider_t * const  provider,
+                          const struct fxpo_http_data_t * const headers ) {
+
+  return provider->no_tile_header != NULL && headers->size > 0 && strstr( (const char *)headers->buf, provider->no_tile_header ) != NULL;
+}
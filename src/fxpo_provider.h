@@ -0,0 +1,87 @@
+#ifndef FXPO_PROVIDER_H
+#define FXPO_PROVIDER_H
+
+#include "fxpo_common.h"
+#include "fxpo_ortho.h"
+#include "fxpo_http.h"
+
+#define MAX_PROVIDER_HOSTS        8
+#define MAX_URL_TEMPLATE_SEGMENTS 16
+
+enum fxpo_url_field {
+  FXPO_URL_FIELD_LITERAL,
+  FXPO_URL_FIELD_HOST,
+  FXPO_URL_FIELD_QUADKEY,
+  FXPO_URL_FIELD_X,
+  FXPO_URL_FIELD_Y,
+  FXPO_URL_FIELD_ZOOM_LEVEL,
+};
+
+/* fxpo_url_segment_t is a piece of a compiled URL template, either literal text or a chunk field. */
+struct fxpo_url_segment_t {
+  enum fxpo_url_field field;
+  const char *        literal;
+  size_t              literal_len;
+};
+
+/* fxpo_provider_t describes an imagery provider. Adding a provider only takes a new entry in the
+   registry in fxpo_provider.c and a value in enum fxpo_provider. */
+struct fxpo_provider_t {
+  /* Name used in DDS file names, e.g. BI in 63568_40144_BI17.dds. */
+  const char * name;
+  /* URL of a chunk with {host}, {quadkey}, {x}, {y} and {z} placeholders. */
+  const char * url_template;
+  /* Hosts requests are spread across by latency, substituted for {host}. */
+  const char * hosts[MAX_PROVIDER_HOSTS];
+  /* Header present in the response to a HEAD request if the provider has no image for a chunk. */
+  const char * no_tile_header;
+  /* Highest zoom level with imagery. Chunks above it are upsampled from this level. */
+  uint8_t max_zoom_level;
+  /* Concurrency and protocol used when fetching chunks. */
+  struct fxpo_http_policy_t policy;
+  /* Default rate limits of all requests to the provider and of the requests to each host, shared by every
+     worker of a context. Unlimited if left 0, see fxpo_config_t for overriding the provider-wide limits. */
+  struct fxpo_http_rate_config_t rate;
+  struct fxpo_http_rate_config_t host_rate;
+
+  /* Filled by fxpo_provider_init. */
+  enum fxpo_provider        id;
+  size_t                    hosts_len;
+  struct fxpo_url_segment_t segments[MAX_URL_TEMPLATE_SEGMENTS];
+  size_t                    segments_len;
+};
+
+/* fxpo_provider_init compiles the URL templates of every registered provider. */
+enum fxpo_status
+fxpo_provider_init();
+
+/* fxpo_provider_get returns the registry entry of provider. */
+const struct fxpo_provider_t *
+fxpo_provider_get( enum fxpo_provider provider );
+
+/* fxpo_provider_from_prefix finds the provider whose name prefixes str, e.g. "BI17" is BI. */
+bool
+fxpo_provider_from_prefix( const char *         str,
+                           enum fxpo_provider * provider,
+                           size_t *             name_len );
+
+/* fxpo_provider_build_url builds the HTTP URL to fetch the image of a chunk. */
+enum fxpo_status
+fxpo_provider_build_url( const struct fxpo_provider_t * provider,
+                         const struct fxpo_chunk_t *    chunk,
+                         char *                         url,
+                         size_t                         url_len );
+
+/* fxpo_provider_build_host_url builds the URL of the root of host, e.g. to open a connection ahead of fetching chunks. */
+enum fxpo_status
+fxpo_provider_build_host_url( const struct fxpo_provider_t * provider,
+                              size_t                         host,
+                              char *                         url,
+                              size_t                         url_len );
+
+/* fxpo_provider_is_no_tile checks the headers of a HEAD response for the provider's missing chunk marker. */
+bool
+fxpo_provider_is_no_tile( const struct fxpo_provider_t *  provider,
+                          const struct fxpo_http_data_t * headers );
+
+#endif
@@ -0,0 +1,316 @@
+#include "fxpo_resize.h"
+#include "fxpo_log.h"
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+
+/* GCC and Clang enable FMA separately from AVX2, MSVC's /arch:AVX2 implies it. */
+#if defined(__FMA__) || defined(_MSC_VER)
+#define RESIZE_MADD128( a, b, c ) _mm_fmadd_ps( a, b, c )
+#define RESIZE_MADD256( a, b, c ) _mm256_fmadd_ps( a, b, c )
+#else
+#define RESIZE_MADD128( a, b, c ) _mm_add_ps( _mm_mul_ps( a, b ), c )
+#define RESIZE_MADD256( a, b, c ) _mm256_add_ps( _mm256_mul_ps( a, b ), c )
+#endif
+#endif
+
+static const char * const FXPO_RESIZE_FILTER_STR[] = {
+  "box",
+  "triangle",
+  "cubicbspline",
+  "catmullrom",
+  "mitchell",
+};
+
+/* Kernels are read-only once built and shared by all threads. Index is the log2 of the scale. */
+static struct fxpo_resize_kernel_t fxpo_resize_kernels[FXPO_RESIZE_FILTER_COUNT][RESIZE_MAX_SCALE_LOG2 + 1];
+
+static float
+fxpo_resize_filter_weight( const enum fxpo_resize_filter filter,
+                           float                         x ) {
+
+  x = fabsf( x );
+
+  switch( filter ) {
+    case FXPO_RESIZE_FILTER_BOX:
+      return x < 0.5f ? 1.0f : 0.0f;
+
+    case FXPO_RESIZE_FILTER_TRIANGLE:
+      return x <= 1.0f ? 1.0f - x : 0.0f;
+
+    case FXPO_RESIZE_FILTER_CUBICBSPLINE:
+      if( x < 1.0f ) return 2.0f/3.0f + x*x*(0.5f*x - 1.0f);
+      if( x < 2.0f ) return (2.0f - x)*(2.0f - x)*(2.0f - x) / 6.0f;
+      return 0.0f;
+
+    case FXPO_RESIZE_FILTER_CATMULLROM:
+      if( x < 1.0f ) return 1.0f - x*x*(2.5f - 1.5f*x);
+      if( x < 2.0f ) return 2.0f - x*(4.0f + x*(0.5f*x - 2.5f));
+      return 0.0f;
+
+    case FXPO_RESIZE_FILTER_MITCHELL:
+      if( x < 1.0f ) return (16.0f + x*x*(21.0f*x - 36.0f)) / 18.0f;
+      if( x < 2.0f ) return (32.0f + x*(-60.0f + x*(36.0f - 7.0f*x))) / 18.0f;
+      return 0.0f;
+
+    default:
+      return 0.0f;
+  }
+}
+
+static void
+fxpo_resize_kernel_build( struct fxpo_resize_kernel_t * const kernel,
+                          const uint8_t                       scale_log2,
+                          const enum fxpo_resize_filter       filter ) {
+
+  const uint32_t scale    = 1u << scale_log2;
+  const int32_t  src_size = CHUNK_SIZE / (int32_t)scale;
+
+  kernel->src_size = (uint32_t)src_size;
+
+  for( int32_t o = 0; o < CHUNK_SIZE; o++ ) {
+    /* Centre of the output pixel in source pixel coordinates. */
+    const float   centre = ((float)o + 0.5f) / (float)scale - 0.5f;
+    const int32_t first  = (int32_t)floorf( centre ) - 1;
+    float         sum    = 0.0f;
+
+    for( int32_t t = 0; t < RESIZE_TAPS; t++ ) {
+      const int32_t src = first + t;
+      const float   w   = fxpo_resize_filter_weight( filter, centre - (float)src );
+
+      kernel->taps[o][t]    = (int16_t)src;
+      kernel->weights[o][t] = w;
+      sum                  += w;
+    }
+
+    /* Normalise so flat areas stay flat regardless of filter and phase. */
+    for( int32_t t = 0; t < RESIZE_TAPS; t++ ) kernel->weights[o][t] /= sum;
+  }
+}
+
+void
+fxpo_resize_init() {
+
+  for( enum fxpo_resize_filter filter = 0; filter < FXPO_RESIZE_FILTER_COUNT; filter++ ) {
+    for( uint8_t scale_log2 = 1; scale_log2 <= RESIZE_MAX_SCALE_LOG2; scale_log2++ ) {
+      fxpo_resize_kernel_build( &fxpo_resize_kernels[filter][scale_log2], scale_log2, filter );
+    }
+  }
+}
+
+enum fxpo_status
+fxpo_resize_filter_from_str( const char * const              str,
+                             enum fxpo_resize_filter * const filter ) {
+
+  for( enum fxpo_resize_filter f = 0; f < FXPO_RESIZE_FILTER_COUNT; f++ ) {
+    if( !strcmp( str, FXPO_RESIZE_FILTER_STR[f] ) ) {
+      *filter = f;
+      return FXPOS_OK;
+    }
+  }
+
+  FXPO_LOG_ERROR( "fxpo_resize_filter_from_str(): unknown filter=%s", str );
+  return FXPOS_INVALID_STATE;
+}
+
+static inline int32_t
+fxpo_resize_clamp( const int32_t value,
+                   const int32_t max ) {
+
+  return value < 0 ? 0 : value > max ? max : value;
+}
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+/* fxpo_resize_widen converts a pixel to float lanes. BGR pixels are widened to 4 lanes, the last one is
+   left out of the output. */
+static inline __m128
+fxpo_resize_widen( const uint8_t * const pixel ) {
+
+  int32_t bits = 0;
+  memcpy( &bits, pixel, PIXEL_CHANNELS );
+
+  return _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( bits ) ) );
+}
+#endif
+
+/* Horizontal pass: upsamples the crop of a source row starting at crop_x to CHUNK_SIZE pixels of float channels.
+   Output pixel o = q * scale + p has the weights of phase p and the taps of phase p shifted by q source
+   pixels, which fall within source pixels q - 2 to q + 2. Those are kept in a window sliding along the
+   row so that each source pixel is converted once rather than for every tap of every output pixel. */
+static inline void
+fxpo_resize_horizontal( const struct fxpo_resize_kernel_t * const kernel,
+                        const uint8_t * const                     src,
+                        const int32_t                             src_width,
+                        const int32_t                             crop_x,
+                        float * const                             dst ) {
+
+  const uint32_t scale = CHUNK_SIZE / kernel->src_size;
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+  __m128 window[RESIZE_TAPS + 1];
+  for( int32_t k = 0; k < RESIZE_TAPS + 1; k++ ) window[k] = fxpo_resize_widen( &src[fxpo_resize_clamp( crop_x - 2 + k, src_width - 1 )*PIXEL_CHANNELS] );
+#else
+  float window[RESIZE_TAPS + 1][PIXEL_CHANNELS];
+  for( int32_t k = 0; k < RESIZE_TAPS + 1; k++ ) {
+    const uint8_t * const pixel = &src[fxpo_resize_clamp( crop_x - 2 + k, src_width - 1 )*PIXEL_CHANNELS];
+    for( uint32_t c = 0; c < PIXEL_CHANNELS; c++ ) window[k][c] = (float)pixel[c];
+  }
+#endif
+
+  for( uint32_t q = 0; q < kernel->src_size; q++ ) {
+    if( q > 0 ) {
+      const uint8_t * const pixel = &src[fxpo_resize_clamp( crop_x + (int32_t)q + 2, src_width - 1 )*PIXEL_CHANNELS];
+      memmove( &window[0], &window[1], RESIZE_TAPS * sizeof(window[0]) );
+#if defined(__AVX2__) || defined(__AVX512F__)
+      window[RESIZE_TAPS] = fxpo_resize_widen( pixel );
+#else
+      for( uint32_t c = 0; c < PIXEL_CHANNELS; c++ ) window[RESIZE_TAPS][c] = (float)pixel[c];
+#endif
+    }
+
+    for( uint32_t p = 0; p < scale; p++ ) {
+      const float * const weights = kernel->weights[p];
+      /* The first tap of a phase is 2 or 1 pixels left of source pixel q. */
+      const uint32_t      first   = (uint32_t)(kernel->taps[p][0] + 2);
+      float * const       out     = &dst[(q*scale + p)*PIXEL_CHANNELS];
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+      __m128 acc = _mm_setzero_ps();
+      for( uint32_t t = 0; t < RESIZE_TAPS; t++ ) acc = RESIZE_MADD128( window[first + t], _mm_set1_ps( weights[t] ), acc );
+
+      float lanes[4];
+      _mm_storeu_ps( lanes, acc );
+      memcpy( out, lanes, PIXEL_CHANNELS * sizeof(float) );
+#else
+      for( uint32_t c = 0; c < PIXEL_CHANNELS; c++ ) {
+        float acc = 0.0f;
+        for( uint32_t t = 0; t < RESIZE_TAPS; t++ ) acc += weights[t] * window[first + t][c];
+        out[c] = acc;
+      }
+#endif
+    }
+  }
+}
+
+/* Vertical pass: blends RESIZE_TAPS horizontally upsampled rows into an 8-bit output row. */
+static inline void
+fxpo_resize_vertical( const float * const rows[RESIZE_TAPS],
+                      const float * const weights,
+                      uint8_t * const     dst ) {
+
+  const uint32_t len = CHUNK_SIZE * PIXEL_CHANNELS;
+  uint32_t       i   = 0;
+
+#if defined(__AVX512F__)
+  const __m512 w0 = _mm512_set1_ps( weights[0] ), w1 = _mm512_set1_ps( weights[1] );
+  const __m512 w2 = _mm512_set1_ps( weights[2] ), w3 = _mm512_set1_ps( weights[3] );
+  const __m512i zero = _mm512_setzero_si512();
+
+  for( ; i < len; i += 16 ) {
+    __m512 acc = _mm512_mul_ps( _mm512_loadu_ps( &rows[0][i] ), w0 );
+    acc = _mm512_fmadd_ps( _mm512_loadu_ps( &rows[1][i] ), w1, acc );
+    acc = _mm512_fmadd_ps( _mm512_loadu_ps( &rows[2][i] ), w2, acc );
+    acc = _mm512_fmadd_ps( _mm512_loadu_ps( &rows[3][i] ), w3, acc );
+
+    /* Negative overshoot must be clamped before the unsigned saturating narrow. */
+    const __m512i v = _mm512_max_epi32( _mm512_cvtps_epi32( acc ), zero );
+    _mm_storeu_si128( (__m128i *)&dst[i], _mm512_cvtusepi32_epi8( v ) );
+  }
+#elif defined(__AVX2__)
+  const __m256 w0 = _mm256_set1_ps( weights[0] ), w1 = _mm256_set1_ps( weights[1] );
+  const __m256 w2 = _mm256_set1_ps( weights[2] ), w3 = _mm256_set1_ps( weights[3] );
+  const __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+
+  for( ; i < len; i += 32 ) {
+    __m256i v[4];
+    for( uint32_t k = 0; k < 4; k++ ) {
+      const uint32_t j = i + k*8;
+      __m256 acc = _mm256_mul_ps( _mm256_loadu_ps( &rows[0][j] ), w0 );
+      acc  = RESIZE_MADD256( _mm256_loadu_ps( &rows[1][j] ), w1, acc );
+      acc  = RESIZE_MADD256( _mm256_loadu_ps( &rows[2][j] ), w2, acc );
+      acc  = RESIZE_MADD256( _mm256_loadu_ps( &rows[3][j] ), w3, acc );
+      v[k] = _mm256_cvtps_epi32( acc );
+    }
+
+    /* Saturating packs work within 128-bit lanes, restore the order of the 4 byte groups afterwards. */
+    const __m256i packed = _mm256_packus_epi16( _mm256_packs_epi32( v[0], v[1] ), _mm256_packs_epi32( v[2], v[3] ) );
+    _mm256_storeu_si256( (__m256i *)&dst[i], _mm256_permutevar8x32_epi32( packed, order ) );
+  }
+#endif
+
+  for( ; i < len; i++ ) {
+    const float acc = rows[0][i]*weights[0] + rows[1][i]*weights[1] + rows[2][i]*weights[2] + rows[3][i]*weights[3];
+    dst[i] = acc <= 0.0f ? 0 : acc >= 255.0f ? 255 : (uint8_t)(acc + 0.5f);
+  }
+}
+
+/* fxpo_resize_upsample_crop upsamples a single crop, see fxpo_resize_upsample_children. */
+static void
+fxpo_resize_upsample_crop( const struct fxpo_resize_kernel_t * const kernel,
+                           const struct fxpo_resize_image_t * const  src,
+                           const struct fxpo_resize_child_t * const  child,
+                           float * const                             rows,
+                           const size_t                              dst_stride ) {
+
+  const size_t  row_len    = CHUNK_SIZE * PIXEL_CHANNELS;
+  const int32_t src_width  = (int32_t)src->width;
+  const int32_t src_height = (int32_t)src->height;
+  const int32_t crop_x     = (int32_t)child->crop_x;
+  const int32_t crop_y     = (int32_t)child->crop_y;
+
+  /* Source rows touched by the vertical taps, 2 rows above and below the crop at most. */
+  const int32_t first_row = fxpo_resize_clamp( crop_y - 2, src_height - 1 );
+  const int32_t last_row  = fxpo_resize_clamp( crop_y + (int32_t)kernel->src_size + 1, src_height - 1 );
+
+  /* The kernel is separable. Upsample every source row horizontally first so the vertical pass is a
+     straight blend of contiguous rows. */
+  for( int32_t y = first_row; y <= last_row; y++ ) {
+    fxpo_resize_horizontal( kernel, &src->buf[y*src->stride], src_width, crop_x, &rows[(y - first_row)*row_len] );
+  }
+
+  for( uint32_t o = 0; o < CHUNK_SIZE; o++ ) {
+    const float * tap_rows[RESIZE_TAPS];
+    for( uint32_t t = 0; t < RESIZE_TAPS; t++ ) {
+      tap_rows[t] = &rows[(fxpo_resize_clamp( crop_y + kernel->taps[o][t], src_height - 1 ) - first_row)*row_len];
+    }
+
+    fxpo_resize_vertical( tap_rows, kernel->weights[o], &child->dst[o*dst_stride] );
+  }
+}
+
+enum fxpo_status
+fxpo_resize_upsample_children( const enum fxpo_resize_filter            filter,
+                               const struct fxpo_resize_image_t * const parent,
+                               const uint8_t                            scale_log2,
+                               const struct fxpo_resize_child_t * const children,
+                               const size_t                             children_len,
+                               struct fxpo_arena_t * const              arena,
+                               const size_t                             dst_stride ) {
+
+  if( scale_log2 == 0 || scale_log2 > RESIZE_MAX_SCALE_LOG2 || filter >= FXPO_RESIZE_FILTER_COUNT ) {
+    FXPO_LOG_ERROR( "fxpo_resize_upsample_children(): unsupported scale=%u filter=%d", 1u << scale_log2, (int)filter );
+    return FXPOS_INVALID_STATE;
+  }
+
+  const struct fxpo_resize_kernel_t * const kernel = &fxpo_resize_kernels[filter][scale_log2];
+
+  const size_t  arena_mark = fxpo_arena_mark( arena );
+  float * const rows       = fxpo_arena_alloc( arena, (kernel->src_size + 4) * CHUNK_SIZE * PIXEL_CHANNELS * sizeof(float) );
+  if( rows == NULL ) return FXPOS_OUT_OF_MEMORY;
+
+  for( size_t i = 0; i < children_len; i++ ) {
+    const struct fxpo_resize_child_t * const child = &children[i];
+
+    if( child->crop_x + kernel->src_size > parent->width || child->crop_y + kernel->src_size > parent->height ) {
+      FXPO_LOG_ERROR( "fxpo_resize_upsample_children(): crop x=%u y=%u outside of parent", child->crop_x, child->crop_y );
+      fxpo_arena_rewind( arena, arena_mark );
+      return FXPOS_INVALID_STATE;
+    }
+
+    fxpo_resize_upsample_crop( kernel, parent, child, rows, dst_stride );
+  }
+
+  fxpo_arena_rewind( arena, arena_mark );
+
+  return FXPOS_OK;
+}
@@ -0,0 +1,63 @@
+#ifndef FXPO_RESIZE_H
+#define FXPO_RESIZE_H
+
+#include "fxpo_common.h"
+#include "fxpo_alloc.h"
+#include "fxpo_ortho.h"
+
+/* Downsampled chunks are upsampled by 2x (1 zoom level) up to 64x (6 zoom levels). */
+#define RESIZE_MAX_SCALE_LOG2 6
+/* Number of source pixels contributing to an output pixel. All supported filters have a support of
+   at most 2 source pixels when upsampling. */
+#define RESIZE_TAPS 4
+
+/* fxpo_resize_kernel_t holds the precomputed taps upsampling a row of CHUNK_SIZE >> scale_log2
+   pixels to CHUNK_SIZE pixels. Taps are relative to the first pixel of the crop and may fall up to
+   2 pixels outside of it, they are clamped to the edge of the source image when resizing. */
+struct fxpo_resize_kernel_t {
+  uint32_t src_size;
+  int16_t  taps[CHUNK_SIZE][RESIZE_TAPS];
+  float    weights[CHUNK_SIZE][RESIZE_TAPS];
+};
+
+/* fxpo_resize_image_t describes a decoded BGRA source image. */
+struct fxpo_resize_image_t {
+  const uint8_t * buf;
+  /* Row stride in bytes. */
+  size_t   stride;
+  uint32_t width;
+  uint32_t height;
+};
+
+/* fxpo_resize_child_t is a crop of a parent image to upsample into a chunk. */
+struct fxpo_resize_child_t {
+  /* Top-left pixel of the crop in the parent image. */
+  uint32_t crop_x;
+  uint32_t crop_y;
+  /* Destination of the upsampled CHUNK_SIZE x CHUNK_SIZE pixels. */
+  uint8_t * dst;
+};
+
+/* fxpo_resize_init precomputes the kernels of every filter and power-of-two ratio so that builders
+   using different filters can share them. Must be called before any other resize function. */
+void
+fxpo_resize_init();
+
+/* fxpo_resize_filter_from_str parses a filter name such as "catmullrom". */
+enum fxpo_status
+fxpo_resize_filter_from_str( const char *              str,
+                             enum fxpo_resize_filter * filter );
+
+/* fxpo_resize_upsample_children upsamples every child crop of CHUNK_SIZE >> scale_log2 pixels of a
+   decoded parent image in one call. Filter taps reaching past a crop sample the neighbouring pixels
+   of the parent so adjacent children join without seams. */
+enum fxpo_status
+fxpo_resize_upsample_children( enum fxpo_resize_filter            filter,
+                               const struct fxpo_resize_image_t * parent,
+                               uint8_t                            scale_log2,
+                               const struct fxpo_resize_child_t * children,
+                               size_t                             children_len,
+                               struct fxpo_arena_t *              arena,
+                               size_t                             dst_stride );
+
+#endif
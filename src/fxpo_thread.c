@@ -0,0 +1,164 @@
+#include "fxpo_thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI
+fxpo_thread_trampoline( LPVOID arg ) {
+#else
+static void *
+fxpo_thread_trampoline( void * arg ) {
+#endif
+
+  struct fxpo_thread_t * const thread = arg;
+  thread->main( thread->arg );
+
+  return 0;
+}
+
+bool
+fxpo_thread_start( struct fxpo_thread_t * const thread,
+                   const fxpo_thread_main_t     main,
+                   void * const                 arg ) {
+
+  thread->main = main;
+  thread->arg  = arg;
+
+#ifdef _WIN32
+  thread->handle = CreateThread( NULL, 0, fxpo_thread_trampoline, thread, 0, NULL );
+  return thread->handle != NULL;
+#else
+  return pthread_create( &thread->handle, NULL, fxpo_thread_trampoline, thread ) == 0;
+#endif
+}
+
+void
+fxpo_thread_join( struct fxpo_thread_t * const thread ) {
+
+#ifdef _WIN32
+  WaitForSingleObject( thread->handle, INFINITE );
+  CloseHandle( thread->handle );
+#else
+  pthread_join( thread->handle, NULL );
+#endif
+}
+
+uint64_t
+fxpo_thread_id() {
+
+#ifdef _WIN32
+  return GetCurrentThreadId();
+#else
+  return (uint64_t)pthread_self();
+#endif
+}
+
+void
+fxpo_mutex_new( struct fxpo_mutex_t * const mutex ) {
+
+#ifdef _WIN32
+  InitializeSRWLock( &mutex->lock );
+#else
+  pthread_mutex_init( &mutex->lock, NULL );
+#endif
+}
+
+void
+fxpo_mutex_free( struct fxpo_mutex_t * const mutex ) {
+
+#ifdef _WIN32
+  (void)mutex;
+#else
+  pthread_mutex_destroy( &mutex->lock );
+#endif
+}
+
+void
+fxpo_mutex_lock( struct fxpo_mutex_t * const mutex ) {
+
+#ifdef _WIN32
+  AcquireSRWLockExclusive( &mutex->lock );
+#else
+  pthread_mutex_lock( &mutex->lock );
+#endif
+}
+
+void
+fxpo_mutex_unlock( struct fxpo_mutex_t * const mutex ) {
+
+#ifdef _WIN32
+  ReleaseSRWLockExclusive( &mutex->lock );
+#else
+  pthread_mutex_unlock( &mutex->lock );
+#endif
+}
+
+void
+fxpo_cond_new( struct fxpo_cond_t * const cond ) {
+
+#ifdef _WIN32
+  InitializeConditionVariable( &cond->cond );
+#else
+  pthread_cond_init( &cond->cond, NULL );
+#endif
+}
+
+void
+fxpo_cond_free( struct fxpo_cond_t * const cond ) {
+
+#ifdef _WIN32
+  (void)cond;
+#else
+  pthread_cond_destroy( &cond->cond );
+#endif
+}
+
+void
+fxpo_cond_wait( struct fxpo_cond_t * const  cond,
+                struct fxpo_mutex_t * const mutex ) {
+
+#ifdef _WIN32
+  SleepConditionVariableSRW( &cond->cond, &mutex->lock, INFINITE, 0 );
+#else
+  pthread_cond_wait( &cond->cond, &mutex->lock );
+#endif
+}
+
+void
+fxpo_cond_wait_ms( struct fxpo_cond_t * const  cond,
+                   struct fxpo_mutex_t * const mutex,
+                   const uint32_t              ms ) {
+
+#ifdef _WIN32
+  SleepConditionVariableSRW( &cond->cond, &mutex->lock, ms, 0 );
+#else
+  struct timespec deadline;
+  clock_gettime( CLOCK_REALTIME, &deadline );
+  deadline.tv_sec  += ms / 1000;
+  deadline.tv_nsec += (long)(ms % 1000) * 1000000L;
+  if( deadline.tv_nsec >= 1000000000L ) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_cond_timedwait( &cond->cond, &mutex->lock, &deadline );
+#endif
+}
+
+void
+fxpo_cond_signal( struct fxpo_cond_t * const cond ) {
+
+#ifdef _WIN32
+  WakeConditionVariable( &cond->cond );
+#else
+  pthread_cond_signal( &cond->cond );
+#endif
+}
+
+void
+fxpo_cond_broadcast( struct fxpo_cond_t * const cond ) {
+
+#ifdef _WIN32
+  WakeAllConditionVariable( &cond->cond );
+#else
+  pthread_cond_broadcast( &cond->cond );
+#endif
+}
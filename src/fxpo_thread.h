@@ -0,0 +1,103 @@
+#ifndef FXPO_THREAD_H
+#define FXPO_THREAD_H
+
+#include "fxpo_common.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+typedef void (*fxpo_thread_main_t)( void * arg );
+
+/* fxpo_thread_t is an OS thread running outside of OpenMP parallel regions, e.g. the logger or the
+   workers of a context. It must stay at the same address until joined. */
+struct fxpo_thread_t {
+#ifdef _WIN32
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+  fxpo_thread_main_t main;
+  void *             arg;
+};
+
+/* fxpo_mutex_t is a lock usable from any thread, including those not created by OpenMP. fxpo_cond_t can wait on it. */
+struct fxpo_mutex_t {
+#ifdef _WIN32
+  SRWLOCK lock;
+#else
+  pthread_mutex_t lock;
+#endif
+};
+
+/* fxpo_cond_t lets threads sleep until another thread changes the state guarded by a fxpo_mutex_t,
+   instead of polling it. */
+struct fxpo_cond_t {
+#ifdef _WIN32
+  CONDITION_VARIABLE cond;
+#else
+  pthread_cond_t cond;
+#endif
+};
+
+/* FXPO_MUTEX_INIT initialises a static fxpo_mutex_t, which needs neither fxpo_mutex_new nor fxpo_mutex_free. */
+#ifdef _WIN32
+#define FXPO_MUTEX_INIT { SRWLOCK_INIT }
+#else
+#define FXPO_MUTEX_INIT { PTHREAD_MUTEX_INITIALIZER }
+#endif
+
+void
+fxpo_mutex_new( struct fxpo_mutex_t * mutex );
+
+void
+fxpo_mutex_free( struct fxpo_mutex_t * mutex );
+
+void
+fxpo_mutex_lock( struct fxpo_mutex_t * mutex );
+
+void
+fxpo_mutex_unlock( struct fxpo_mutex_t * mutex );
+
+void
+fxpo_cond_new( struct fxpo_cond_t * cond );
+
+void
+fxpo_cond_free( struct fxpo_cond_t * cond );
+
+/* fxpo_cond_wait releases mutex, which must be held, until cond is signalled and then takes it again.
+   Waits may also end spuriously, so the state waited for must be checked in a loop. */
+void
+fxpo_cond_wait( struct fxpo_cond_t *  cond,
+                struct fxpo_mutex_t * mutex );
+
+/* fxpo_cond_wait_ms is fxpo_cond_wait giving up after ms milliseconds. */
+void
+fxpo_cond_wait_ms( struct fxpo_cond_t *  cond,
+                   struct fxpo_mutex_t * mutex,
+                   uint32_t              ms );
+
+/* fxpo_cond_signal wakes a thread waiting on cond. */
+void
+fxpo_cond_signal( struct fxpo_cond_t * cond );
+
+/* fxpo_cond_broadcast wakes every thread waiting on cond. */
+void
+fxpo_cond_broadcast( struct fxpo_cond_t * cond );
+
+/* fxpo_thread_start runs main( arg ) on a new thread. */
+bool
+fxpo_thread_start( struct fxpo_thread_t * thread,
+                   fxpo_thread_main_t     main,
+                   void *                 arg );
+
+/* fxpo_thread_join waits for the thread to return. */
+void
+fxpo_thread_join( struct fxpo_thread_t * thread );
+
+/* fxpo_thread_id returns an identifier of the calling thread that is unique among running threads.
+   Unlike omp_get_thread_num it also distinguishes threads created outside of OpenMP. */
+uint64_t
+fxpo_thread_id();
+
+#endif
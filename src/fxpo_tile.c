@@ -0,0 +1,144 @@
+#include "fxpo_tile.h"
+
+/* fxpo_tile_mip_at returns the first pixel of chunk (xo, yo) in mip level of mips of a tile of size bytes
+   and row stride bytes. */
+static inline uint8_t *
+fxpo_tile_mip_at( const size_t    size,
+                  const size_t    stride,
+                  uint8_t * const mips,
+                  const uint32_t  level,
+                  const uint32_t  xo,
+                  const uint32_t  yo ) {
+
+  uint8_t * mip = mips;
+  for( uint32_t l = 1; l < level; l++ ) mip += size >> (2*l);
+  const size_t chunk_size = CHUNK_SIZE >> level;
+  return &mip[yo*chunk_size*(stride >> level) + xo*chunk_size*PIXEL_CHANNELS];
+}
+
+/* fxpo_tile_downsample is inlined into the downsample routine of every geometry, see fxpo_tile_geometry_t. */
+static inline void
+fxpo_tile_downsample( const size_t          size,
+                      const size_t          stride,
+                      const uint8_t * const tile,
+                      uint8_t * const       mips,
+                      const uint32_t        level,
+                      const uint32_t        xo,
+                      const uint32_t        yo ) {
+
+  const size_t          chunk_size = CHUNK_SIZE >> level;
+  const size_t          src_stride = stride >> (level - 1);
+  const size_t          dst_stride = stride >> level;
+  const uint8_t * const src        = level == 1 ? &tile[yo*CHUNK_SIZE*stride + xo*CHUNK_SIZE*PIXEL_CHANNELS] : fxpo_tile_mip_at( size, stride, mips, level - 1, xo, yo );
+  uint8_t * const       dst        = fxpo_tile_mip_at( size, stride, mips, level, xo, yo );
+
+  for( size_t j = 0; j < chunk_size; j++ ) {
+    const uint8_t * const row0 = &src[2*j*src_stride];
+    const uint8_t * const row1 = row0 + src_stride;
+    for( size_t i = 0; i < chunk_size*PIXEL_CHANNELS; i++ ) {
+      const size_t c = i % PIXEL_CHANNELS;
+      const size_t k = (i - c)*2 + c;
+      dst[j*dst_stride + i] = (uint8_t)((row0[k] + row0[k + PIXEL_CHANNELS] + row1[k] + row1[k + PIXEL_CHANNELS] + 2) / 4);
+    }
+  }
+}
+
+#define FXPO_TILE_DEFINE_GEOMETRY( N )                                                           \
+  static uint8_t *                                                                               \
+  fxpo_tile_chunk_##N( uint8_t * const tile,                                                     \
+                       const uint32_t  xo,                                                       \
+                       const uint32_t  yo ) {                                                    \
+                                                                                                 \
+    return &tile[(size_t)yo*CHUNK_SIZE*N*CHUNK_SIZE*PIXEL_CHANNELS + (size_t)xo*CHUNK_SIZE*PIXEL_CHANNELS]; \
+  }                                                                                              \
+                                                                                                 \
+  static void                                                                                    \
+  fxpo_tile_blit_##N( uint8_t * const       tile,                                                \
+                      const uint32_t        xo,                                                  \
+                      const uint32_t        yo,                                                  \
+                      const uint8_t * const chunk ) {                                            \
+                                                                                                 \
+    uint8_t * const dst = fxpo_tile_chunk_##N( tile, xo, yo );                                   \
+    for( size_t j = 0; j < CHUNK_SIZE; j++ ) {                                                   \
+      memcpy( &dst[j*N*CHUNK_SIZE*PIXEL_CHANNELS], &chunk[j*CHUNK_SIZE*PIXEL_CHANNELS], CHUNK_SIZE*PIXEL_CHANNELS ); \
+    }                                                                                            \
+  }                                                                                              \
+                                                                                                 \
+  static void                                                                                    \
+  fxpo_tile_fill_##N( uint8_t * const       tile,                                                \
+                      const uint32_t        xo,                                                  \
+                      const uint32_t        yo,                                                  \
+                      const uint8_t * const colour ) {                                           \
+                                                                                                 \
+    uint8_t * const dst = fxpo_tile_chunk_##N( tile, xo, yo );                                   \
+    for( size_t i = 0; i < CHUNK_SIZE; i++ ) memcpy( &dst[i*PIXEL_CHANNELS], colour, PIXEL_CHANNELS ); \
+    for( size_t j = 1; j < CHUNK_SIZE; j++ ) {                                                   \
+      memcpy( &dst[j*N*CHUNK_SIZE*PIXEL_CHANNELS], dst, CHUNK_SIZE*PIXEL_CHANNELS );             \
+    }                                                                                            \
+  }                                                                                              \
+                                                                                                 \
+  static void                                                                                    \
+  fxpo_tile_downsample_##N( const uint8_t * const tile,                                          \
+                            uint8_t * const       mips,                                          \
+                            const uint32_t        level,                                         \
+                            const uint32_t        xo,                                            \
+                            const uint32_t        yo ) {                                         \
+                                                                                                 \
+    fxpo_tile_downsample( (size_t)N*CHUNK_SIZE*N*CHUNK_SIZE*PIXEL_CHANNELS, (size_t)N*CHUNK_SIZE*PIXEL_CHANNELS, tile, mips, level, xo, yo ); \
+  }
+
+FXPO_TILE_GEOMETRIES( FXPO_TILE_DEFINE_GEOMETRY )
+
+#define FXPO_TILE_GEOMETRY_ENTRY( N )                        \
+  {                                                          \
+    .chunks_per_side = N,                                    \
+    .width           = N*CHUNK_SIZE,                         \
+    .stride          = (size_t)N*CHUNK_SIZE*PIXEL_CHANNELS,  \
+    .size            = (size_t)N*CHUNK_SIZE*N*CHUNK_SIZE*PIXEL_CHANNELS, \
+    .chunk           = fxpo_tile_chunk_##N,                  \
+    .blit            = fxpo_tile_blit_##N,                   \
+    .fill            = fxpo_tile_fill_##N,                   \
+    .downsample      = fxpo_tile_downsample_##N,             \
+  },
+
+static const struct fxpo_tile_geometry_t FXPO_TILE_GEOMETRY[] = {
+  FXPO_TILE_GEOMETRIES( FXPO_TILE_GEOMETRY_ENTRY )
+};
+
+const struct fxpo_tile_geometry_t *
+fxpo_tile_geometry( const uint32_t chunks_per_side ) {
+
+  for( size_t i = 0; i < sizeof(FXPO_TILE_GEOMETRY) / sizeof(FXPO_TILE_GEOMETRY[0]); i++ ) {
+    if( FXPO_TILE_GEOMETRY[i].chunks_per_side == chunks_per_side ) return &FXPO_TILE_GEOMETRY[i];
+  }
+
+  return NULL;
+}
+
+size_t
+fxpo_tile_mips_size( const struct fxpo_tile_geometry_t * const geometry ) {
+
+  size_t size = 0;
+  for( uint32_t level = 1; level <= TILE_MIPS; level++ ) size += geometry->size >> (2*level);
+  return size;
+}
+
+uint8_t *
+fxpo_tile_mip( const struct fxpo_tile_geometry_t * const geometry,
+               uint8_t * const                           mips,
+               const uint32_t                            level ) {
+
+  uint8_t * mip = mips;
+  for( uint32_t l = 1; l < level; l++ ) mip += geometry->size >> (2*l);
+  return mip;
+}
+
+uint8_t *
+fxpo_tile_mip_chunk( const struct fxpo_tile_geometry_t * const geometry,
+                     uint8_t * const                           mips,
+                     const uint32_t                            level,
+                     const uint32_t                            xo,
+                     const uint32_t                            yo ) {
+
+  return fxpo_tile_mip_at( geometry->size, geometry->stride, mips, level, xo, yo );
+}
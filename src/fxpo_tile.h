@@ -0,0 +1,79 @@
+#ifndef FXPO_TILE_H
+#define FXPO_TILE_H
+
+#include "fxpo_common.h"
+#include "fxpo_ortho.h"
+
+/* Mip levels below the texture that can be built alongside it, each chunk of mip level l being
+   CHUNK_SIZE >> l pixels wide. libjpeg-turbo decodes JPEGs at up to 1/8 scale. */
+#define TILE_MIPS 3
+
+/* Supported texture sizes as number of chunks per tile side: 2048, 4096 and 8192 pixels. */
+#define FXPO_TILE_GEOMETRIES( X ) \
+  X( 8 )                          \
+  X( 16 )                         \
+  X( 32 )
+
+/* fxpo_tile_geometry_t describes the pixel layout of a tile buffer. Per-chunk routines are generated
+   for every supported geometry so their loop bounds and strides are compile-time constants. */
+struct fxpo_tile_geometry_t {
+  /* Number of chunks along each side of the tile. */
+  uint32_t chunks_per_side;
+  /* Width and height of the tile in pixels. */
+  uint32_t width;
+  /* Row stride of the tile buffer in bytes. */
+  size_t stride;
+  /* Size of the tile buffer in bytes. */
+  size_t size;
+
+  /* chunk returns the first pixel of chunk (xo, yo) in tile. */
+  uint8_t * (*chunk)( uint8_t * tile,
+                      uint32_t  xo,
+                      uint32_t  yo );
+
+  /* blit copies a CHUNK_SIZE x CHUNK_SIZE BGRA image into chunk (xo, yo) of tile. */
+  void (*blit)( uint8_t *       tile,
+                uint32_t        xo,
+                uint32_t        yo,
+                const uint8_t * chunk );
+
+  /* fill sets every pixel of chunk (xo, yo) of tile to a PIXEL_CHANNELS colour. */
+  void (*fill)( uint8_t *       tile,
+                uint32_t        xo,
+                uint32_t        yo,
+                const uint8_t * colour );
+
+  /* downsample box-filters chunk (xo, yo) of mip level - 1, tile for level 1, into mip level of mips.
+     Pixels are averaged as stored, like a scaled JPEG decode does. */
+  void (*downsample)( const uint8_t * tile,
+                      uint8_t *       mips,
+                      uint32_t        level,
+                      uint32_t        xo,
+                      uint32_t        yo );
+};
+
+/* fxpo_tile_mips_size returns the size of a buffer holding mip levels 1 to TILE_MIPS of a tile of geometry,
+   stored one after the other with the layout of the tile buffer. */
+size_t
+fxpo_tile_mips_size( const struct fxpo_tile_geometry_t * geometry );
+
+/* fxpo_tile_mip returns mip level, from 1 to TILE_MIPS, in mips. Its row stride is geometry->stride >> level. */
+uint8_t *
+fxpo_tile_mip( const struct fxpo_tile_geometry_t * geometry,
+               uint8_t *                           mips,
+               uint32_t                            level );
+
+/* fxpo_tile_mip_chunk returns the first pixel of chunk (xo, yo) in mip level of mips. */
+uint8_t *
+fxpo_tile_mip_chunk( const struct fxpo_tile_geometry_t * geometry,
+                     uint8_t *                           mips,
+                     uint32_t                            level,
+                     uint32_t                            xo,
+                     uint32_t                            yo );
+
+/* fxpo_tile_geometry returns the geometry of tiles with chunks_per_side chunks along each side
+   or NULL if the size is not supported. */
+const struct fxpo_tile_geometry_t *
+fxpo_tile_geometry( uint32_t chunks_per_side );
+
+#endif
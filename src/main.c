@@ -1,240 +1,603 @@
+#include "fxpo.h"
 #include "fxpo_common.h"
 #include "fxpo_log.h"
-#include "fxpo_alloc.h"
-#include "fxpo_http.h"
-#include "fxpo_jpeg.h"
 #include "fxpo_ortho.h"
 #include "fxpo_nvtt3.h"
-
-#pragma warning( push )
-#pragma warning( disable : 4067 4456 )
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb/stb_image_resize2.h"
-#pragma warning( pop )
+#include "fxpo_budget.h"
+#include "fxpo_resize.h"
+#include "fxpo_tile.h"
+#include "fxpo_daemon.h"
+#include "fxpo_progress.h"
+#include <signal.h>
+
+/* Textures built with chunks filled in by --tolerant, listed in the folder of the tileset. */
+#define DEGRADED_LIST_NAME "fxpo_degraded.txt"
+
+struct fxpo_options_t {
+  const char * scenery_path;
+  const char * tileset;
+  /* Memory budget for tiles being assembled and compressed in bytes. 0 means unlimited. */
+  size_t max_memory;
+  /* Rate limits of the requests to each provider. 0 keeps the provider's default. */
+  double max_requests_per_second;
+  size_t max_bytes_per_second;
+  /* Connections each worker opens to every provider host before the first tile. */
+  size_t warm_connections;
+  /* Back tile buffers with huge pages. */
+  bool huge_pages;
+  /* Pin worker threads to cores and allocate their buffers on the local NUMA node. */
+  bool pin_threads;
+  /* Fill chunks that cannot be fetched or decoded instead of failing, and keep going when a texture fails. */
+  bool tolerant;
+  /* Only rebuild the textures listed as degraded by the last tolerant run. */
+  bool retry_degraded;
+  /* Decode the first mips of each chunk at reduced scale instead of filtering them from the texture. */
+  bool scaled_mips;
+  /* Filter used to upsample chunks missing at the tile's zoom level. */
+  enum fxpo_resize_filter resize_filter;
+  /* Texture size as number of chunks per tile side. */
+  uint32_t chunks_per_side;
+  enum fxpo_mode mode;
+  /* Root of the chunk cache used by --fetch-only and --offline. NULL for the tileset's default. */
+  const char * cache_path;
+  /* Archive of the chunk responses to record, or to replay instead of the network. */
+  const char * record_path;
+  const char * replay_path;
+  /* Factor applied to the latencies recorded while replaying. */
+  double       replay_latency;
+  /* Seconds between progress reports, 0 for the default of the output and negative to disable them. */
+  double progress_interval;
+  /* Serve tile build requests instead of building a tileset. */
+  bool     daemon;
+  uint16_t port;
+};
 
 void
 print_usage( const char * program ) {
 
-  printf( "Usage: %s \"<scenery_path>\" \"<tileset>\"\n", program );
+  printf( "Usage: %s [options] \"<scenery_path>\" \"<tileset>\"\n", program );
+  printf( "       %s --daemon [options] \"<scenery_path>\"\n", program );
   printf( "  <scenery_path> is the path to X-Plane's Custom Scenery folder.\n    Example: C:\\X-Plane 12\\Custom Scenery\n" );
   printf( "  <tileset> is the coordinates of the tileset to download and process.\n    Example: +57-006\n" );
+  printf( "Options:\n" );
+  printf( "  --max-memory <size> limits memory used by tiles being assembled and compressed.\n    Example: 8G\n" );
+  printf( "  --texture-size <size> builds textures of 2048, 4096 or 8192 pixels covering the same area.\n    Default: 4096\n" );
+  printf( "  --resize-filter <filter> upsamples missing chunks using box, triangle, cubicbspline, catmullrom or mitchell.\n    Default: catmullrom\n" );
+  printf( "  --log-level <level> shows messages of level error, warn, info or debug and above.\n    Default: debug\n" );
+  printf( "  --fetch-only downloads chunks into the chunk cache without building textures.\n" );
+  printf( "  --offline builds textures from the chunk cache without downloading.\n" );
+  printf( "  --cache <path> is the chunk cache used by --fetch-only and --offline.\n    Default: <scenery_path>/fxpo_cache\n" );
+  printf( "  --daemon keeps running and builds tiles requested over HTTP on localhost.\n" );
+  printf( "  --max-requests <rate> limits the requests per second sent to a provider by all workers.\n    Example: 200\n" );
+  printf( "  --max-bandwidth <size> limits the bytes per second received from a provider by all workers.\n    Example: 20M\n" );
+  printf( "  --warm-connections <count> opens count connections per worker to every provider host at start-up.\n    Default: %u\n", FXPO_DEFAULT_WARM_CONNECTIONS );
+  printf( "  --port <port> is the port the daemon listens on.\n    Default: %u\n", DAEMON_DEFAULT_PORT );
+  printf( "  --huge-pages backs tile buffers with huge pages.\n" );
+  printf( "  --pin-threads pins worker threads to cores and allocates their buffers on the local NUMA node.\n" );
+  printf( "  --tolerant fills chunks that cannot be fetched or decoded and lists their textures in\n    <scenery_path>/zOrtho4XP_<tileset>/" DEGRADED_LIST_NAME " instead of aborting.\n" );
+  printf( "  --retry-degraded only rebuilds the textures listed by the last --tolerant run. Implies --tolerant.\n" );
+  printf( "  --scaled-mips decodes the first mip of every chunk from its JPEG at half scale and builds the next %u from it\n    instead of filtering them from the texture.\n", TILE_MIPS - 1 );
+  printf( "  --record <path> records every chunk request and response of the run to an archive.\n" );
+  printf( "  --replay <path> serves chunk requests from an archive made by --record instead of the network.\n" );
+  printf( "  --replay-latency <scale> waits for the recorded latencies times scale when replaying.\n    Default: 0\n" );
+  printf( "  --progress-interval <seconds> reports progress on the terminal, or as JSON lines if stderr is not one,\n    every seconds. 0 disables reports.\n    Default: %.0f on a terminal, %.0f otherwise\n",
+          PROGRESS_TTY_INTERVAL_S, PROGRESS_JSON_INTERVAL_S );
 }
 
-int
-main( int     argc,
-      char ** argv ) {
+bool
+parse_args( const int                     argc,
+            char ** const                 argv,
+            struct fxpo_options_t * const opts ) {
 
-  FXPO_LOG_TITLE( "fxpo: fast x-plane orthoimages" );
+  const char * positional[2];
+  size_t       positional_len = 0;
 
-  /* Process scenery path and tile coordinates. */
-  if( argc < 3 ) {
-    FXPO_LOG_ERROR( "missing arguments" );
-    print_usage( argv[0] );
-    return EXIT_FAILURE;
-  }
+  *opts = (struct fxpo_options_t) {
+    .resize_filter    = FXPO_RESIZE_FILTER_CATMULLROM,
+    .chunks_per_side  = DEFAULT_CHUNKS_PER_TILE_SIDE,
+    .port             = DAEMON_DEFAULT_PORT,
+    .warm_connections = FXPO_DEFAULT_WARM_CONNECTIONS,
+  };
 
-  const char * scenery_path = argv[1];
-  const char * tileset      = argv[2];
+  for( int i = 1; i < argc; i++ ) {
+    const char * const arg = argv[i];
 
-  if( fxpo_nvtt3_is_cuda_enabled() ) FXPO_LOG_INFO( "CUDA acceleration enabled" );
-  else FXPO_LOG_WARN( "no CUDA acceleration" );
+    if( strncmp( arg, "--", 2 ) != 0 ) {
+      if( positional_len == 2 ) {
+        FXPO_LOG_ERROR( "unexpected argument %s", arg );
+        return false;
+      }
+      positional[positional_len++] = arg;
+      continue;
+    }
+
+    /* Options without value. */
+    if( !strcmp( arg, "--huge-pages" ) ) {
+      opts->huge_pages = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--pin-threads" ) ) {
+      opts->pin_threads = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--daemon" ) ) {
+      opts->daemon = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--tolerant" ) ) {
+      opts->tolerant = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--retry-degraded" ) ) {
+      opts->tolerant       = true;
+      opts->retry_degraded = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--scaled-mips" ) ) {
+      opts->scaled_mips = true;
+      continue;
+    }
+
+    if( !strcmp( arg, "--fetch-only" ) || !strcmp( arg, "--offline" ) ) {
+      if( opts->mode != FXPO_MODE_BUILD ) {
+        FXPO_LOG_ERROR( "--fetch-only and --offline are mutually exclusive" );
+        return false;
+      }
+      opts->mode = !strcmp( arg, "--fetch-only" ) ? FXPO_MODE_FETCH_ONLY : FXPO_MODE_OFFLINE;
+      continue;
+    }
+
+    if( i + 1 >= argc ) {
+      FXPO_LOG_ERROR( "missing value for option %s", arg );
+      return false;
+    }
+
+    const char * const value = argv[++i];
+
+    if( !strcmp( arg, "--max-memory" ) ) {
+      if( fxpo_budget_parse_size( value, &opts->max_memory ) != FXPOS_OK ) return false;
+    } else if( !strcmp( arg, "--log-level" ) ) {
+      if( !fxpo_log_set_level( value ) ) {
+        FXPO_LOG_ERROR( "unknown log level %s", value );
+        return false;
+      }
+    } else if( !strcmp( arg, "--texture-size" ) ) {
+      char * end;
+      const unsigned long size = strtoul( value, &end, 10 );
+      opts->chunks_per_side = (uint32_t)(size / CHUNK_SIZE);
+      if( *end != '\0' || (unsigned long)opts->chunks_per_side * CHUNK_SIZE != size || fxpo_tile_geometry( opts->chunks_per_side ) == NULL ) {
+        FXPO_LOG_ERROR( "unsupported texture size %s", value );
+        return false;
+      }
+    } else if( !strcmp( arg, "--resize-filter" ) ) {
+      if( fxpo_resize_filter_from_str( value, &opts->resize_filter ) != FXPOS_OK ) return false;
+    } else if( !strcmp( arg, "--cache" ) ) {
+      opts->cache_path = value;
+    } else if( !strcmp( arg, "--max-requests" ) ) {
+      char * end;
+      opts->max_requests_per_second = strtod( value, &end );
+      if( *end != '\0' || opts->max_requests_per_second <= 0 ) {
+        FXPO_LOG_ERROR( "invalid request rate %s", value );
+        return false;
+      }
+    } else if( !strcmp( arg, "--max-bandwidth" ) ) {
+      if( fxpo_budget_parse_size( value, &opts->max_bytes_per_second ) != FXPOS_OK ) return false;
+    } else if( !strcmp( arg, "--warm-connections" ) ) {
+      char * end;
+      opts->warm_connections = strtoul( value, &end, 10 );
+      if( *end != '\0' ) {
+        FXPO_LOG_ERROR( "invalid connection count %s", value );
+        return false;
+      }
+    } else if( !strcmp( arg, "--record" ) ) {
+      opts->record_path = value;
+    } else if( !strcmp( arg, "--replay" ) ) {
+      opts->replay_path = value;
+    } else if( !strcmp( arg, "--replay-latency" ) ) {
+      char * end;
+      opts->replay_latency = strtod( value, &end );
+      if( *end != '\0' || opts->replay_latency < 0 ) {
+        FXPO_LOG_ERROR( "invalid latency scale %s", value );
+        return false;
+      }
+    } else if( !strcmp( arg, "--progress-interval" ) ) {
+      char * end;
+      const double interval = strtod( value, &end );
+      if( *end != '\0' || interval < 0 ) {
+        FXPO_LOG_ERROR( "invalid progress interval %s", value );
+        return false;
+      }
+      opts->progress_interval = interval > 0 ? interval : -1.0;
+    } else if( !strcmp( arg, "--port" ) ) {
+      char * end;
+      const unsigned long port = strtoul( value, &end, 10 );
+      if( *end != '\0' || port == 0 || port > UINT16_MAX ) {
+        FXPO_LOG_ERROR( "invalid port %s", value );
+        return false;
+      }
+      opts->port = (uint16_t)port;
+    } else {
+      FXPO_LOG_ERROR( "unknown option %s", arg );
+      return false;
+    }
+  }
 
-  const size_t max_parallel = omp_get_max_threads();
-  FXPO_LOG_INFO( "thread pool size=%zu", max_parallel );
+  /* The daemon is told the tileset of each tile it builds. */
+  if( positional_len < (opts->daemon ? 1 : 2) ) {
+    FXPO_LOG_ERROR( "missing arguments" );
+    return false;
+  }
 
-  struct fxpo_tile_t ** tiles;
+  if( opts->daemon && (positional_len > 1 || opts->mode == FXPO_MODE_FETCH_ONLY) ) {
+    FXPO_LOG_ERROR( "--daemon takes no tileset and cannot be combined with --fetch-only" );
+    return false;
+  }
 
-  FXPO_LOG_INFO( "searching scenery_path=\"%s\" tileset=%s", scenery_path, tileset );
-  const size_t tile_num = fxpo_ortho_find_tiles( scenery_path, tileset, &tiles );
-  if( tile_num == 0 ) {
-    FXPO_LOG_ERROR( "no terrain files found in scenery_path=\"%s\" tileset=%s", scenery_path, tileset );
-    return EXIT_FAILURE;
+  /* Chunks left out of the cache are fetched again by the next --fetch-only run anyway. */
+  if( opts->retry_degraded && (opts->daemon || opts->mode == FXPO_MODE_FETCH_ONLY) ) {
+    FXPO_LOG_ERROR( "--retry-degraded cannot be combined with --daemon or --fetch-only" );
+    return false;
   }
 
-  FXPO_LOG_INFO( "loaded %zu tiles", tile_num );
+  if( (opts->record_path != NULL && opts->replay_path != NULL) || ((opts->record_path != NULL || opts->replay_path != NULL) && opts->mode == FXPO_MODE_OFFLINE) ) {
+    FXPO_LOG_ERROR( "--record and --replay are mutually exclusive and cannot be combined with --offline" );
+    return false;
+  }
 
-  /* Initialise libraries and global context. */
-  fxpo_http_init();
-  fxpo_nvtt3_init();
+  opts->scenery_path = positional[0];
+  opts->tileset      = opts->daemon ? NULL : positional[1];
 
-  struct fxpo_nvtt3_context_t nvtt_ctx;
-  fxpo_nvtt3_context_new( &nvtt_ctx );
+  return true;
+}
 
-  /* Use OpenMP to parallelise tile processing. */
-  bool    abort = false;
-  int32_t it;
-  #pragma omp parallel
-  {
-    struct fxpo_http_multi_context_t http_ctx;
-    fxpo_http_multi_context_new( &http_ctx, max_parallel, CHUNK_SIZE * 4 );
+/* Context interrupted by SIGINT and SIGTERM. */
+static struct fxpo_context_t * volatile fxpo_signal_ctx;
 
-    /* HTTP response buffers. */
-    struct fxpo_http_data_t res[CHUNKS_PER_TILE];
-    for( size_t i = 0; i < CHUNKS_PER_TILE; i++ ) fxpo_http_data_new( &res[i] );
+/* fxpo_on_signal stops the workers within milliseconds, dropping transfers in flight and partial
+   textures. A second signal terminates the process right away. */
+static void
+fxpo_on_signal( const int sig ) {
 
-    /* Pixels of the orthophoto for a tile. This is a 4096x4096 image. */
-    uint8_t * const tile_imgbuf = fxpo_aligned_malloc( TILE_SIZE * COLOUR_CHANNELS );
+  signal( sig, SIG_DFL );
+  if( fxpo_signal_ctx != NULL ) fxpo_context_interrupt( fxpo_signal_ctx );
+}
 
-    #pragma omp for
-    for( it = 0; it < tile_num; it++ ) {
-      /* MSVC only supports OpenMP 2.0 that has no proper cancellation support.
-         `break` statements in for loops are not allowed by standard OMP however MSVC's implementation
-         allows it and exits the current thread's set of iterations which is exactly the goal here. */
-      if( abort ) break;
+/* fxpo_batch_t tracks the textures of a tileset built by the executable. */
+struct fxpo_batch_t {
+  struct fxpo_context_t * ctx;
+  /* Progress of the batch. NULL if not reported. */
+  struct fxpo_progress_t * progress;
+  /* Keep building the other textures when one fails. */
+  bool                    tolerant;
+  volatile int64_t        failed;
+  /* List of the textures built with chunks filled in, one file name per line. NULL if not kept. */
+  FILE *                  degraded;
+  /* Textures listed by the previous run, pointing into listed_buf, and whether each one completed. */
+  char *                  listed_buf;
+  char **                 listed;
+  bool *                  listed_done;
+  size_t                  listed_len;
+  struct fxpo_mutex_t     lock;
+};
+
+static void
+fxpo_batch_done( const struct fxpo_result_t * const result,
+                 void * const                       user ) {
+
+  struct fxpo_batch_t * const batch = user;
+
+  if( batch->progress != NULL ) fxpo_progress_on_done( batch->progress, result );
+
+  if( result->status == FXPOS_OK && result->degraded ) FXPO_LOG_WARN( "built dds=%s with chunks filled in", result->dds_path );
+
+  if( batch->degraded != NULL ) {
+    const char * name = strrchr( result->dds_path, '/' );
+    name = name != NULL ? name + 1 : result->dds_path;
+
+    /* Listed textures that were cancelled or failed stay listed for the next retry. */
+    fxpo_mutex_lock( &batch->lock );
+    size_t listed = 0;
+    while( listed < batch->listed_len && strcmp( batch->listed[listed], name ) ) listed++;
+    if( listed < batch->listed_len ) batch->listed_done[listed] = true;
+
+    if( result->status == FXPOS_OK ? result->degraded : listed < batch->listed_len ) fprintf( batch->degraded, "%s\n", name );
+    fxpo_mutex_unlock( &batch->lock );
+  }
 
-      const struct fxpo_tile_t * const tile = tiles[it];
+  if( result->status == FXPOS_OK || result->status == FXPOS_CANCELLED ) return;
 
-      FXPO_LOG_INFO( "building chunks for tile x=%u y=%u zoom_level=%u", tile->x, tile->y, tile->zoom_level );
+  /* Stop at the first texture that fails, like a failing build would, unless the run is tolerant. */
+  FXPO_LOG_ERROR( "failed to build dds=%s: %s", result->dds_path, fxpo_status_str( result->status ) );
+  if( fxpo_atomic_add( &batch->failed, 1 ) == 1 && !batch->tolerant ) fxpo_context_cancel_all( batch->ctx );
+}
 
-      char quadkey[MAX_QUADKEY_LENGTH] = {0};
+/* fxpo_batch_queued weighs the progress estimate with each texture of the tileset as it is queued. */
+static void
+fxpo_batch_queued( const uint64_t     id,
+                   const char * const dds_name,
+                   void * const       user ) {
 
-      char                urls[CHUNKS_PER_TILE][MAX_URL_LENGTH];
-      struct fxpo_chunk_t chunks[CHUNK_SIZE];
+  const struct fxpo_batch_t * const batch = user;
 
-      uint8_t * imgbuf = NULL;
-      size_t    imgbuf_len;
+  (void)id;
+  struct fxpo_tile_t tile;
+  if( batch->progress != NULL && fxpo_ortho_parse_dds_name( dds_name, &tile ) == FXPOS_OK ) fxpo_progress_expect( batch->progress, &tile );
+}
 
-      /* Each tile has 256 chunks (16x16). */
-      for( uint8_t yo = 0; yo < CHUNKS_PER_TILE_SIDE; yo++ ) {
-        for( uint8_t xo = 0; xo < CHUNKS_PER_TILE_SIDE; xo++ ) {
-          const size_t i = xo*CHUNKS_PER_TILE_SIDE + yo;
+/* fxpo_batch_read_degraded reads the list of degraded textures at path into batch->listed. Leaves it
+   empty if there is none. */
+static void
+fxpo_batch_read_degraded( struct fxpo_batch_t * const batch,
+                          const char * const          path ) {
+
+  FILE * const f = fopen( path, "rb" );
+  if( f == NULL ) return;
+
+  fseek( f, 0, SEEK_END );
+  const long size = ftell( f );
+  fseek( f, 0, SEEK_SET );
+
+  char * const list = size > 0 ? fxpo_malloc( (size_t)size + 1 ) : NULL;
+  if( list != NULL ) list[fread( list, 1, (size_t)size, f )] = '\0';
+  fclose( f );
+
+  if( list == NULL ) return;
+
+  /* Every name takes at least two bytes with its line break. */
+  const size_t max_names = (size_t)size / 2 + 1;
+  batch->listed      = fxpo_malloc( max_names * sizeof(char *) );
+  batch->listed_done = fxpo_malloc( max_names * sizeof(bool) );
+  if( batch->listed == NULL || batch->listed_done == NULL ) {
+    fxpo_free( batch->listed_done );
+    fxpo_free( batch->listed );
+    fxpo_free( list );
+    batch->listed      = NULL;
+    batch->listed_done = NULL;
+    return;
+  }
 
-          chunks[i] = (struct fxpo_chunk_t) {
-            .x          = tile->x + xo,
-            .y          = tile->y + yo,
-            .zoom_level = tile->zoom_level,
-            .found      = false,
-          };
+  batch->listed_buf = list;
+  for( char * name = strtok( list, "\r\n" ); name != NULL; name = strtok( NULL, "\r\n" ) ) {
+    batch->listed_done[batch->listed_len] = false;
+    batch->listed[batch->listed_len++]    = name;
+  }
+}
 
-          fxpo_ortho_tile2quadkey( chunks[i].x, chunks[i].y, chunks[i].zoom_level, &quadkey[0] );
-          fxpo_ortho_build_url( tile->provider, &chunks[i], quadkey, &urls[i][0], MAX_URL_LENGTH );
-        }
-      }
+/* fxpo_batch_write_degraded completes the new list of degraded textures at tmp_path with the listed
+   textures that were never handled, e.g. because the run was interrupted before queueing them, and
+   replaces the list at path with it. No list is left behind once every texture is complete. */
+static void
+fxpo_batch_write_degraded( struct fxpo_batch_t * const batch,
+                           const char * const          tmp_path,
+                           const char * const          path ) {
 
-      /* Check if chunk at given zoom level found. Resize if not. */
-      FXPO_LOG_DEBUG( "fetching metadata for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+  for( size_t i = 0; i < batch->listed_len; i++ ) {
+    if( !batch->listed_done[i] ) fprintf( batch->degraded, "%s\n", batch->listed[i] );
+  }
+
+  const bool empty = ftell( batch->degraded ) == 0;
+  if( fclose( batch->degraded ) != 0 ) {
+    FXPO_LOG_WARN( "could not write list of degraded textures to %s", tmp_path );
+    remove( tmp_path );
+  } else if( empty ) {
+    remove( tmp_path );
+    remove( path );
+  } else if( !fxpo_file_replace( tmp_path, path ) ) {
+    FXPO_LOG_WARN( "could not replace list of degraded textures %s", path );
+    remove( tmp_path );
+  }
 
-      bool has_chunks = false;
+  batch->degraded = NULL;
+}
 
-      do {
-        has_chunks = true;
+/* fxpo_batch_queue_degraded queues the textures listed in batch based on request. Returns the number of
+   textures queued in count. */
+static enum fxpo_status
+fxpo_batch_queue_degraded( struct fxpo_context_t * const     ctx,
+                           struct fxpo_request_t             request,
+                           const struct fxpo_batch_t * const batch,
+                           struct fxpo_progress_t * const    progress,
+                           size_t * const                    count ) {
+
+  *count = 0;
+
+  for( size_t i = 0; i < batch->listed_len; i++ ) {
+    const char * const name = batch->listed[i];
+    request.dds_name = name;
+
+    const enum fxpo_status status = fxpo_context_build( ctx, &request, NULL );
+    if( status == FXPOS_INVALID_STATE ) {
+      FXPO_LOG_WARN( "skipping invalid texture name=%s", name );
+    } else if( status != FXPOS_OK ) {
+      return status;
+    } else {
+      (*count)++;
+    }
+
+    struct fxpo_tile_t tile;
+    if( status == FXPOS_OK && progress != NULL && fxpo_ortho_parse_dds_name( name, &tile ) == FXPOS_OK ) fxpo_progress_expect( progress, &tile );
+  }
 
-        if( fxpo_http_get_multi( &http_ctx, urls, CHUNKS_PER_TILE, res, true ) != FXPOS_OK ) {
-          FXPO_LOG_ERROR( "failed to fetch chunk metadata for tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
-          abort = true;
-          goto cleanup;
-        }
+  return FXPOS_OK;
+}
 
-        for( size_t i = 0; i < CHUNK_SIZE; i++ ) {
-          struct fxpo_chunk_t * const chunk = &chunks[i];
-          if( chunk->found ) continue;
+int
+main( int     argc,
+      char ** argv ) {
 
-          /* Check if chunk at given zoom level exists. Downsample if not. */
-          /* FIXME (@bcsongor, 2023-11-29) Is there a more reliable way to check if Arc has an image for the given chunk? */
-          if( tile->provider == FXPO_PROVIDER_BI && strstr( (const char *)res[i].buf, "X-VE-Tile-Info: no-tile" )
-              || tile->provider == FXPO_PROVIDER_ARC && strstr( (const char *)res[i].buf, "Etag: vvvvvvvvvvvvf" )) {
+  FXPO_LOG_TITLE( "fxpo: fast x-plane orthoimages" );
 
-            FXPO_LOG_DEBUG( "missing chunk at x=%u y=%u for zl=%u. downsampling.", chunk->x, chunk->y, chunk->zoom_level );
-            has_chunks = false;
+  /* Process options, scenery path and tile coordinates. */
+  struct fxpo_options_t opts;
+  if( !parse_args( argc, argv, &opts ) ) {
+    print_usage( argv[0] );
+    return EXIT_FAILURE;
+  }
 
-            fxpo_ortho_downsample_chunk( chunk );
-            fxpo_ortho_tile2quadkey( chunk->x, chunk->y, chunk->zoom_level, &quadkey[0] );
-            fxpo_ortho_build_url( tile->provider, chunk, quadkey, &urls[i][0], MAX_URL_LENGTH );
+  /* Hand log messages to a background thread from now on, flush them on any exit. */
+  fxpo_log_start();
+  atexit( fxpo_log_stop );
 
-            /* printf( "%u %u %u URL: %s\n", chunk->x, chunk->y, chunk->zoom_level, urls[i] ); */
+  const char * scenery_path = opts.scenery_path;
+  const char * tileset      = opts.tileset;
 
-            /* Reset the response buffer to signal fxpo_http_get_multi to make the request again with the new URL. */
-            fxpo_http_data_reset( &res[i] );
-          } else {
-            FXPO_LOG_DEBUG( "found chunk at x=%u y=%u for zl=%u.", chunk->x, chunk->y, chunk->zoom_level );
-            chunk->found = true;
-          }
-        }
-      } while( !has_chunks );
+  const bool fetch_only = opts.mode == FXPO_MODE_FETCH_ONLY;
+  const bool offline    = opts.mode == FXPO_MODE_OFFLINE;
 
-      /* Reset HTTP data buffers. */
-      for( size_t i = 0; i < CHUNK_SIZE; i++ ) fxpo_http_data_reset( &res[i] );
+  if( fetch_only ) FXPO_LOG_INFO( "fetch-only mode, textures are not built" );
+  else if( fxpo_nvtt3_is_cuda_enabled() ) FXPO_LOG_INFO( "CUDA acceleration enabled" );
+  else FXPO_LOG_WARN( "no CUDA acceleration" );
 
-      FXPO_LOG_DEBUG( "fetching images for tile x=%u y=%u", tile->x, tile->y );
-      if( fxpo_http_get_multi( &http_ctx, urls, CHUNKS_PER_TILE, res, false ) != FXPOS_OK ) {
-        FXPO_LOG_ERROR( "failed to fetch images for tile x=%u y=%u", tile->x, tile->y );
-        abort = true;
-        goto cleanup;
-      }
+  const size_t max_parallel = omp_get_max_threads();
+  FXPO_LOG_INFO( "thread pool size=%zu", max_parallel );
 
-      for( uint8_t yo = 0; yo < CHUNKS_PER_TILE_SIDE; yo++ ) {
-        for( uint8_t xo = 0; xo < CHUNKS_PER_TILE_SIDE; xo++ ) {
-          const size_t i = xo*CHUNKS_PER_TILE_SIDE + yo;
-
-          const struct fxpo_chunk_t * const     chunk = &chunks[i];
-          const struct fxpo_http_data_t * const data  = &res[i];
-
-          FXPO_LOG_DEBUG( "processing JPEG image for url=%s size=%zu", urls[i], data->size );
-
-          uint8_t downsample = tile->zoom_level - chunk->zoom_level;
-          if( downsample > 0 ) {
-            uint32_t x, y, w, h;
-            fxpo_ortho_chunk_bbox( chunk->x, chunk->y, tile->x + xo, tile->y + yo, downsample, &x, &y, &w, &h );
-
-            /* Decode a portion of the JPEG image specified by the crop bounding box. */
-            if( fxpo_jpeg_cropped_decode( data->buf, data->size, &imgbuf, &imgbuf_len, x, y, w, h ) == FXPOS_OK ) {
-              FXPO_LOG_DEBUG( "cropped decoded JPEG image to pixel buffer size=%zu", imgbuf_len );
-
-              /* Upsample cropped image to full chunk size using Catmull-Rom filter. */
-              uint8_t * const resized_imgbuf = fxpo_aligned_malloc( CHUNK_SIZE * CHUNK_SIZE * COLOUR_CHANNELS );
-              stbir_resize_uint8_linear( imgbuf, (int)w, (int)h, 0, resized_imgbuf, CHUNK_SIZE, CHUNK_SIZE, 0, STBIR_RGBA );
-              aligned_free( imgbuf );
-              imgbuf = resized_imgbuf;
-            } else {
-              FXPO_LOG_ERROR( "failed to cropped decode JPEG image for url=%s", urls[i] );
-              abort = true;
-              goto cleanup;
-            }
-          } else {
-            if( fxpo_jpeg_decode( data->buf, data->size, &imgbuf, &imgbuf_len ) == FXPOS_OK ) {
-              FXPO_LOG_DEBUG( "decoded JPEG image to pixel buffer size=%zu", imgbuf_len );
-            } else {
-              FXPO_LOG_ERROR( "failed to decode JPEG image for url=%s", urls[i] );
-              abort = true;
-              goto cleanup;
-            }
-          }
-
-          for( size_t j = 0; j < CHUNK_SIZE; j++ ) {
-            memcpy( &tile_imgbuf[yo*TILE_WIDTH*CHUNK_SIZE*COLOUR_CHANNELS + j*TILE_HEIGHT*COLOUR_CHANNELS + xo*CHUNK_SIZE*COLOUR_CHANNELS],
-                    &imgbuf[j*CHUNK_SIZE*COLOUR_CHANNELS],
-                    CHUNK_SIZE*COLOUR_CHANNELS );
-          }
-
-          aligned_free( imgbuf );
-          imgbuf = NULL;
-        }
-      }
+  /* Initialise libraries and global context. */
+  if( fxpo_library_init( NULL ) != FXPOS_OK ) {
+    FXPO_LOG_ERROR( "could not initialise fxpo" );
+    return EXIT_FAILURE;
+  }
 
-      FXPO_LOG_DEBUG( "built tile x=%u y=%u zl=%u", tile->x, tile->y, tile->zoom_level );
+  struct fxpo_config_t config;
+  fxpo_config_default( &config );
+  config.scenery_path            = scenery_path;
+  config.threads                 = max_parallel;
+  config.max_memory              = opts.max_memory;
+  config.max_requests_per_second = opts.max_requests_per_second;
+  config.max_bytes_per_second    = (double)opts.max_bytes_per_second;
+  config.texture_size            = opts.chunks_per_side * CHUNK_SIZE;
+  config.resize_filter           = opts.resize_filter;
+  config.mode                    = opts.mode;
+  config.cache_path              = opts.cache_path;
+  config.huge_pages              = opts.huge_pages;
+  config.pin_threads             = opts.pin_threads;
+  config.warm_connections        = opts.warm_connections;
+  config.tolerant                = opts.tolerant;
+  config.scaled_mips             = opts.scaled_mips;
+  config.record_path             = opts.record_path;
+  config.replay_path             = opts.replay_path;
+  config.replay_latency          = opts.replay_latency;
+
+  /* Progress is reported for the tiles of a batch. The daemon has no end to estimate. */
+  struct fxpo_progress_t progress;
+  const bool             report_progress = !opts.daemon && opts.progress_interval >= 0;
+  if( report_progress ) {
+    fxpo_progress_new( &progress, opts.progress_interval );
+    config.progress      = fxpo_progress_on_stage;
+    config.progress_user = &progress;
+  }
 
-      char dds_path[MAX_PATH_LENGTH];
-      fxpo_ortho_build_dds_path( scenery_path, tileset, tile, dds_path, sizeof(dds_path) );
+  /* Only the daemon mixes priorities. */
+  if( opts.daemon ) {
+    config.interactive_workers = DAEMON_INTERACTIVE_WORKERS( max_parallel );
+    config.max_queued          = DAEMON_QUEUE_CAPACITY;
+    FXPO_LOG_INFO( "%zu workers reserved for interactive tiles", config.interactive_workers );
+  }
 
-      FXPO_LOG_DEBUG( "compressing tile to dds=%s", dds_path );
-      fxpo_nvtt3_compress( &nvtt_ctx, TILE_WIDTH, TILE_HEIGHT, tile_imgbuf, dds_path );
-      FXPO_LOG_INFO( "saved compressed tile to dds=%s", dds_path );
+  struct fxpo_context_t * ctx;
+  if( fxpo_context_new( &config, &ctx ) != FXPOS_OK ) {
+    FXPO_LOG_ERROR( "could not start workers" );
+    if( report_progress ) fxpo_progress_free( &progress );
+    fxpo_library_clean();
+    return EXIT_FAILURE;
+  }
 
-cleanup:
-      for( size_t i = 0; i < CHUNKS_PER_TILE; i++ ) fxpo_http_data_reset( &res[i] );
-      if( imgbuf != NULL ) aligned_free( imgbuf );
-    } /* for end */
+  if( (fetch_only || offline) && opts.cache_path != NULL ) FXPO_LOG_INFO( "chunk cache=%s", opts.cache_path );
+
+  fxpo_signal_ctx = ctx;
+  signal( SIGINT, fxpo_on_signal );
+  signal( SIGTERM, fxpo_on_signal );
+
+  bool abort = false;
+
+  if( opts.daemon ) {
+    abort = fxpo_daemon_run( ctx, opts.port ) != FXPOS_OK;
+  } else {
+    struct fxpo_batch_t batch = { .ctx = ctx, .progress = report_progress ? &progress : NULL, .tolerant = opts.tolerant, .failed = 0 };
+    fxpo_mutex_new( &batch.lock );
+
+    /* Tolerant runs building textures update the list. It is written aside and only replaces the
+       previous one once the run is over, carrying over the listed textures that did not complete. */
+    char degraded_path[MAX_PATH_LENGTH];
+    char degraded_tmp_path[MAX_PATH_LENGTH + 8];
+    snprintf( degraded_path, sizeof(degraded_path), "%s/zOrtho4XP_%s/" DEGRADED_LIST_NAME, scenery_path, tileset );
+    snprintf( degraded_tmp_path, sizeof(degraded_tmp_path), "%s.tmp", degraded_path );
+    if( opts.tolerant && !fetch_only ) {
+      fxpo_batch_read_degraded( &batch, degraded_path );
+      if( (batch.degraded = fopen( degraded_tmp_path, "w" )) == NULL ) FXPO_LOG_WARN( "could not write list of degraded textures to %s", degraded_tmp_path );
+    }
+
+    const struct fxpo_request_t request = {
+      .tileset  = tileset,
+      .priority = FXPO_PRIORITY_BACKGROUND,
+      /* Batch runs always rebuild the textures referenced by the tileset. */
+      .rebuild  = true,
+      .done     = fxpo_batch_done,
+      .queued   = fxpo_batch_queued,
+      .user     = &batch,
+    };
+
+    FXPO_LOG_INFO( "searching scenery_path=\"%s\" tileset=%s", scenery_path, tileset );
+
+    size_t           tile_num = 0;
+    enum fxpo_status status   = FXPOS_OK;
+    if( opts.retry_degraded ) {
+      if( batch.listed_len > 0 ) status = fxpo_batch_queue_degraded( ctx, request, &batch, batch.progress, &tile_num );
+      else FXPO_LOG_INFO( "no degraded textures listed in %s", degraded_path );
+    } else {
+      status = fxpo_context_build_tileset( ctx, &request, &tile_num );
+    }
+
+    if( status == FXPOS_OK ) {
+      FXPO_LOG_INFO( "loaded %zu tiles", tile_num );
+
+      if( report_progress ) fxpo_progress_run( &progress, ctx, tile_num );
+      fxpo_context_wait( ctx );
+      abort = fxpo_atomic_load( &batch.failed ) > 0;
+
+      struct fxpo_stats_t stats;
+      fxpo_context_stats( ctx, &stats );
+      FXPO_LOG_INFO( "built %llu tiles, decoded %llu chunks, reused %llu identical chunks",
+                     (unsigned long long)stats.tiles_built, (unsigned long long)stats.chunks_decoded, (unsigned long long)stats.chunks_deduplicated );
+      if( stats.tiles_degraded > 0 ) {
+        FXPO_LOG_WARN( "%llu tiles were built with chunks filled in, rebuild them with --retry-degraded",
+                       (unsigned long long)stats.tiles_degraded );
+      }
+    } else if( status == FXPOS_NOT_FOUND ) {
+      FXPO_LOG_ERROR( "no terrain files found in scenery_path=\"%s\" tileset=%s", scenery_path, tileset );
+      abort = true;
+    } else {
+      FXPO_LOG_ERROR( "could not queue tileset=%s: %s", tileset, fxpo_status_str( status ) );
+      abort = true;
+    }
+
+    /* Requests queued before a failure may still be running. */
+    fxpo_context_cancel_all( ctx );
+    fxpo_context_wait( ctx );
+
+    if( batch.degraded != NULL ) fxpo_batch_write_degraded( &batch, degraded_tmp_path, degraded_path );
+    fxpo_free( batch.listed_done );
+    fxpo_free( batch.listed );
+    fxpo_free( batch.listed_buf );
+    fxpo_mutex_free( &batch.lock );
+  }
 
-    aligned_free( tile_imgbuf );
-    for( size_t i = 0; i < CHUNKS_PER_TILE; i++ ) fxpo_http_data_free( &res[i] );
-    fxpo_http_multi_context_free( &http_ctx );
-  } /* omp parallel end */
+  if( fxpo_context_is_interrupted( ctx ) ) {
+    FXPO_LOG_WARN( "interrupted" );
+    abort = true;
+  }
 
   /* Clean up. */
-  for( size_t i = 0; i < tile_num; i++ ) free( tiles[i] );
-  free( tiles );
-  fxpo_http_clean();
-  fxpo_nvtt3_context_free( &nvtt_ctx );
+  signal( SIGINT, SIG_DFL );
+  signal( SIGTERM, SIG_DFL );
+  fxpo_signal_ctx = NULL;
+  fxpo_context_free( ctx );
+  if( report_progress ) fxpo_progress_free( &progress );
+  fxpo_library_clean();
 
   if( abort ) {
     FXPO_LOG_ERROR( "aborted!" );